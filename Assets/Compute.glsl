@@ -43,76 +43,278 @@ rendering.
 // Compute shaders are part of openGL core since version 4.3
 #version 430
 
-// This will just run once for each particle.
-layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+// This runs once for each vertex, and once for each triangle, of every
+// instance that moved (see calcTransformJobs in main.cpp). A group has
+// TRANSFORM_GROUP_SIZE threads, so that the GPU can run a whole group of
+// vertices side by side, instead of one thread in every group.
+layout(local_size_x = TRANSFORM_GROUP_SIZE) in;
 
-#define MAX_MESHES 7
-#define MAX_TRIANGLES_PER_MESH 1486 // biggest mesh is 1486 triangles
-#define NUM_TRIANGLES_IN_SCENE 1554 // This is calculated in the console window
+// How many vertices there are in all the jobs put together,
+// the threads after that many work on the triangles
+uniform int numJobVertices;
 
-struct InTriangle 
+// How many jobs there are, and how many threads have work, vertices and
+// triangles put together. The last group hangs over the end of the work.
+uniform int numJobs;
+uniform int numJobThreads;
+
+// MAX_MESHES, MAX_INSTANCES, TRANSFORM_GROUP_SIZE, and TRANSFORM_LINEAR_SEARCH
+// are not typed in here, createShader() in main.cpp counts them after the
+// scene is loaded, and puts a #define for each of them right after the #version line
+
+// Same as struct Vertex in Scene.h, the uv is
+// split into the 4th float after each vec3
+struct Vertex
 {
-	vec4 pos[3];
-	vec4 uv[3];
-	vec4 normal[3];
+	vec3 pos;
+	float u;
+	vec3 normal;
+	float v;
 };
 
-struct Mesh
+// Where the vertices of one mesh are in inGeometry.v, and
+// where the indices of its triangles are in inIndices.i
+struct MeshRange
 {
+	int firstTriangle;
 	int numTriangles;
-	int junk1;
-	int junk2;
-	int junk3;
-	InTriangle t[MAX_TRIANGLES_PER_MESH];
+	int firstVertex;
+	int numVertices;
+};
+
+// Same as struct Instance in Scene.h
+struct Instance
+{
+	mat4 objectToWorld;
+	mat4 worldToObject;
+	int mesh;
+	int transform;
+	int texture;
+	int mask;
+	int bvhRoot;
+	int firstTriangle;
+	int firstVertex;
+	int firstIndex;
+	int model;
+	int shadowMesh;
+	int shadowBvhRoot;
+	int shadowFirstTriangle;
 };
 
 // A layout describing the vertex buffer.
+// Every instance gets its own copy of its mesh's vertices in here,
+// moved into world space, starting at the instance's firstVertex
 layout(binding = 0) buffer b0
 {
-	Mesh m[MAX_MESHES];
+	Vertex v[];
 } outBuffer;
 
+// The vertices of every mesh, one mesh after another
 layout (binding = 1) buffer b1
 {
-	Mesh m[MAX_MESHES];
+	Vertex v[];
 } inGeometry;
 
 layout (binding = 2) buffer b2
 {
-	mat4x4 m[MAX_MESHES];
+	mat4x4 m[];
 } inMatrices;
 
+// 3 for every triangle of every mesh, they count from the mesh's firstVertex
+layout (binding = 3) buffer b3
+{
+	uint i[];
+} inIndices;
+
+// The world space box around every instance. Every vertex grows the box of
+// its instance to fit around itself, so when all the vertices are done, the
+// box fits tightly around the whole instance. main.cpp resets these to an
+// "empty" box every frame, before this shader runs.
+// The numbers are floats that were converted with floatToOrderedInt,
+// because atomicMin and atomicMax only work on integers.
+layout (binding = 4) buffer b4
+{
+	ivec4 boundsMin[MAX_INSTANCES];
+	ivec4 boundsMax[MAX_INSTANCES];
+} outBounds;
+
+// Which mesh, and which matrix, every instance uses
+layout (binding = 5) buffer b5
+{
+	Instance instances[MAX_INSTANCES];
+} inInstances;
+
+// Where every mesh is in inGeometry and inIndices
+layout (binding = 6) buffer b6
+{
+	MeshRange ranges[MAX_MESHES];
+} inMeshes;
+
+// The TrianglePositions (see Scene.h) of every instance's triangles, 9 floats
+// each, starting at the instance's firstTriangle. The fragment shader tests
+// the rays against these, without reading the whole vertices.
+layout (binding = 7) buffer b7
+{
+	float p[];
+} outPositions;
+
+// Same as struct TransformJob in Scene.h, one instance to move, and how
+// many vertices and triangles all the jobs before it have put together
+struct TransformJob
+{
+	int instance;
+	int firstVertex;
+	int firstTriangle;
+	int junk1;
+};
+
+// The instances that moved since the last frame, in the order of the instance table
+layout (binding = 8) buffer b8
+{
+	TransformJob jobs[];
+} inJobs;
+
+// If a float is positive, then its bits, read as an int, get bigger
+// when the float gets bigger. If it is negative, they get smaller, so
+// we flip all the bits except the sign to make negative floats sort
+// the right way too. Then min and max of the ints give the same answer
+// as min and max of the floats. FragmentShader.glsl flips them back.
+int floatToOrderedInt(float f)
+{
+	int i = floatBitsToInt(f);
+	return i >= 0 ? i : i ^ 0x7FFFFFFF;
+}
+
+// Gives back the job that vertex (or triangle) "i" of all the jobs put together
+// is in, the last job that starts at or before it. The jobs are in order, so
+// this cuts the jobs it could be in in half every step, instead of walking
+// through them one at a time. A job with no vertices starts at the same
+// place as the job after it, so it is never the last one to start there.
+int findJob(uint i, bool triangles)
+{
+#if TRANSFORM_LINEAR_SEARCH
+	// The old way, only for the transform benchmark to compare with
+	int job = 0;
+
+	while (job + 1 < numJobs && uint(triangles ? inJobs.jobs[job + 1].firstTriangle : inJobs.jobs[job + 1].firstVertex) <= i)
+		job++;
+
+	return job;
+#else
+	int low = 0;
+	int high = numJobs - 1;
+
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+		int first = triangles ? inJobs.jobs[middle].firstTriangle : inJobs.jobs[middle].firstVertex;
+
+		if (uint(first) <= i)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	return low;
+#endif
+}
+
+// Moves vertex "i" of all the jobs put together
+void transformVertex(uint i)
+{
+	int job = findJob(i, false);
+	int instanceIndex = inJobs.jobs[job].instance;
+
+	// count is the vertex index of the instance
+	// that is being processed
+	uint count = i - uint(inJobs.jobs[job].firstVertex);
+
+	// where the vertex is read from, and written to
+	uint src = inMeshes.ranges[inInstances.instances[instanceIndex].mesh].firstVertex + count;
+	uint dst = inInstances.instances[instanceIndex].firstVertex + count;
+
+	mat4x4 matrix = inMatrices.m[inInstances.instances[instanceIndex].transform];
+
+	Vertex vertex = inGeometry.v[src];
+
+	// multiply point by model matrix, and then export to fragment shader buffer
+	vec3 point = (matrix * vec4(vertex.pos, 1)).xyz;
+	outBuffer.v[dst].pos = point;
+
+	// multiply normal by model matrix, and then export to fragment shader buffer
+	outBuffer.v[dst].normal = normalize(mat3(matrix) * vertex.normal);
+
+	// The UVs don't move, but many instances share one mesh, so
+	// the output buffer can't be filled with the meshes in advance
+	outBuffer.v[dst].u = vertex.u;
+	outBuffer.v[dst].v = vertex.v;
+
+	// grow the box of the instance to fit this vertex
+	atomicMin(outBounds.boundsMin[instanceIndex].x, floatToOrderedInt(point.x));
+	atomicMin(outBounds.boundsMin[instanceIndex].y, floatToOrderedInt(point.y));
+	atomicMin(outBounds.boundsMin[instanceIndex].z, floatToOrderedInt(point.z));
+	atomicMax(outBounds.boundsMax[instanceIndex].x, floatToOrderedInt(point.x));
+	atomicMax(outBounds.boundsMax[instanceIndex].y, floatToOrderedInt(point.y));
+	atomicMax(outBounds.boundsMax[instanceIndex].z, floatToOrderedInt(point.z));
+}
+
+// Writes the TrianglePositions of triangle "i" of all the jobs put
+// together. The corners are moved exactly the same way transformVertex
+// moves them, so the rays hit the same points that are shaded.
+void transformTriangle(uint i)
+{
+	int job = findJob(i, true);
+	int instanceIndex = inJobs.jobs[job].instance;
+	uint count = i - uint(inJobs.jobs[job].firstTriangle);
+
+	MeshRange range = inMeshes.ranges[inInstances.instances[instanceIndex].mesh];
+	mat4x4 matrix = inMatrices.m[inInstances.instances[instanceIndex].transform];
+
+	uint src = 3 * (range.firstTriangle + count);
+	vec3 p[3];
+
+	for (int k = 0; k < 3; k++)
+	{
+		p[k] = (matrix * vec4(inGeometry.v[range.firstVertex + inIndices.i[src + k]].pos, 1)).xyz;
+	}
+
+	vec3 e1 = p[1] - p[0];
+	vec3 e2 = p[2] - p[0];
+
+	uint dst = 9 * (inInstances.instances[instanceIndex].firstTriangle + count);
+
+	outPositions.p[dst + 0] = p[0].x;
+	outPositions.p[dst + 1] = p[0].y;
+	outPositions.p[dst + 2] = p[0].z;
+	outPositions.p[dst + 3] = e1.x;
+	outPositions.p[dst + 4] = e1.y;
+	outPositions.p[dst + 5] = e1.z;
+	outPositions.p[dst + 6] = e2.x;
+	outPositions.p[dst + 7] = e2.y;
+	outPositions.p[dst + 8] = e2.z;
+}
+
 // Declare main program function which is executed when
 void main()
 {
 	// Get the index of this object into the buffer
 	uint i = gl_GlobalInvocationID.x;
 
-	int meshIndex = 0;
-	uint count = i;
-	
-	// count is the triangle index of the mesh
-	// that is being processed
-
-	while(count >= inGeometry.m[meshIndex].numTriangles)
+	// the threads at the end of the last group have nothing to do
+	if (i >= uint(numJobThreads))
 	{
-		count -= inGeometry.m[meshIndex].numTriangles;
-		meshIndex++;
+		return;
 	}
 
-	for(int j = 0; j < 3; j++)
+	// The first threads move the vertices, which the fragment shader
+	// shades with, the rest make the triangle positions that the rays
+	// are tested against
+	if (i < uint(numJobVertices))
 	{
-		// multiply point by model matrix, and then export to fragment shader buffer
-		vec4 point = inMatrices.m[meshIndex] * inGeometry.m[meshIndex].t[count].pos[j];
-		outBuffer.m[meshIndex].t[count].pos[j] = point;
-
-		// multiply point by model matrix, and then export to fragment shader buffer
-		vec3 normal = mat3(inMatrices.m[meshIndex]) * inGeometry.m[meshIndex].t[count].normal[j].xyz;
-		outBuffer.m[meshIndex].t[count].normal[j] = vec4(normalize(normal), 1);
+		transformVertex(i);
 	}
-
-	// The color of each mesh, the UV coordinates, and the number of
-	// triangles per mesh, are already in the output buffer. An 
-	// explanation of how this is possible is written in the main.cpp
-	// file in the init() function
-}
\ No newline at end of file
+	else
+	{
+		transformTriangle(i - uint(numJobVertices));
+	}
+}
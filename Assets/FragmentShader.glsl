@@ -38,10 +38,26 @@ cube from the triangles array in the Fragment Shader (and also adjusting
 NUM_TRIANGLES accordingly). There are many optimization techniques out 
 there, but ultimately Ray Tracing is not typically used for Real-Time 
 rendering.
+
+With COMPUTE_TRACE, main.cpp compiles this same file as a compute shader
+instead. Every group of threads traces one TRACE_TILE_SIZE x TRACE_TILE_SIZE
+tile of pixels, which are close together on the screen, so their rays go
+through the same boxes of the BVH. Every pixel is written into traceImage,
+which main.cpp copies to the screen afterwards.
+
+With WAVEFRONT_TRACE, main.cpp compiles it into five compute shaders, one
+for every pass in Wavefront.h, and WAVEFRONT_STAGE says which pass it is.
+The passes only talk to each other through the queues at the bottom of
+this file, so each one only has the registers and branches of its own step.
 */
 
 #version 430 // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
 
+// Only the passes of WAVEFRONT_TRACE are given a WAVEFRONT_STAGE
+#ifndef WAVEFRONT_STAGE
+#define WAVEFRONT_STAGE 0
+#endif
+
 // The uniform variables, these storing the camera position and the four corner rays of the camera's view.
 uniform vec3 eye;
 uniform vec3 ray00;
@@ -49,11 +65,28 @@ uniform vec3 ray01;
 uniform vec3 ray10;
 uniform vec3 ray11;
 
+#if WAVEFRONT_STAGE
+// One thread for every entry of a queue, or every pixel of a tile in generate
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+// The picture, which resolve writes
+layout(rgba8, binding = 0) uniform writeonly image2D traceImage;
+
+// How big the picture is, in pixels
+uniform ivec2 screenSize;
+#elif COMPUTE_TRACE
+// One thread for every pixel of a tile, TRACE_TILE_PIXELS is TRACE_TILE_SIZE squared
+layout(local_size_x = TRACE_TILE_PIXELS) in;
+
+// The picture, the same size as the window
+layout(rgba8, binding = 0) uniform writeonly image2D traceImage;
+#else
 // The input textureCoord relative to the quad as given by the Vertex Shader.
 in vec2 textureCoord;
 
 // The output of the Fragment Shader, AKA the pixel color.
 out vec4 color;
+#endif
 
 struct light 
 {
@@ -68,34 +101,69 @@ struct light
 // Create some constants
 #define MAX_SCENE_BOUNDS 100.0
 
-#define MAX_LIGHTS 1
-#define MAX_MESHES 7
-#define MAX_TRIANGLES_PER_MESH 1486 // biggest mesh is 1486 triangles
-#define NUM_TRIANGLES_IN_SCENE 1554 // This is calculated in the console window
+// MAX_LIGHTS, MAX_MESHES, MAX_INSTANCES, MAX_TEXTURES, BVH_MAX_DEPTH,
+// TWO_LEVEL_BVH, SHADOW_RAY_BIAS, and the INSTANCE_MASK_ bits are not typed in here.
+// createShader() in main.cpp counts the scene after it is loaded, and
+// puts a #define for each of them right after the #version line, with
+// the same values that Scene.h and BVH.h give the C++ code.
 
+// The uvs and normals of the three corners of the triangle that a ray
+// hit, see getHitTriangle. The positions are not needed, the hitinfo
+// already says where on the triangle the ray hit.
 struct InTriangle 
 {
-	vec4 pos[3];
-	vec4 uv[3];
-	vec4 normal[3];
+	vec2 uv[3];
+	vec3 normal[3];
 };
 
-struct Mesh
+// Same as struct Vertex in Scene.h, the uv is
+// split into the 4th float after each vec3
+struct Vertex
 {
-	int numTriangles;
-	int junk1;
-	int junk2;
-	int junk3;
-	InTriangle t[MAX_TRIANGLES_PER_MESH];
+	vec3 pos;
+	float u;
+	vec3 normal;
+	float v;
 };
 
 // texture that we will use
-uniform sampler2D textureTest[MAX_MESHES];
+uniform sampler2D textureTest[MAX_TEXTURES];
+
+#if COMPUTE_TRACE && !WAVEFRONT_STAGE
+// In a fragment shader, texture() picks the mip level from how much the
+// uv changes from one pixel to the next, which the GPU gets by comparing
+// the pixels of every 2x2 quad. A compute shader has no quads, so every
+// pixel of the tile puts its uv in here, and main() compares them itself.
+shared vec2 tileUV[TRACE_TILE_SIZE][TRACE_TILE_SIZE];
+shared int tileTexture[TRACE_TILE_SIZE][TRACE_TILE_SIZE];
+#endif
+
+#if COMPUTE_TRACE || WAVEFRONT_STAGE
+// How much the uv changes to the next pixel on the right, and the next
+// pixel up, for the surface that the camera ray of this pixel hit
+vec2 uvDx;
+vec2 uvDy;
+
+// Where thread i of a group is in its square tile of pixels. The threads go through
+// the tile in Z order (every other bit of the thread's number is x, the rest are y),
+// so threads 0 to 3 are the first 2x2 quad, 4 to 7 the next one, and so on. The GPU
+// runs threads that are next to each other together, so they are pixels that are
+// next to each other in both directions, not a long row, like in a fragment shader.
+ivec2 zOrderPixel(uint i)
+{
+	return ivec2(
+		(i & 1u) | ((i >> 1u) & 2u) | ((i >> 2u) & 4u) | ((i >> 3u) & 8u),
+		((i >> 1u) & 1u) | ((i >> 2u) & 2u) | ((i >> 3u) & 4u) | ((i >> 4u) & 8u));
+}
+#endif
 
-// A layout describing the vertex buffer.
+// A layout describing the vertex buffer, the vertices of every mesh one after another.
+// With TWO_LEVEL_BVH, this is every mesh in object space.
+// Otherwise it is a copy of every instance's mesh in world space.
+// Either way, the vertices that an instance uses start at the instance's firstVertex.
 layout(binding = 0) buffer vertexBlock
 {
-	Mesh m[MAX_MESHES];
+	Vertex vertices[];
 };
 
 layout (binding = 1) buffer lightBlock
@@ -103,25 +171,130 @@ layout (binding = 1) buffer lightBlock
 	light lights[MAX_LIGHTS];
 };
 
+// One box in a Bounding Volume Hierarchy, see BVH.h for how the trees are built.
+// If count is 0, leftFirst is the index of the left child, and the right child is leftFirst + 1.
+// If count is not 0, this is a leaf, and bvhTriangles[leftFirst] to bvhTriangles[leftFirst + count - 1]
+// are the triangles inside of the box.
+struct BVHNode
+{
+	vec3 boundsMin;
+	int leftFirst;
+	vec3 boundsMax;
+	int count;
+};
+
+// Every mesh has its own tree, all of the trees are in this one array
+layout (binding = 2) buffer bvhNodeBlock
+{
+	BVHNode bvhNodes[];
+};
+
+// The triangle indices that the leaves point to, they start at 0 for every mesh
+layout (binding = 3) buffer bvhTriangleBlock
+{
+	int bvhTriangles[];
+};
+
+// The index of the root node of every instance's tree, -1 if the mesh is empty
+uniform int bvhRoot[MAX_INSTANCES];
+
+// Without TWO_LEVEL_BVH, the instances that can cast a shadow from each light
+// (see ShadowCasters in Scene.h). Light l has numShadowCasters[l] of them,
+// starting at shadowCasters[l * MAX_INSTANCES].
+uniform int numShadowCasters[MAX_LIGHTS];
+uniform int shadowCasters[MAX_LIGHTS * MAX_INSTANCES];
+
+// The world space box around every instance (its hitbox), made by
+// Compute.glsl while it transforms the triangles. The numbers are
+// floats that were converted to ints, see orderedIntToFloat.
+layout (binding = 4) buffer meshBoundsBlock
+{
+	ivec4 meshBoundsMin[MAX_INSTANCES];
+	ivec4 meshBoundsMax[MAX_INSTANCES];
+};
+
+// One copy of a mesh in the scene, same as struct Instance in Scene.h.
+// The triangles of the mesh are in object space, so a ray is multiplied
+// by worldToObject to move it into the same space as the triangles.
+struct Instance
+{
+	mat4 objectToWorld;
+	mat4 worldToObject;
+	int mesh;
+	int transform;
+	int texture;
+	int mask;
+	int bvhRoot;
+	int firstTriangle;
+	int firstVertex;
+	int firstIndex;
+	int model;
+	int shadowMesh;
+	int shadowBvhRoot;
+	int shadowFirstTriangle;
+};
+
+layout (binding = 5) buffer instanceBlock
+{
+	Instance instances[MAX_INSTANCES];
+};
+
+// 3 for every triangle of every mesh, the vertices at its corners. Triangle t of
+// an instance is indices[firstIndex + 3 * t] and the two after it, and they
+// count from the instance's firstVertex, so every instance of a mesh uses them.
+layout (binding = 6) buffer indexBlock
+{
+	uint indices[];
+};
+
+// 9 floats for every triangle, the first corner and the two edges
+// from it (see TrianglePositions in Scene.h). Triangle t of an instance
+// starts at trianglePositions[9 * (firstTriangle + t)]. Rays are only
+// tested against these, which are packed tightly, so the vertices,
+// with their normals and uvs, are only read for the triangle that is hit.
+// Same as the vertices, these are in object space with TWO_LEVEL_BVH,
+// otherwise Compute.glsl writes a world space copy for every instance.
+layout (binding = 7) buffer positionBlock
+{
+	float trianglePositions[];
+};
+
+// The root of the top level tree, which is in bvhNodes right after the trees
+// of the meshes. Its leaves point to instances (bvhTriangles holds instance indices).
+uniform int topLevelRoot;
+
+// The root of the top level tree of every light, over only the instances that
+// can cast a shadow from it, -1 if there are none (see buildTopLevelBVH)
+uniform int shadowRoot[MAX_LIGHTS];
+
+// Everything about where a ray hit, filled in while the ray is traced,
+// so that the shading never has to work any of it out again
 struct hitinfo
 {
+	// where the ray hit, and how far along the ray that is
 	vec3 point;
+	float dist;
+
+	// which instance, and which triangle of the instance's mesh
 	int m;
 	int t;
+
+	// How far the hit is along the two edges of the triangle (u and v in
+	// rayIntersectsTriangle). The corners are weighted (1 - u - v), u, and v.
+	vec2 bary;
 };
 
 // Determines whether or not a ray in a given direction hits a given triangle.
 // Returns -1.0 if it does not; otherwise returns the value t at which the ray hits the triangle, which can be used to determine the point of collision.
-// p is point on ray, d is ray direction, v0, v1, and v2 are points of the triangle.
-float rayIntersectsTriangle(vec3 p, vec3 d, vec3 v0, vec3 v1, vec3 v2)
+// p is point on ray, d is ray direction, v0 is the first point of the triangle,
+// and e1 and e2 are the two edges of the triangle that start at v0. The edges are
+// worked out once for every triangle (see TrianglePositions in Scene.h), instead of for every ray.
+// If the ray hits, bary is set to u and v, which the shading uses to blend the corners.
+float rayIntersectsTriangle(vec3 p, vec3 d, vec3 v0, vec3 e1, vec3 e2, out vec2 bary)
 {
-	vec3 e1,e2,h,s,q;
+	vec3 h,s,q;
 	float a,f,u,v, t;
 
-	// Get two edges of triangle
-	e1 = vec3(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
-	e2 = vec3(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z);
-	
 	// Cross ray direction with triangle edge
 	h = cross(d, e2);
 	
@@ -168,6 +341,7 @@ float rayIntersectsTriangle(vec3 p, vec3 d, vec3 v0, vec3 v1, vec3 v2)
 	if (t > 0.00001)
 	{
 		// The ray does intersect the triangle, and we return the t value.
+		bary = vec2(u, v);
 		return t;
 	}
 	
@@ -175,66 +349,337 @@ float rayIntersectsTriangle(vec3 p, vec3 d, vec3 v0, vec3 v1, vec3 v2)
 	return -1.0;
 }
 
-// Given an origin point, a direction, and a variable to pass information back out to, this will test a ray against every triangle in the scene.
-// It will then return true or false, based on whether or not the ray collided with anything.
-// If it did, then the hitinfo object will be filled with a point of collision and an index referring to which triangle it intersects with first.
-bool intersectTriangles(vec3 origin, vec3 dir, out hitinfo info)
+// Slab test: determines whether or not a ray hits a box.
+// The ray enters and leaves the space between the two planes of the box on each axis (a slab) at two distances.
+// If the ray is inside all three slabs at the same time, it is inside the box.
+// Returns -1.0 if it does not hit the box; otherwise returns the distance at which the ray enters the box (0 if the ray starts inside).
+// invDir is 1.0 / ray direction, it is computed once per ray, because divides are slow.
+float rayIntersectsBox(vec3 p, vec3 invDir, vec3 boundsMin, vec3 boundsMax)
 {
-	// Start our variables for determining the closest triangle.
-	// Smallest will be the smallest distance between the origin point and the point of collision.
-	// Found just determines whether or not there was a collision at all.
-	float smallest = MAX_SCENE_BOUNDS;
+	// Distance along the ray to each plane of the box
+	vec3 t0 = (boundsMin - p) * invDir;
+	vec3 t1 = (boundsMax - p) * invDir;
+
+	// Sort them, so that we know where we enter and leave each slab
+	vec3 tSmall = min(t0, t1);
+	vec3 tBig = max(t0, t1);
+
+	// We are inside the box after entering the last slab, and until leaving the first slab
+	float tNear = max(max(tSmall.x, tSmall.y), tSmall.z);
+	float tFar = min(min(tBig.x, tBig.y), tBig.z);
+
+	// If we leave a slab before entering all of them, or the box is behind the ray, then there's no collision.
+	if (tFar < max(tNear, 0.0))
+	{
+		return -1.0;
+	}
+
+	return max(tNear, 0.0);
+}
+
+// Undo floatToOrderedInt from Compute.glsl
+float orderedIntToFloat(int i)
+{
+	return intBitsToFloat(i >= 0 ? i : i ^ 0x7FFFFFFF);
+}
+
+vec3 orderedIntToFloat(ivec3 i)
+{
+	return vec3(orderedIntToFloat(i.x), orderedIntToFloat(i.y), orderedIntToFloat(i.z));
+}
+
+// Checks if a ray collides with a mesh's hitbox, returns -1.0 if it doesn't,
+// otherwise the distance to the hitbox. If the ray misses the hitbox, or the
+// hitbox is farther than a triangle we already hit, there's no reason to
+// check any of the mesh's triangles.
+float rayIntersectsMesh(int i, vec3 p, vec3 invDir)
+{
+	vec3 boundsMin = orderedIntToFloat(meshBoundsMin[i].xyz);
+	vec3 boundsMax = orderedIntToFloat(meshBoundsMax[i].xyz);
+
+	return rayIntersectsBox(p, invDir, boundsMin, boundsMax);
+}
+
+// 1.0 / direction, without dividing by zero when the ray is parallel to an axis
+vec3 inverseDirection(vec3 dir)
+{
+	vec3 s = vec3(dir.x < 0.0 ? -1.0 : 1.0, dir.y < 0.0 ? -1.0 : 1.0, dir.z < 0.0 ? -1.0 : 1.0);
+	return s / max(abs(dir), vec3(0.00000001));
+}
+
+// Tests a ray against the triangles of one mesh, using the mesh's BVH.
+// Starting at the root, every box that the ray hits has its two children tested, and the
+// closer child is visited first, while the other child is saved on a stack for later.
+// When a leaf is reached, its few triangles are tested just like the old loop did.
+// Boxes that are farther away than the closest triangle found so far (smallest) are skipped.
+// If anyHit is true, this returns as soon as it finds any triangle at all.
+// The mesh's triangles start at trianglePositions[9 * firstTriangle].
+// Only info.t and info.bary are set here, the caller knows which mesh it asked for, and where the hit point is.
+bool intersectMeshBVH(int firstTriangle, int rootNode, vec3 origin, vec3 dir, vec3 invDir, bool anyHit, inout float smallest, inout hitinfo info)
+{
+	int nodeIndex = rootNode;
+
+	// empty mesh
+	if (nodeIndex < 0)
+	{
+		return false;
+	}
+
+	// The root box is not tested here, the ray already hit the
+	// mesh's hitbox (or the instance's box in the top level) to get here
+
+	// Nodes we still need to visit
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
 	bool found = false;
 
-	for(int i = 0; i < MAX_MESHES; i++)
+	while (true)
 	{
-		// Placeholder for future optimization
-		// Check if ray collides with mesh's hitbox
-		// before checking the triangles of the mesh
-		if(true)
+		BVHNode node = bvhNodes[nodeIndex];
+
+		// Leaf, check all triangles in the box
+		if (node.count > 0)
 		{
-			// check all triangles in the mesh
-			for(int j = 0; j < m[i].numTriangles; j++)
+			for (int k = 0; k < node.count; k++)
 			{
-				InTriangle t = m[i].t[j];
-
-				// If the dot product is 0, the vectors are 90 degrees apart (orthogonal or perpendicular).
-				// If the dot product is less than 0, the vectors are more than 90 degrees apart.
-				// If the dot product is greater than 0, the vectors are less than 90 degrees apart.
-
-				// If our direction can't hit the triangle
-				// skip this triangle, and check the next triangle
+				int j = bvhTriangles[node.leftFirst + k];
+				int p = 9 * (firstTriangle + j);
 
-				// We determine this, if all vertex normals on the triangle point
-				// away from the rays that are moving towards the triangle
+				// Only the corner and the edges are needed to test the triangle
+				vec3 v0 = vec3(trianglePositions[p], trianglePositions[p + 1], trianglePositions[p + 2]);
+				vec3 e1 = vec3(trianglePositions[p + 3], trianglePositions[p + 4], trianglePositions[p + 5]);
+				vec3 e2 = vec3(trianglePositions[p + 6], trianglePositions[p + 7], trianglePositions[p + 8]);
 
 				// Compute distance d using above function to determine how far along the ray the triangle collides.
-				float d = rayIntersectsTriangle(origin, dir, t.pos[0].xyz, t.pos[1].xyz, t.pos[2].xyz);
+				vec2 bary;
+				float d = rayIntersectsTriangle(origin, dir, v0, e1, e2, bary);
 
 				// If t = -1.0 then there was no intersection, we also ignore it if t is not < smallest, as that would mean we already found a triangle that 
 				// was closer (and thus collides first).
-				if(d != -1.0 && d < smallest)
+				if (d != -1.0 && d < smallest)
 				{
 					// This t becomes the new smallest.
 					smallest = d;
 
 					// color can be found via index as can the normal
-					// Thus, we just pass out a point of collision using t and the triangle index.
-					info.point = origin + (dir * d);
-					info.m = i;
 					info.t = j;
+					info.bary = bary;
 
 					// Make sure we set found to true, signifying that the ray collided with something.
 					found = true;
+
+					if (anyHit)
+					{
+						return true;
+					}
+				}
+			}
+		}
+
+		// Box with two children, check which ones the ray hits
+		else
+		{
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+
+			float dLeft = rayIntersectsBox(origin, invDir, bvhNodes[left].boundsMin, bvhNodes[left].boundsMax);
+			float dRight = rayIntersectsBox(origin, invDir, bvhNodes[right].boundsMin, bvhNodes[right].boundsMax);
+
+			// A box that starts after the closest triangle can't have anything closer in it
+			if (dLeft >= smallest)
+			{
+				dLeft = -1.0;
+			}
+
+			if (dRight >= smallest)
+			{
+				dRight = -1.0;
+			}
+
+			// Both hit, go into the closer one, and come back for the other one later
+			if (dLeft != -1.0 && dRight != -1.0)
+			{
+				if (dRight < dLeft)
+				{
+					stack[stackSize++] = left;
+					nodeIndex = right;
+				}
+				else
+				{
+					stack[stackSize++] = right;
+					nodeIndex = left;
+				}
+
+				continue;
+			}
+
+			// Only one hit, go into that one
+			if (dLeft != -1.0)
+			{
+				nodeIndex = left;
+				continue;
+			}
+
+			if (dRight != -1.0)
+			{
+				nodeIndex = right;
+				continue;
+			}
+		}
+
+		// Nothing left to do in this part of the tree,
+		// go back to a box that we saved for later
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIndex = stack[--stackSize];
+	}
+
+	return found;
+}
+
+// Tests a ray against every instance in the top level tree at "rootNode" that has every bit
+// of "mask", by walking down the tree. For every instance box that the ray hits, the ray is
+// moved into the instance's object space and tested against the tree of the instance's mesh.
+// The direction is not normalized after it is moved, so the distance to a triangle in object
+// space is the same as the distance in world space, and "smallest" works for every instance.
+bool intersectInstances(int rootNode, vec3 origin, vec3 dir, int mask, bool anyHit, inout float smallest, inout hitinfo info)
+{
+	int nodeIndex = rootNode;
+
+	// no instances
+	if (nodeIndex < 0)
+	{
+		return false;
+	}
+
+	vec3 invDir = inverseDirection(dir);
+
+	// Unlike the meshes, nothing tested the root box yet
+	float dRoot = rayIntersectsBox(origin, invDir, bvhNodes[nodeIndex].boundsMin, bvhNodes[nodeIndex].boundsMax);
+
+	if (dRoot == -1.0 || dRoot >= smallest)
+	{
+		return false;
+	}
+
+	// Nodes we still need to visit
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	bool found = false;
+
+	while (true)
+	{
+		BVHNode node = bvhNodes[nodeIndex];
+
+		// Leaf, check the instances in the box
+		if (node.count > 0)
+		{
+			for (int k = 0; k < node.count; k++)
+			{
+				int id = bvhTriangles[node.leftFirst + k];
+
+				// this kind of ray can't hit this instance
+				if ((instances[id].mask & mask) != mask)
+				{
+					continue;
+				}
+
+				// Move the ray into the object space of the instance
+				vec3 objectOrigin = (instances[id].worldToObject * vec4(origin, 1.0)).xyz;
+				vec3 objectDir = mat3(instances[id].worldToObject) * dir;
+
+				// Shadow rays go into the tree of the shadow LOD,
+				// which can have fewer triangles than the one the camera sees
+				int firstTriangle = instances[id].firstTriangle;
+				int root = instances[id].bvhRoot;
+
+				if ((mask & INSTANCE_MASK_SHADOW) != 0)
+				{
+					firstTriangle = instances[id].shadowFirstTriangle;
+					root = instances[id].shadowBvhRoot;
+				}
+
+				if (intersectMeshBVH(firstTriangle, root, objectOrigin, objectDir, inverseDirection(objectDir), anyHit, smallest, info))
+				{
+					info.m = id;
+					found = true;
+
+					if (anyHit)
+					{
+						return true;
+					}
+				}
+			}
+		}
+
+		// Box with two children, same as intersectMeshBVH
+		else
+		{
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+
+			float dLeft = rayIntersectsBox(origin, invDir, bvhNodes[left].boundsMin, bvhNodes[left].boundsMax);
+			float dRight = rayIntersectsBox(origin, invDir, bvhNodes[right].boundsMin, bvhNodes[right].boundsMax);
+
+			if (dLeft >= smallest)
+			{
+				dLeft = -1.0;
+			}
+
+			if (dRight >= smallest)
+			{
+				dRight = -1.0;
+			}
+
+			if (dLeft != -1.0 && dRight != -1.0)
+			{
+				if (dRight < dLeft)
+				{
+					stack[stackSize++] = left;
+					nodeIndex = right;
 				}
+				else
+				{
+					stack[stackSize++] = right;
+					nodeIndex = left;
+				}
+
+				continue;
+			}
+
+			if (dLeft != -1.0)
+			{
+				nodeIndex = left;
+				continue;
 			}
+
+			if (dRight != -1.0)
+			{
+				nodeIndex = right;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
 		}
+
+		nodeIndex = stack[--stackSize];
 	}
 
 	return found;
 }
 
-bool rayHitCar(vec3 origin, vec3 dir, out hitinfo info)
+// Given an origin point, a direction, and a variable to pass information back out to, this will test a ray against every triangle in the scene.
+// It will then return true or false, based on whether or not the ray collided with anything.
+// If it did, then the hitinfo object will be filled with a point of collision and an index referring to which triangle it intersects with first.
+bool intersectTriangles(vec3 origin, vec3 dir, out hitinfo info)
 {
 	// Start our variables for determining the closest triangle.
 	// Smallest will be the smallest distance between the origin point and the point of collision.
@@ -242,140 +687,219 @@ bool rayHitCar(vec3 origin, vec3 dir, out hitinfo info)
 	float smallest = MAX_SCENE_BOUNDS;
 	bool found = false;
 
-	// only check the car and tires
-	for(int i = 2; i < MAX_MESHES; i++)
+#if TWO_LEVEL_BVH
+	found = intersectInstances(topLevelRoot, origin, dir, INSTANCE_MASK_CAMERA, false, smallest, info);
+#else
+	vec3 invDir = inverseDirection(dir);
+
+	for(int i = 0; i < MAX_INSTANCES; i++)
 	{
-		// Placeholder for future optimization
 		// Check if ray collides with mesh's hitbox
 		// before checking the triangles of the mesh
-		if(true)
+		float dHitbox = rayIntersectsMesh(i, origin, invDir);
+
+		if(dHitbox != -1.0 && dHitbox < smallest)
 		{
-			// check all triangles in the mesh
-			for(int j = 0; j < m[i].numTriangles; j++)
+			// check the triangles in the mesh that the ray can hit
+			if (intersectMeshBVH(instances[i].firstTriangle, bvhRoot[i], origin, dir, invDir, false, smallest, info))
 			{
-				InTriangle t = m[i].t[j];
+				info.m = i;
+				found = true;
+			}
+		}
+	}
+#endif
 
-				// Compute distance d using above function to determine how far along the ray the triangle collides.
-				float d = rayIntersectsTriangle(origin, dir, t.pos[0].xyz, t.pos[1].xyz, t.pos[2].xyz);
+	// Pass out a point of collision using the distance to the closest triangle
+	info.point = origin + (dir * smallest);
+	info.dist = smallest;
 
-				if(d != -1.0 && d < smallest)
-				{
-					// This t becomes the new smallest.
-					smallest = d;
+	return found;
+}
 
-					// color can be found via index as can the normal
-					// Thus, we just pass out a point of collision using t and the triangle index.
-					info.point = origin + (dir * d);
-					info.m = i;
-					info.t = j;
+// The occlusion query of the shadow rays: true if anything that can cast a
+// shadow from light "l" is on the ray from "origin" along "dir", closer than
+// "tMax". A shadow ray doesn't need to know which triangle is the closest, so
+// it stops at the first triangle it finds, and "smallest" starts at tMax, so
+// nothing past the point that the ray goes to is ever tested. Only the
+// instances near the light are tested (see calcLightMasks in main.cpp),
+// the ones that are far away from it are never looked at.
+bool occluded(int l, vec3 origin, vec3 dir, float tMax)
+{
+	float smallest = tMax;
+	hitinfo info;
 
-					return true;
-				}
-			}
+#if TWO_LEVEL_BVH
+	// down the light's own top level tree
+	int mask = INSTANCE_MASK_SHADOW | INSTANCE_MASK_LIGHT(l);
+	return intersectInstances(shadowRoot[l], origin, dir, mask, true, smallest, info);
+#else
+	vec3 invDir = inverseDirection(dir);
+
+	for(int k = 0; k < numShadowCasters[l]; k++)
+	{
+		int i = shadowCasters[l * MAX_INSTANCES + k];
+
+		// Check if ray collides with mesh's hitbox
+		// before checking the triangles of the mesh
+		float dHitbox = rayIntersectsMesh(i, origin, invDir);
+
+		if (dHitbox != -1.0 && dHitbox < smallest &&
+			intersectMeshBVH(instances[i].firstTriangle, bvhRoot[i], origin, dir, invDir, true, smallest, info))
+		{
+			return true;
 		}
 	}
 
-	return found;
+	return false;
+#endif
 }
 
-vec3 GetInterpolatedNormal(vec3 pointHit, vec3 p1, vec3 p2, vec3 p3, vec3 n1, vec3 n2, vec3 n3)
+// Looks up the three corners of triangle t of instance m. This is the only
+// place that reads the vertices, once for the triangle that a ray hit.
+InTriangle getTriangle(int m, int t)
 {
-	// Given the 3 points on the triangle,
-	// Given the 1 point inside the triangle,
-	// Given the 3 normals on the triangle,
-	// Find the interpolated normal for that point
+	InTriangle tri;
 
-	vec3 a = p1;
-	vec3 b = p2;
-	vec3 c = p3;
-	vec3 p = pointHit;
+	int index = instances[m].firstIndex + 3 * t;
 
-	vec3 v0 = b - a;
-	vec3 v1 = c - a; 
-	vec3 v2 = p - a;
+	for (int k = 0; k < 3; k++)
+	{
+		Vertex corner = vertices[instances[m].firstVertex + indices[index + k]];
 
-	float d00 = dot(v0, v0);
-	float d01 = dot(v0, v1);
-	float d11 = dot(v1, v1);
-	float d20 = dot(v2, v0);
-	float d21 = dot(v2, v1);
-	float denom = d00 * d11 - d01 * d01;
-	
+		tri.uv[k] = vec2(corner.u, corner.v);
+		tri.normal[k] = corner.normal;
+	}
+
+	return tri;
+}
+
+// Gives back the triangle that a ray hit, with its normals in world space
+InTriangle getHitTriangle(hitinfo i)
+{
+	// Without TWO_LEVEL_BVH, Compute.glsl already moved the
+	// vertices into the instance's own copy of the mesh
+	InTriangle t = getTriangle(i.m, i.t);
+
+#if TWO_LEVEL_BVH
+	// The vertices of an instance are in object space,
+	// so turn the normals the way the instance is turned
+	mat3 normalMatrix = transpose(mat3(instances[i.m].worldToObject));
+
+	for (int k = 0; k < 3; k++)
+	{
+		t.normal[k] = normalize(normalMatrix * t.normal[k]);
+	}
+#endif
+
+	return t;
+}
+
+// Blends the three normals of a triangle together, for the point where the
+// ray hit it. rayIntersectsTriangle already worked out how much of each
+// corner is in that point (bary), so nothing is worked out again here.
+vec3 GetInterpolatedNormal(vec2 bary, vec3 n1, vec3 n2, vec3 n3)
+{
 	// Barycentric Coordinates of point
-	float v = (d11 * d20 - d01 * d21) / denom;
-	float w = (d00 * d21 - d01 * d20) / denom;
-	float u = 1.0f - v - w;
+	float u = 1.0 - bary.x - bary.y;
 
-	// Interpolate Normal
 	// Interpolate Normal
 	vec3 newNormal = 
 		u*n1 + 
-		v*n2 + 
-		w*n3;
+		bary.x*n2 + 
+		bary.y*n3;
 
-	// This is calculated incorrectly
-	// It needs to be fixed so that
-	// The car can look smooth
 	return normalize(newNormal);
 }
 
-vec2 GetInterpolatedUV(vec3 pointHit, vec3 p1, vec3 p2, vec3 p3, vec2 t1, vec2 t2, vec2 t3)
+// Same as GetInterpolatedNormal, but with the texture coordinates
+vec2 GetInterpolatedUV(vec2 bary, vec2 t1, vec2 t2, vec2 t3)
 {
-	// Given the 3 points on the triangle,
-	// Given the 1 point inside the triangle,
-	// Given the 3 normals on the triangle,
-	// Find the interpolated normal for that point
-
-	vec3 a = p1;
-	vec3 b = p2;
-	vec3 c = p3;
-	vec3 p = pointHit;
-
-	vec3 v0 = b - a;
-	vec3 v1 = c - a; 
-	vec3 v2 = p - a;
-
-	float d00 = dot(v0, v0);
-	float d01 = dot(v0, v1);
-	float d11 = dot(v1, v1);
-	float d20 = dot(v2, v0);
-	float d21 = dot(v2, v1);
-	float denom = d00 * d11 - d01 * d01;
-	
 	// Barycentric Coordinates of point
-	float v = (d11 * d20 - d01 * d21) / denom;
-	float w = (d00 * d21 - d01 * d20) / denom;
-	float u = 1.0f - v - w;
+	float u = 1.0 - bary.x - bary.y;
 
 	// Interpolate UV
 	vec2 newUV = 
 		u*t1 + 
-		v*t2 + 
-		w*t3;
+		bary.x*t2 + 
+		bary.y*t3;
 
 	// return the texture coordinate
 	return newUV;
 }
 
-vec4 getSurfaceColor(hitinfo i)
+// t is getHitTriangle(i), which trace() only looks up once
+vec4 getSurfaceColor(hitinfo i, InTriangle t)
 {
-	InTriangle t = m[i.m].t[i.t];
-
 	vec2 uv = GetInterpolatedUV(
-		i.point,
-		t.pos[0].xyz,
-		t.pos[1].xyz,
-		t.pos[2].xyz,
-		vec2(t.uv[0]),
-		vec2(t.uv[1]),
-		vec2(t.uv[2])
+		i.bary,
+		t.uv[0],
+		t.uv[1],
+		t.uv[2]
 	);
 
-	return texture(textureTest[i.m], uv.xy);
+#if COMPUTE_TRACE || WAVEFRONT_STAGE
+	// The index into textureTest has to be the same for every thread that
+	// runs it together, and a tile can have the car and the road in it,
+	// so every texture gets its own textureGrad with a fixed index
+	int index = instances[i.m].texture;
+	vec4 color = vec4(0);
+
+	for (int k = 0; k < MAX_TEXTURES; k++)
+		if (k == index)
+			color = textureGrad(textureTest[k], uv.xy, uvDx, uvDy);
+
+	return color;
+#else
+	return texture(textureTest[instances[i.m].texture], uv.xy);
+#endif
+}
+
+// How much light L puts on the point that a ray hit, if nothing is in the way.
+// pointToLight is the direction from the point to the light, and dist is how far away it is.
+vec3 lightColor(light L, vec3 pointToLight, float dist, hitinfo rayHitPoint, InTriangle t)
+{
+	// Get the interpolated normal for the Point that is hit on the triangle by the ray
+	// This normal will be interpolated between all three vertex normals
+	vec3 normal = GetInterpolatedNormal(
+		rayHitPoint.bary, 
+		t.normal[0],
+		t.normal[1],
+		t.normal[2]);
+
+	// Get a reflection vector bouncing the light ray off the surface of the triangle.
+	// Used for specular light calculations.
+	vec3 reflectedRayToPoint = reflect(pointToLight, normal);
+
+	// get the dot product, just like the basic tutorials
+	float NdotL = dot(normal, pointToLight);
+
+	// clamp the color
+	NdotL = clamp(NdotL, 0.0, 1.0);
+
+	// Formula for range-based attenuation
+	float atten = 1.0 - (dist*dist) / (L.radius*L.radius);
+	
+	// clamp the attenuation
+	atten = clamp(atten, 0.0, 1.0);
+
+	// Get the final color of the light on the pixel
+	float diffuse = NdotL;
+
+	// brightness of light
+	vec3 brightness = L.brightness * L.color.xyz * atten;
+
+	// color of surface
+	vec4 surfaceColor = getSurfaceColor(rayHitPoint, t);
+
+	// Return our diffuse light and specular (we do white light, for specula) and factor in the reflectionLevel and lightIntensity.
+	return surfaceColor.xyz * brightness * diffuse;
 }
 
-vec3 addLightColorToPixColor(light L, vec3 dirRayToPoint, hitinfo rayHitPoint, bool checkShadows)
+vec3 addLightColorToPixColor(int l, hitinfo rayHitPoint, InTriangle t, bool checkShadows)
 {
+	light L = lights[l];
+
 	// get direction from point to light
 	vec3 pointToLight = L.pos.xyz - rayHitPoint.point;
 	
@@ -391,67 +915,54 @@ vec3 addLightColorToPixColor(light L, vec3 dirRayToPoint, hitinfo rayHitPoint, b
 	// normalize the distance, to get direction
 	pointToLight = normalize(pointToLight);
 
-	// Create a hitinfo object to store the collision.
-	hitinfo lightHitPoint;
-
 	// Now we check to see if any polygons are standing between the point
 	// that the ray hit, and the light. If a polygon blocks this new ray from
 	// the light, then don't light this pixel (shadow). Otherwise, light it.
+	// The ray stops just short of the point, anything after that is behind it.
 	// If you do NOT want shadows, delete the if-statment
 	if(checkShadows)
 	{
-		if(rayHitCar(L.pos.xyz, -pointToLight, lightHitPoint))
+		if(occluded(l, L.pos.xyz, -pointToLight, dist - SHADOW_RAY_BIAS))
 		{
-			// If the distance from the point to the light is farther than the distance from the light to the first surface it hits
-			if(dist - length(L.pos.xyz - lightHitPoint.point) > 0.1)
-			{
-				// Then this is in shadow, since the light is hitting another object first.
-				return vec3(0);
-			}
+			// Then this is in shadow, since the light is hitting another object first.
+			return vec3(0);
 		}
 	}
 
-	hitinfo i = rayHitPoint;
-	InTriangle t = m[i.m].t[i.t];
-
-	// Get the interpolated normal for the Point that is hit on the triangle by the ray
-	// This normal will be interpolated between all three vertex normals
-	vec3 normal = GetInterpolatedNormal(
-		rayHitPoint.point, 
-		t.pos[0].xyz,
-		t.pos[1].xyz,
-		t.pos[2].xyz,
-		t.normal[0].xyz,
-		t.normal[1].xyz,
-		t.normal[2].xyz);
-
-	// Get a reflection vector bouncing the light ray off the surface of the triangle.
-	// Used for specular light calculations.
-	vec3 reflectedRayToPoint = reflect(pointToLight, normal);
-
-	// get the dot product, just like the basic tutorials
-	float NdotL = dot(normal, pointToLight);
-
-	// clamp the color
-	NdotL = clamp(NdotL, 0.0, 1.0);
+	return lightColor(L, pointToLight, dist, rayHitPoint, t);
+}
 
-	// Formula for range-based attenuation
-	float atten = 1.0 - (dist*dist) / (L.radius*L.radius);
+// Calculate/return the color value of the point that a ray from the camera hit.
+// t is getHitTriangle(eyeHitTriangle), the rays only read the positions of the
+// triangles, this is the one time that the normals and uvs of the triangle are read
+vec4 shadeHit(vec3 dirEyeToTriangle, hitinfo eyeHitTriangle, InTriangle t)
+{
+	vec4 surfaceColor = getSurfaceColor(eyeHitTriangle, t);
 	
-	// clamp the attenuation
-	atten = clamp(atten, 0.0, 1.0);
+	// If you're aiming for a real-time render
+	// you can return color here, to disable
+	// all lighting effects
+	// return surfaceColor;
 
-	// Get the final color of the light on the pixel
-	float diffuse = NdotL;
+	// Create a pixColor variable, which will determine the output color of this pixel. Start with some ambient light.
+	vec3 pixColor = surfaceColor.xyz * 0.1;
 
-	// brightness of light
-	vec3 brightness = L.brightness * L.color.xyz * atten;
+	// which mesh the instance is a copy of
+	int mesh = instances[eyeHitTriangle.m].mesh;
 
-	// color of surface
-	vec4 surfaceColor = getSurfaceColor(rayHitPoint);
+	// skybox
+	if(mesh == 1)
+	{
+		return surfaceColor;
+	}
 
-	// Return our diffuse light and specular (we do white light, for specula) and factor in the reflectionLevel and lightIntensity.
-	return surfaceColor.xyz * brightness * diffuse;
+	// Every light adds its color. Only the plane has shadows
+	// on it, the car and tires don't check for shadows.
+	for(int l = 0; l < MAX_LIGHTS; l++)
+		pixColor += addLightColorToPixColor(l, eyeHitTriangle, t, mesh == 0);
+
+	// Return the final pixel color.		
+	return vec4(pixColor.rgb, 1.0);
 }
 
 // Trace a ray from an origin point in a given direction and calculate/return the color value of the point that ray hits.
@@ -462,40 +973,362 @@ vec4 trace(vec3 origin, vec3 dirEyeToTriangle)
 
 	// If this ray intersects any of the triangles in the scene.
 	if (intersectTriangles(origin, dirEyeToTriangle, eyeHitTriangle))
+		return shadeHit(dirEyeToTriangle, eyeHitTriangle, getHitTriangle(eyeHitTriangle));
+
+	// If the ray doesn't hit any triangles, then this ray sees nothing and thus:
+	// Return 0, which can be replaced with skybox
+	return vec4(vec3(0), 1.0);
+}
+
+#if WAVEFRONT_STAGE
+// The queues of WAVEFRONT_TRACE, the same structs as Wavefront.h
+
+struct WavefrontRay
+{
+	vec3 origin;
+	int pixel;
+	vec3 dir;
+	float junk1;
+};
+
+struct WavefrontHit
+{
+	vec3 dir;
+	int pixel;
+	vec3 point;
+	float dist;
+	vec2 bary;
+	int m;
+	int t;
+};
+
+struct WavefrontShadowRay
+{
+	vec3 origin;
+	int pixel;
+	vec3 dir;
+	float dist;
+	vec3 color;
+	int light;
+};
+
+struct WavefrontQueueCount
+{
+	uint count;
+	uint numGroupsX;
+	uint numGroupsY;
+	uint numGroupsZ;
+};
+
+layout (binding = 8) buffer rayQueueBlock
+{
+	WavefrontRay rays[];
+};
+
+layout (binding = 9) buffer hitQueueBlock
+{
+	WavefrontHit hits[];
+};
+
+layout (binding = 10) buffer shadowQueueBlock
+{
+	WavefrontShadowRay shadowRays[];
+};
+
+// queueCounts[WAVEFRONT_RAY_QUEUE] is how many entries are in rays[], and so on
+layout (binding = 11) buffer queueCountBlock
+{
+	WavefrontQueueCount queueCounts[NUM_WAVEFRONT_QUEUES];
+};
+
+// 3 for every pixel, red, green, and blue, as fixed point (see WAVEFRONT_COLOR_SCALE)
+layout (binding = 12) buffer pixelColorBlock
+{
+	uint pixelColors[];
+};
+
+// Used by pushToQueue, how many threads of the group, up to and
+// including each one, have an entry, and where the group's entries start
+shared uint pushScan[WAVEFRONT_GROUP_SIZE];
+shared uint pushFirst;
+
+// Every thread of the group has to call this, even the ones that have nothing
+// to add to the queue. It gives back where in the queue this thread puts its
+// entry, or -1 if "push" is false. The entries stay in the order of the threads,
+// and only one thread asks for room, for all of them, with one atomicAdd.
+// It raises numGroupsX too, so that the pass that reads the queue starts
+// a group of threads for every WAVEFRONT_GROUP_SIZE entries in it.
+int pushToQueue(int queue, bool push)
+{
+	uint i = gl_LocalInvocationIndex;
+
+	pushScan[i] = push ? 1u : 0u;
+
+	memoryBarrierShared();
+	barrier();
+
+	// Every step adds the count of the thread "step" threads before,
+	// after 6 steps (for 64 threads) every thread has the count of all
+	// the threads before it, and the last thread has the whole group
+	for (uint step = 1u; step < WAVEFRONT_GROUP_SIZE; step *= 2u)
+	{
+		uint before = i >= step ? pushScan[i - step] : 0u;
+
+		memoryBarrierShared();
+		barrier();
+
+		pushScan[i] += before;
+
+		memoryBarrierShared();
+		barrier();
+	}
+
+	uint total = pushScan[WAVEFRONT_GROUP_SIZE - 1];
+
+	if (i == 0u && total > 0u)
+	{
+		pushFirst = atomicAdd(queueCounts[queue].count, total);
+		atomicMax(queueCounts[queue].numGroupsX, (pushFirst + total + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE);
+	}
+
+	memoryBarrierShared();
+	barrier();
+
+	return push ? int(pushFirst + pushScan[i]) - 1 : -1;
+}
+
+// Adds a color to a pixel. Any number of threads can add to
+// the same pixel at the same time, they don't have to wait.
+void addToPixel(int pixel, vec3 color)
+{
+	uvec3 add = uvec3(max(color, vec3(0)) * WAVEFRONT_COLOR_SCALE + 0.5);
+
+	for (int c = 0; c < 3; c++)
+		if (add[c] != 0u)
+			atomicAdd(pixelColors[3 * pixel + c], add[c]);
+}
+
+// The camera ray through the middle of a pixel, the same one the fragment shader traces
+vec3 cameraRay(vec2 pixel)
+{
+	vec2 pos = (pixel + 0.5) / vec2(screenSize);
+	return normalize(mix(mix(ray00, ray01, pos.y), mix(ray10, ray11, pos.y), pos.x));
+}
+
+// Where a ray goes through the plane of triangle t of instance m, as the u and v
+// that rayIntersectsTriangle gives, even if that is outside of the triangle.
+// Returns false if the ray runs along the plane.
+bool rayHitsPlane(int m, int t, vec3 origin, vec3 dir, out vec2 bary)
+{
+#if TWO_LEVEL_BVH
+	// The triangles are in object space, see intersectInstances
+	origin = (instances[m].worldToObject * vec4(origin, 1.0)).xyz;
+	dir = mat3(instances[m].worldToObject) * dir;
+#endif
+
+	int p = 9 * (instances[m].firstTriangle + t);
+
+	vec3 v0 = vec3(trianglePositions[p], trianglePositions[p + 1], trianglePositions[p + 2]);
+	vec3 e1 = vec3(trianglePositions[p + 3], trianglePositions[p + 4], trianglePositions[p + 5]);
+	vec3 e2 = vec3(trianglePositions[p + 6], trianglePositions[p + 7], trianglePositions[p + 8]);
+
+	vec3 h = cross(dir, e2);
+	float a = dot(e1, h);
+
+	if (a > -0.00001 && a < 0.00001)
+		return false;
+
+	vec3 s = origin - v0;
+	vec3 q = cross(s, e1);
+
+	bary = vec2(dot(s, h), dot(dir, q)) / a;
+	return true;
+}
+
+// One group for every tile of the picture, one camera ray for every pixel
+void generatePass()
+{
+	ivec2 pixel = ivec2(gl_WorkGroupID.xy) * WAVEFRONT_TILE_SIZE + zOrderPixel(gl_LocalInvocationIndex);
+
+	// The tiles on the right and top edges hang over the picture
+	bool inside = pixel.x < screenSize.x && pixel.y < screenSize.y;
+
+	int slot = pushToQueue(WAVEFRONT_RAY_QUEUE, inside);
+
+	if (inside)
+		rays[slot] = WavefrontRay(eye, pixel.y * screenSize.x + pixel.x, cameraRay(vec2(pixel)), 0.0);
+}
+
+// Finds the closest triangle of every ray. A ray that
+// doesn't hit anything leaves its pixel black.
+void extendPass()
+{
+	uint id = gl_GlobalInvocationID.x;
+
+	WavefrontRay ray;
+	hitinfo info;
+	bool hit = false;
+
+	if (id < queueCounts[WAVEFRONT_RAY_QUEUE].count)
+	{
+		ray = rays[id];
+		hit = intersectTriangles(ray.origin, ray.dir, info);
+	}
+
+	int slot = pushToQueue(WAVEFRONT_HIT_QUEUE, hit);
+
+	if (hit)
+		hits[slot] = WavefrontHit(ray.dir, ray.pixel, info.point, info.dist, info.bary, info.m, info.t);
+}
+
+// The same as shadeHit(), but the shadow rays of the plane
+// go in the shadow queue, instead of being traced here
+void shadePass()
+{
+	uint id = gl_GlobalInvocationID.x;
+
+	// true if the lights add to this thread's pixel
+	bool lit = false;
+
+	WavefrontHit hit;
+	hitinfo info;
+	InTriangle t;
+	int mesh;
+
+	if (id < queueCounts[WAVEFRONT_HIT_QUEUE].count)
 	{
-		vec4 surfaceColor = getSurfaceColor(eyeHitTriangle);
-		
-		// If you're aiming for a real-time render
-		// you can return color here, to disable
-		// all lighting effects
-		// return surfaceColor;
+		hit = hits[id];
+		info = hitinfo(hit.point, hit.dist, hit.m, hit.t, hit.bary);
+
+		t = getHitTriangle(info);
+		vec2 uv = GetInterpolatedUV(info.bary, t.uv[0], t.uv[1], t.uv[2]);
 
-		// Create a pixColor variable, which will determine the output color of this pixel. Start with some ambient light.
-		vec3 pixColor = surfaceColor.xyz * 0.1;
+		// There are no 2x2 quads to compare uvs with, so the rays through the
+		// next pixel on the right, and the next one up, are sent through the
+		// plane of the same triangle, to see how much the uv changes there.
+		// Every hit is from a camera ray, until there are bounces.
+		vec2 pixel = vec2(hit.pixel % screenSize.x, hit.pixel / screenSize.x);
+		vec2 bary;
+
+		uvDx = vec2(0);
+		uvDy = vec2(0);
+
+		if (rayHitsPlane(info.m, info.t, eye, cameraRay(pixel + vec2(1, 0)), bary))
+			uvDx = GetInterpolatedUV(bary, t.uv[0], t.uv[1], t.uv[2]) - uv;
+
+		if (rayHitsPlane(info.m, info.t, eye, cameraRay(pixel + vec2(0, 1)), bary))
+			uvDy = GetInterpolatedUV(bary, t.uv[0], t.uv[1], t.uv[2]) - uv;
+
+		vec4 surfaceColor = getSurfaceColor(info, t);
+
+		// which mesh the instance is a copy of
+		mesh = instances[info.m].mesh;
 
 		// skybox
-		if(eyeHitTriangle.m == 1)
+		if (mesh == 1)
 		{
-			return surfaceColor;
+			addToPixel(hit.pixel, surfaceColor.xyz);
 		}
-
-		// plane
-		if(eyeHitTriangle.m == 0)
-			pixColor += addLightColorToPixColor(lights[0], dirEyeToTriangle, eyeHitTriangle, true);
-		
-		// car and tires
 		else
-			pixColor += addLightColorToPixColor(lights[0], dirEyeToTriangle, eyeHitTriangle, false);
+		{
+			// ambient light
+			addToPixel(hit.pixel, surfaceColor.xyz * 0.1);
+			lit = true;
+		}
+	}
+
+	// One shadow ray for every light. Every thread of the group pushes to
+	// the queue once for every light, even if it has nothing to push,
+	// because pushToQueue waits for the whole group (see pushToQueue)
+	for (int l = 0; l < MAX_LIGHTS; l++)
+	{
+		WavefrontShadowRay shadow;
+		bool castShadow = false;
+
+		if (lit)
+		{
+			light L = lights[l];
+			vec3 pointToLight = L.pos.xyz - info.point;
+			float dist = length(pointToLight);
+			pointToLight = normalize(pointToLight);
+
+			// only if the light touches the pixel
+			if (dist <= L.radius)
+			{
+				vec3 color = lightColor(L, pointToLight, dist, info, t);
+
+				// only the plane has shadows on it
+				if (mesh == 0)
+				{
+					shadow = WavefrontShadowRay(L.pos.xyz, hit.pixel, -pointToLight, dist, color, l);
+					castShadow = true;
+				}
+				else
+				{
+					addToPixel(hit.pixel, color);
+				}
+			}
+		}
+
+		int slot = pushToQueue(WAVEFRONT_SHADOW_QUEUE, castShadow);
 
-		// Return the final pixel color.		
-		return vec4(pixColor.rgb, 1.0);
+		if (castShadow)
+			shadowRays[slot] = shadow;
 	}
+}
 
-	// If the ray doesn't hit any triangles, then this ray sees nothing and thus:
-	// Return 0, which can be replaced with skybox
-	return vec4(vec3(0), 1.0);
+// Adds the light of every shadow ray that gets to its point
+void shadowPass()
+{
+	uint id = gl_GlobalInvocationID.x;
+
+	if (id >= queueCounts[WAVEFRONT_SHADOW_QUEUE].count)
+		return;
+
+	WavefrontShadowRay shadow = shadowRays[id];
+
+	// If the light hits another surface before it gets to this point, it is in shadow
+	if (occluded(shadow.light, shadow.origin, shadow.dir, shadow.dist - SHADOW_RAY_BIAS))
+		return;
+
+	addToPixel(shadow.pixel, shadow.color);
+}
+
+// One group for every tile of the picture, like generate. Writes every
+// pixel into traceImage, and sets it back to 0 for the next frame to add to.
+void resolvePass()
+{
+	ivec2 pixel = ivec2(gl_WorkGroupID.xy) * WAVEFRONT_TILE_SIZE + zOrderPixel(gl_LocalInvocationIndex);
+
+	if (pixel.x >= screenSize.x || pixel.y >= screenSize.y)
+		return;
+
+	int p = 3 * (pixel.y * screenSize.x + pixel.x);
+
+	vec3 color = vec3(pixelColors[p], pixelColors[p + 1], pixelColors[p + 2]) / WAVEFRONT_COLOR_SCALE;
+
+	pixelColors[p] = 0u;
+	pixelColors[p + 1] = 0u;
+	pixelColors[p + 2] = 0u;
+
+	imageStore(traceImage, pixel, vec4(clamp(color, 0.0, 1.0), 1.0));
 }
 
+void main(void)
+{
+#if WAVEFRONT_STAGE == WAVEFRONT_GENERATE
+	generatePass();
+#elif WAVEFRONT_STAGE == WAVEFRONT_EXTEND
+	extendPass();
+#elif WAVEFRONT_STAGE == WAVEFRONT_SHADE
+	shadePass();
+#elif WAVEFRONT_STAGE == WAVEFRONT_SHADOW
+	shadowPass();
+#else
+	resolvePass();
+#endif
+}
+#else
 void main(void)
 {
 	// Keep in mind, "textureCoord" does not actually mean textures being mapped onto the surface of geometry,
@@ -505,7 +1338,68 @@ void main(void)
 	// For your mental image, imagine this shader runes once for every single pixel on your screen.
 	// Every time it runs, dir is the ray that goes from the camera's position, through the pixel that it is rendering. Thus, we are tracing a ray through every pixel 
 	// on the screen to determine what to render.
+#if COMPUTE_TRACE
+	// Where the pixel that this thread traces is in its tile
+	ivec2 local = zOrderPixel(gl_LocalInvocationIndex);
+
+	ivec2 pixel = ivec2(gl_WorkGroupID.xy) * TRACE_TILE_SIZE + local;
+	ivec2 size = imageSize(traceImage);
+
+	// The tiles on the right and top edges hang over the picture when its size isn't
+	// a multiple of TRACE_TILE_SIZE. Those threads still have to get to barrier().
+	bool inside = pixel.x < size.x && pixel.y < size.y;
+
+	// The middle of the pixel, like textureCoord is for the fragment shader
+	vec2 pos = (vec2(pixel) + 0.5) / vec2(size);
+	vec3 dir = normalize(mix(mix(ray00, ray01, pos.y), mix(ray10, ray11, pos.y), pos.x));
+
+	hitinfo eyeHitTriangle;
+	bool hit = inside && intersectTriangles(eye, dir, eyeHitTriangle);
+
+	InTriangle t;
+	vec2 uv = vec2(0);
+	int tex = -1;
+
+	if (hit)
+	{
+		t = getHitTriangle(eyeHitTriangle);
+		uv = GetInterpolatedUV(eyeHitTriangle.bary, t.uv[0], t.uv[1], t.uv[2]);
+		tex = instances[eyeHitTriangle.m].texture;
+	}
+
+	tileUV[local.x][local.y] = uv;
+	tileTexture[local.x][local.y] = tex;
+
+	// Wait for every pixel of the tile to write its uv
+	memoryBarrierShared();
+	barrier();
+
+	if (!inside)
+		return;
+
+	// Compare to the other pixel in the same row, and in the same column, of
+	// this pixel's 2x2 quad, like texture() does. If that pixel hit a different
+	// texture (or nothing), the uv doesn't change smoothly there, so use level 0.
+	ivec2 quad = local & ~1;
+	uvDx = vec2(0);
+	uvDy = vec2(0);
+
+	if (tileTexture[quad.x][local.y] == tex && tileTexture[quad.x + 1][local.y] == tex)
+		uvDx = tileUV[quad.x + 1][local.y] - tileUV[quad.x][local.y];
+
+	if (tileTexture[local.x][quad.y] == tex && tileTexture[local.x][quad.y + 1] == tex)
+		uvDy = tileUV[local.x][quad.y + 1] - tileUV[local.x][quad.y];
+
+	vec4 color = vec4(vec3(0), 1.0);
+
+	if (hit)
+		color = shadeHit(dir, eyeHitTriangle, t);
+
+	imageStore(traceImage, pixel, color);
+#else
 	vec2 pos = textureCoord;
 	vec3 dir = normalize(mix(mix(ray00, ray01, pos.y), mix(ray10, ray11, pos.y), pos.x));
 	color = trace(eye, dir);
-}
\ No newline at end of file
+#endif
+}
+#endif
\ No newline at end of file
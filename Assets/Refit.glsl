@@ -0,0 +1,178 @@
+/*
+Title: Advanced Ray Tracer
+File Name: Refit.glsl
+Copyright  2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Without TWO_LEVEL_BVH, the tree of every instance is built around its
+triangles in world space. When the instances move, this makes every box
+fit around the triangles that are in it now, without building the trees
+again (see refitSceneBVH in BVH.cpp, which does the same on the CPU).
+
+A box can only be refit after both of its children, so the nodes are
+refit one level at a time, the deepest level first, one dispatch for
+every level (see listRefitNodes). Every node of a level is one thread.
+
+While it is at it, it adds up the SAH cost of every tree (see bvhCost),
+so main.cpp can tell when the boxes have grown too much, and the trees
+should be built again.
+*/
+
+// Compute shaders are part of openGL core since version 4.3
+#version 430
+
+// REFIT_GROUP_SIZE is not typed in here, createProgram() in main.cpp
+// puts a #define for it right after the #version line
+layout(local_size_x = REFIT_GROUP_SIZE) in;
+
+// Where the level that this dispatch refits starts in inRefit.n,
+// and how many nodes are in it
+uniform int levelStart;
+uniform int levelCount;
+
+// Same as struct BVHNode in BVH.h
+struct BVHNode
+{
+	vec3 boundsMin;
+	int leftFirst;
+	vec3 boundsMax;
+	int count;
+};
+
+// Same as struct RefitNode in BVH.h
+struct RefitNode
+{
+	int node;
+	int firstTriangle;
+	int tree;
+	int junk1;
+};
+
+// Every node of every tree, one level after another, the deepest level first
+layout(binding = 0) buffer b0
+{
+	RefitNode n[];
+} inRefit;
+
+// The SAH cost of every node, and everything under it, before it is
+// divided by the area of the root. Indexed the same way as bvh.nodes.
+layout(binding = 1) buffer b1
+{
+	float c[];
+} nodeCosts;
+
+// The boxes that are refit
+layout(binding = 2) buffer b2
+{
+	BVHNode nodes[];
+} bvh;
+
+// The triangles of every leaf, they count from the instance's firstTriangle
+layout(binding = 3) buffer b3
+{
+	int t[];
+} bvhTriangles;
+
+// The SAH cost of the tree of every instance, written at its root
+layout(binding = 4) buffer b4
+{
+	float c[];
+} treeCosts;
+
+// The world space TrianglePositions that Compute.glsl wrote, 9 floats each
+layout(binding = 7) buffer b7
+{
+	float p[];
+} inPositions;
+
+float surfaceArea(vec3 boundsMin, vec3 boundsMax)
+{
+	vec3 e = boundsMax - boundsMin;
+	return 2.0 * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+
+	// the threads at the end of the last group have nothing to do
+	if (i >= uint(levelCount))
+	{
+		return;
+	}
+
+	RefitNode refit = inRefit.n[levelStart + int(i)];
+	BVHNode node = bvh.nodes[refit.node];
+
+	vec3 boundsMin;
+	vec3 boundsMax;
+	float cost;
+
+	if (node.count > 0)
+	{
+		// A leaf, the box around the corners of its triangles,
+		// made the same way refitNode in BVH.cpp makes it
+		boundsMin = vec3(3.402823466e+38);
+		boundsMax = vec3(-3.402823466e+38);
+
+		for (int k = 0; k < node.count; k++)
+		{
+			uint src = 9 * uint(refit.firstTriangle + bvhTriangles.t[node.leftFirst + k]);
+
+			vec3 v0 = vec3(inPositions.p[src + 0], inPositions.p[src + 1], inPositions.p[src + 2]);
+			vec3 e1 = vec3(inPositions.p[src + 3], inPositions.p[src + 4], inPositions.p[src + 5]);
+			vec3 e2 = vec3(inPositions.p[src + 6], inPositions.p[src + 7], inPositions.p[src + 8]);
+			vec3 p1 = v0 + e1;
+			vec3 p2 = v0 + e2;
+
+			boundsMin = min(boundsMin, min(v0, min(p1, p2)));
+			boundsMax = max(boundsMax, max(v0, max(p1, p2)));
+		}
+
+		boundsMin -= vec3(BVH_BOUNDS_EPSILON);
+		boundsMax += vec3(BVH_BOUNDS_EPSILON);
+
+		cost = surfaceArea(boundsMin, boundsMax) * float(node.count);
+	}
+	else
+	{
+		// The children are on the level below, which
+		// the dispatch before this one already refit
+		BVHNode left = bvh.nodes[node.leftFirst];
+		BVHNode right = bvh.nodes[node.leftFirst + 1];
+
+		boundsMin = min(left.boundsMin, right.boundsMin);
+		boundsMax = max(left.boundsMax, right.boundsMax);
+
+		cost = surfaceArea(boundsMin, boundsMax) + nodeCosts.c[node.leftFirst] + nodeCosts.c[node.leftFirst + 1];
+	}
+
+	bvh.nodes[refit.node].boundsMin = boundsMin;
+	bvh.nodes[refit.node].boundsMax = boundsMax;
+	nodeCosts.c[refit.node] = cost;
+
+	// The cost of the whole tree, the same as bvhCost
+	if (refit.tree >= 0)
+	{
+		float area = surfaceArea(boundsMin, boundsMax);
+		treeCosts.c[refit.tree] = area > 0.0 ? cost / area : 0.0;
+	}
+}
@@ -0,0 +1,536 @@
+/*
+Title: Basic Ray Tracer
+File Name: BVH.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cfloat>
+
+#include "BVH.h"
+
+// Instead of trying every possible split, we put the triangles
+// into this many buckets along an axis, and only try splitting
+// between the buckets. This is much faster, and almost as good.
+#define SAH_BINS 16
+
+// A box with this many triangles (or less) is never split
+#define BVH_MIN_LEAF_SIZE 2
+
+// A box with more triangles than this is always split,
+// even if the SAH says that it isn't worth it
+#define BVH_MAX_LEAF_SIZE 8
+
+struct Bin
+{
+	glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+	glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+	int count = 0;
+};
+
+static float surfaceArea(glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	glm::vec3 e = boundsMax - boundsMin;
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+// Splits node "nodeIndex" into two children, then splits the children,
+// and so on, until the SAH says that splitting is not worth it anymore.
+// "indices" are the primitives of this tree, the node owns [first, first + count).
+static void subdivide(std::vector<BVHNode>& nodes, int nodeIndex, const std::vector<BVHPrimitive>& prims, std::vector<int>& indices, int maxLeafSize, int depth)
+{
+	int first = nodes[nodeIndex].leftFirst;
+	int count = nodes[nodeIndex].count;
+
+	// Get the box around every primitive in the node,
+	// and the box around the centers of the primitives
+	glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+	glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+	glm::vec3 centroidMin = glm::vec3(FLT_MAX);
+	glm::vec3 centroidMax = glm::vec3(-FLT_MAX);
+
+	for (int i = first; i < first + count; i++)
+	{
+		const BVHPrimitive& t = prims[indices[i]];
+		boundsMin = glm::min(boundsMin, t.boundsMin);
+		boundsMax = glm::max(boundsMax, t.boundsMax);
+		centroidMin = glm::min(centroidMin, t.centroid);
+		centroidMax = glm::max(centroidMax, t.centroid);
+	}
+
+	nodes[nodeIndex].boundsMin = boundsMin - glm::vec3(BVH_BOUNDS_EPSILON);
+	nodes[nodeIndex].boundsMax = boundsMax + glm::vec3(BVH_BOUNDS_EPSILON);
+
+	// the stack in the shader can't hold a deeper tree
+	if (count == 1 || (count <= BVH_MIN_LEAF_SIZE && count <= maxLeafSize) || depth >= BVH_MAX_DEPTH - 1)
+		return;
+
+	// Find the cheapest split of all three axes
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+
+		// every primitive has the same center on this axis
+		if (extent <= 0.0f)
+			continue;
+
+		Bin bins[SAH_BINS];
+		float scale = SAH_BINS / extent;
+
+		// drop every primitive into a bin, based on its center
+		for (int i = first; i < first + count; i++)
+		{
+			const BVHPrimitive& t = prims[indices[i]];
+			int b = std::min(SAH_BINS - 1, (int)((t.centroid[axis] - centroidMin[axis]) * scale));
+			bins[b].count++;
+			bins[b].boundsMin = glm::min(bins[b].boundsMin, t.boundsMin);
+			bins[b].boundsMax = glm::max(bins[b].boundsMax, t.boundsMax);
+		}
+
+		// Sweep from the left, then from the right, to get the area and
+		// primitive count on both sides of every split plane between the bins
+		float leftArea[SAH_BINS - 1];
+		float rightArea[SAH_BINS - 1];
+		int leftCount[SAH_BINS - 1];
+		int rightCount[SAH_BINS - 1];
+
+		glm::vec3 lMin = glm::vec3(FLT_MAX), lMax = glm::vec3(-FLT_MAX);
+		glm::vec3 rMin = glm::vec3(FLT_MAX), rMax = glm::vec3(-FLT_MAX);
+		int lCount = 0, rCount = 0;
+
+		for (int i = 0; i < SAH_BINS - 1; i++)
+		{
+			lCount += bins[i].count;
+			lMin = glm::min(lMin, bins[i].boundsMin);
+			lMax = glm::max(lMax, bins[i].boundsMax);
+			leftCount[i] = lCount;
+			leftArea[i] = lCount > 0 ? surfaceArea(lMin, lMax) : 0.0f;
+
+			int j = SAH_BINS - 1 - i;
+			rCount += bins[j].count;
+			rMin = glm::min(rMin, bins[j].boundsMin);
+			rMax = glm::max(rMax, bins[j].boundsMax);
+			rightCount[j - 1] = rCount;
+			rightArea[j - 1] = rCount > 0 ? surfaceArea(rMin, rMax) : 0.0f;
+		}
+
+		for (int i = 0; i < SAH_BINS - 1; i++)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0)
+				continue;
+
+			float cost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	int leftCount;
+
+	if (bestAxis == -1)
+	{
+		// Every primitive has the same center, there is no good way to split
+		// them. If there are too many for one leaf, just cut the list in half.
+		if (count <= maxLeafSize)
+			return;
+
+		leftCount = count / 2;
+	}
+	else
+	{
+		// The cost of testing every primitive in this box, compared to the cost
+		// of testing the two child boxes (1 for the box test, plus each side's
+		// primitives times the chance of the ray getting into that side)
+		float leafCost = (float)count;
+		float splitCost = 1.0f + bestCost / surfaceArea(boundsMin, boundsMax);
+
+		if (splitCost >= leafCost && count <= maxLeafSize)
+			return;
+
+		// Move the primitives on the left of the split plane to the
+		// front of the list, and the ones on the right to the back
+		float extent = centroidMax[bestAxis] - centroidMin[bestAxis];
+		float scale = SAH_BINS / extent;
+
+		int* middle = std::partition(&indices[first], &indices[first] + count, [&](int index)
+		{
+			int b = std::min(SAH_BINS - 1, (int)((prims[index].centroid[bestAxis] - centroidMin[bestAxis]) * scale));
+			return b <= bestSplit;
+		});
+
+		leftCount = (int)(middle - &indices[first]);
+	}
+
+	// Children are always next to each other in the array
+	int leftChild = (int)nodes.size();
+	nodes.push_back(BVHNode());
+	nodes.push_back(BVHNode());
+
+	nodes[leftChild].leftFirst = first;
+	nodes[leftChild].count = leftCount;
+	nodes[leftChild + 1].leftFirst = first + leftCount;
+	nodes[leftChild + 1].count = count - leftCount;
+
+	// this node is not a leaf anymore
+	nodes[nodeIndex].leftFirst = leftChild;
+	nodes[nodeIndex].count = 0;
+
+	subdivide(nodes, leftChild, prims, indices, maxLeafSize, depth + 1);
+	subdivide(nodes, leftChild + 1, prims, indices, maxLeafSize, depth + 1);
+}
+
+int buildBVH(const std::vector<BVHPrimitive>& prims, int maxLeafSize, SceneBVH& bvh)
+{
+	int numPrims = (int)prims.size();
+
+	std::vector<int> indices(numPrims);
+
+	for (int i = 0; i < numPrims; i++)
+		indices[i] = i;
+
+	// Build the tree on its own
+	std::vector<BVHNode> nodes;
+	nodes.reserve(2 * numPrims);
+
+	BVHNode root;
+	root.leftFirst = 0;
+	root.count = numPrims;
+	nodes.push_back(root);
+
+	subdivide(nodes, 0, prims, indices, maxLeafSize, 0);
+
+	// Then add it to the end of the big array. The indices in the
+	// tree start at 0, so they have to be moved to where the tree
+	// and its primitives actually are in the big arrays.
+	int nodeOffset = (int)bvh.nodes.size();
+	int triangleOffset = (int)bvh.triangles.size();
+
+	for (BVHNode& node : nodes)
+	{
+		if (node.count == 0)
+			node.leftFirst += nodeOffset;
+		else
+			node.leftFirst += triangleOffset;
+	}
+
+	bvh.nodes.insert(bvh.nodes.end(), nodes.begin(), nodes.end());
+	bvh.triangles.insert(bvh.triangles.end(), indices.begin(), indices.end());
+
+	return nodeOffset;
+}
+
+int buildMeshBVH(const Mesh& mesh, const glm::mat4x4& matrix, SceneBVH& bvh)
+{
+	int numTriangles = mesh.numTriangles;
+
+	if (numTriangles == 0)
+		return -1;
+
+	// Put the vertices where the matrix says, the same way Compute.glsl does.
+	// Every vertex is moved once, even though it is in about six triangles.
+	const Vertex* vertices = mesh.vertexData();
+	std::vector<glm::vec3> points(mesh.numVertices);
+
+	for (int v = 0; v < mesh.numVertices; v++)
+		points[v] = glm::vec3(matrix * glm::vec4(vertices[v].pos, 1.0f));
+
+	const unsigned int* indices = mesh.indexData();
+	std::vector<BVHPrimitive> tris(numTriangles);
+
+	for (int j = 0; j < numTriangles; j++)
+	{
+		glm::vec3 p[3];
+
+		for (int k = 0; k < 3; k++)
+			p[k] = points[indices[3 * j + k]];
+
+		tris[j].boundsMin = glm::min(p[0], glm::min(p[1], p[2]));
+		tris[j].boundsMax = glm::max(p[0], glm::max(p[1], p[2]));
+		tris[j].centroid = (p[0] + p[1] + p[2]) / 3.0f;
+	}
+
+	int root = buildBVH(tris, BVH_MAX_LEAF_SIZE, bvh);
+
+	// the top level tree goes after this
+	bvh.bottomLevelNodes = (int)bvh.nodes.size();
+	bvh.bottomLevelTriangles = (int)bvh.triangles.size();
+
+	return root;
+}
+
+void buildSceneBVH(const Mesh* meshes, const Instance* instances, int numInstances, SceneBVH& bvh)
+{
+	bvh.nodes.clear();
+	bvh.triangles.clear();
+	bvh.topLevelRoot = -1;
+	bvh.root.resize(numInstances);
+	bvh.builtMesh.resize(numInstances);
+	bvh.builtCost.resize(numInstances);
+
+	for (int i = 0; i < numInstances; i++)
+	{
+		bvh.root[i] = buildMeshBVH(meshes[instances[i].mesh], instances[i].objectToWorld, bvh);
+		bvh.builtMesh[i] = instances[i].mesh;
+		bvh.builtCost[i] = bvh.root[i] >= 0 ? bvhCost(bvh, bvh.root[i]) : 0.0f;
+	}
+}
+
+// Builds one top level tree over the instances in "ids", and adds it to the end
+// of bvh.nodes and bvh.triangles. The box of an instance is the box of the tree of
+// its shadow LOD if "shadow" is true, otherwise of its camera LOD. Returns
+// the root node, or -1 if none of the instances has any triangles.
+static int buildInstanceTree(const Instance* instances, const int* ids, int numIds, bool shadow, SceneBVH& bvh)
+{
+	// Instances of an empty mesh are left out of the tree, a box
+	// for them would only pull the split planes and the root box
+	// toward wherever the box was put. instanceOf[b] is the
+	// instance that boxes[b] belongs to.
+	std::vector<BVHPrimitive> boxes;
+	std::vector<int> instanceOf;
+	boxes.reserve(numIds);
+	instanceOf.reserve(numIds);
+
+	for (int k = 0; k < numIds; k++)
+	{
+		int i = ids[k];
+		int treeRoot = shadow ? instances[i].shadowBvhRoot : instances[i].bvhRoot;
+
+		if (treeRoot < 0)
+			continue;
+
+		// The world space box of an instance is the box around the
+		// 8 corners of its object space root box, after they are moved
+		// into world space. It is a little bigger than it has to be
+		// when the instance is rotated, but it is very cheap to get.
+		glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+		glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+
+		const BVHNode& root = bvh.nodes[treeRoot];
+
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 p = glm::vec3(
+				(corner & 1) ? root.boundsMax.x : root.boundsMin.x,
+				(corner & 2) ? root.boundsMax.y : root.boundsMin.y,
+				(corner & 4) ? root.boundsMax.z : root.boundsMin.z);
+
+			p = glm::vec3(instances[i].objectToWorld * glm::vec4(p, 1));
+
+			boundsMin = glm::min(boundsMin, p);
+			boundsMax = glm::max(boundsMax, p);
+		}
+
+		BVHPrimitive box;
+		box.boundsMin = boundsMin;
+		box.boundsMax = boundsMax;
+		box.centroid = (boundsMin + boundsMax) * 0.5f;
+
+		boxes.push_back(box);
+		instanceOf.push_back(i);
+	}
+
+	if (boxes.empty())
+		return -1;
+
+	// one instance per leaf
+	int firstLeaf = (int)bvh.triangles.size();
+	int rootNode = buildBVH(boxes, 1, bvh);
+
+	// The leaves point to boxes, make them point to the instances
+	for (int k = firstLeaf; k < (int)bvh.triangles.size(); k++)
+		bvh.triangles[k] = instanceOf[bvh.triangles[k]];
+
+	return rootNode;
+}
+
+void buildTopLevelBVH(const Instance* instances, int numInstances, const ShadowCasters& casters, SceneBVH& bvh)
+{
+	// throw away last frame's top level trees
+	bvh.nodes.resize(bvh.bottomLevelNodes);
+	bvh.triangles.resize(bvh.bottomLevelTriangles);
+
+	// The camera rays can hit every instance
+	std::vector<int> everyInstance(numInstances);
+
+	for (int i = 0; i < numInstances; i++)
+		everyInstance[i] = i;
+
+	bvh.topLevelRoot = buildInstanceTree(instances, everyInstance.data(), numInstances, false, bvh);
+
+	// The shadow rays of a light only walk the tree of the instances near
+	// it, so the instances far away from every light are not in any of them
+	bvh.shadowRoot.resize(MAX_LIGHTS);
+
+	for (int l = 0; l < MAX_LIGHTS; l++)
+		bvh.shadowRoot[l] = buildInstanceTree(instances, casters.instances.data() + l * numInstances, casters.count[l], true, bvh);
+}
+
+// Adds up the area of every box under node "n", times its weight, the way bvhCost does
+static float subtreeCost(const std::vector<BVHNode>& nodes, int n)
+{
+	const BVHNode& node = nodes[n];
+	float area = surfaceArea(node.boundsMin, node.boundsMax);
+
+	if (node.count > 0)
+		return area * node.count;
+
+	return area + subtreeCost(nodes, node.leftFirst) + subtreeCost(nodes, node.leftFirst + 1);
+}
+
+float bvhCost(const SceneBVH& bvh, int root)
+{
+	const BVHNode& node = bvh.nodes[root];
+	float area = surfaceArea(node.boundsMin, node.boundsMax);
+
+	return area > 0.0f ? subtreeCost(bvh.nodes, root) / area : 0.0f;
+}
+
+bool canRefitSceneBVH(const Instance* instances, int numInstances, const SceneBVH& bvh)
+{
+	if ((int)bvh.builtMesh.size() != numInstances)
+		return false;
+
+	for (int i = 0; i < numInstances; i++)
+		if (bvh.builtMesh[i] != instances[i].mesh)
+			return false;
+
+	return true;
+}
+
+// Refits node "n", after the nodes under it, and gives back the same
+// sum as subtreeCost, so the cost of the tree comes out of the refit.
+// The corners are made the same way as in Refit.glsl.
+static float refitNode(SceneBVH& bvh, int n, const TrianglePositions* positions)
+{
+	BVHNode& node = bvh.nodes[n];
+
+	if (node.count > 0)
+	{
+		glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+		glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+
+		for (int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+		{
+			const TrianglePositions& t = positions[bvh.triangles[i]];
+			glm::vec3 p1 = t.v0 + t.e1;
+			glm::vec3 p2 = t.v0 + t.e2;
+
+			boundsMin = glm::min(boundsMin, glm::min(t.v0, glm::min(p1, p2)));
+			boundsMax = glm::max(boundsMax, glm::max(t.v0, glm::max(p1, p2)));
+		}
+
+		node.boundsMin = boundsMin - glm::vec3(BVH_BOUNDS_EPSILON);
+		node.boundsMax = boundsMax + glm::vec3(BVH_BOUNDS_EPSILON);
+
+		return surfaceArea(node.boundsMin, node.boundsMax) * node.count;
+	}
+
+	float cost = refitNode(bvh, node.leftFirst, positions) + refitNode(bvh, node.leftFirst + 1, positions);
+
+	// The children already have the epsilon, and the
+	// box around them is the box around their triangles
+	const BVHNode& left = bvh.nodes[node.leftFirst];
+	const BVHNode& right = bvh.nodes[node.leftFirst + 1];
+	node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+	node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+
+	return cost + surfaceArea(node.boundsMin, node.boundsMax);
+}
+
+float refitSceneBVH(const Mesh* transformed, int numInstances, SceneBVH& bvh)
+{
+	float worst = 0.0f;
+
+	for (int i = 0; i < numInstances; i++)
+	{
+		int root = bvh.root[i];
+
+		if (root < 0 || bvh.builtCost[i] <= 0.0f)
+			continue;
+
+		float sum = refitNode(bvh, root, transformed[i].positions.data());
+		float area = surfaceArea(bvh.nodes[root].boundsMin, bvh.nodes[root].boundsMax);
+
+		if (area > 0.0f)
+			worst = std::max(worst, sum / area / bvh.builtCost[i]);
+	}
+
+	return worst;
+}
+
+void listRefitNodes(const Instance* instances, int numInstances, const SceneBVH& bvh, std::vector<RefitNode>& nodes, std::vector<int>& levelStart)
+{
+	// The nodes at every depth, the root of every tree is at depth 0
+	std::vector<std::vector<RefitNode>> levels;
+
+	for (int i = 0; i < numInstances; i++)
+	{
+		if (bvh.root[i] < 0)
+			continue;
+
+		// Walk down the tree with a stack, like the fragment shader does
+		std::vector<std::pair<int, int>> stack;
+		stack.push_back({ bvh.root[i], 0 });
+
+		while (!stack.empty())
+		{
+			int n = stack.back().first;
+			int depth = stack.back().second;
+			stack.pop_back();
+
+			if (depth >= (int)levels.size())
+				levels.resize(depth + 1);
+
+			RefitNode refit;
+			refit.node = n;
+			refit.firstTriangle = instances[i].firstTriangle;
+			refit.tree = depth == 0 ? i : -1;
+			refit.junk1 = 0;
+			levels[depth].push_back(refit);
+
+			if (bvh.nodes[n].count == 0)
+			{
+				stack.push_back({ bvh.nodes[n].leftFirst, depth + 1 });
+				stack.push_back({ bvh.nodes[n].leftFirst + 1, depth + 1 });
+			}
+		}
+	}
+
+	nodes.clear();
+	levelStart.clear();
+
+	for (int depth = (int)levels.size() - 1; depth >= 0; depth--)
+	{
+		levelStart.push_back((int)nodes.size());
+		nodes.insert(nodes.end(), levels[depth].begin(), levels[depth].end());
+	}
+
+	levelStart.push_back((int)nodes.size());
+}
@@ -0,0 +1,191 @@
+/*
+Title: Basic Ray Tracer
+File Name: BVH.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+A Bounding Volume Hierarchy (BVH) is a tree of boxes. The root box holds
+every triangle of a mesh, and every box is split into two smaller boxes,
+until each box only has a few triangles left in it. A ray that misses a
+box can skip every triangle inside of it, so instead of testing every
+triangle, a ray only tests the few triangles in the boxes that it hits.
+
+Where to split each box is chosen with the Surface Area Heuristic (SAH).
+The chance of a random ray hitting a box is proportional to its surface
+area, so we pick the split that gives the smallest
+	(area of left box * triangles on left) + (area of right box * triangles on right)
+
+Every mesh gets its own tree, and all of the trees are put one after
+another into one array of nodes, so the whole thing can be given to the
+fragment shader in one Shader Storage Buffer.
+
+When TWO_LEVEL_BVH is 1, the trees of the meshes (the bottom level) are
+built once in object space, when the meshes are loaded. Every frame, one
+more small tree (the top level) is built over the boxes of the instances
+in world space, and added to the end of the same array. A ray walks down
+the top level tree to find which instances it might hit, then it is moved
+into the object space of each of those instances, to walk down the tree
+of the instance's mesh.
+
+When TWO_LEVEL_BVH is 0, the tree of every instance is built around its
+triangles in world space, and they move every frame. Building every tree
+again every frame is slow, so most frames the trees are only refit: every
+box is made to fit around the triangles that are in it now, starting from
+the leaves and going up to the root, without changing which triangles are
+in which box. That is much quicker, but as the instance turns, the boxes
+get bigger and overlap more, so the SAH cost of the tree goes up (see
+bvhCost). When it goes up too much, the trees are built again.
+*/
+
+#pragma once
+
+#include <vector>
+#include "Scene.h"
+
+// The deepest a tree can be. The traversal in the fragment shader
+// uses a stack of this size, so the build never goes deeper than this.
+#define BVH_MAX_DEPTH 32
+
+// The compute shader and the CPU multiply the triangles by the
+// matrices separately, so their answers can be slightly different.
+// Every box is made this much bigger, so that a triangle on the GPU
+// never pokes out of its box.
+#define BVH_BOUNDS_EPSILON 0.0001f
+
+// A tree that is refit is built again when its SAH cost gets this many
+// times bigger than it was right after it was built
+#define BVH_REFIT_MAX_COST_RATIO 1.2f
+
+// One box in the tree, this matches struct BVHNode in FragmentShader.glsl.
+// In std430, a vec3 followed by an int fits in 16 bytes, so this is 32 bytes.
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+
+	// If count is 0, this is the index of the left child,
+	// and the right child is right after it (leftFirst + 1).
+	// If count is not 0, this is the first index into
+	// SceneBVH::triangles that belongs to this box.
+	int leftFirst;
+
+	glm::vec3 boundsMax;
+
+	// Number of triangles in this box, 0 if it has children
+	int count;
+};
+
+// The box around one thing that goes into a tree, a triangle
+// for the bottom level, or an instance for the top level
+struct BVHPrimitive
+{
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	glm::vec3 centroid;
+};
+
+// The trees of every mesh in the scene
+struct SceneBVH
+{
+	// Every node of every tree
+	std::vector<BVHNode> nodes;
+
+	// Triangle indices (into Mesh::triangles) that the leaves point to.
+	// The leaves of the top level tree point to instance indices instead.
+	std::vector<int> triangles;
+
+	// Index of the root node of each mesh, -1 if the mesh is empty.
+	// buildSceneBVH builds one tree per instance instead, so
+	// then this is the root node of each instance.
+	std::vector<int> root;
+
+	// Index of the root node of the top level tree, -1 if there is none
+	int topLevelRoot = -1;
+
+	// The root node of the top level tree of every light's shadow
+	// casters, MAX_LIGHTS of them, -1 for a light that has none
+	std::vector<int> shadowRoot;
+
+	// How much of nodes and triangles belongs to the bottom level trees,
+	// the top level tree always starts right after this
+	int bottomLevelNodes = 0;
+	int bottomLevelTriangles = 0;
+
+	// Only for buildSceneBVH: the mesh that the tree of every instance was
+	// built from, and the SAH cost of the tree right after it was built
+	std::vector<int> builtMesh;
+	std::vector<float> builtCost;
+};
+
+// One node of the tree of an instance, for Refit.glsl, this matches struct
+// RefitNode there. "tree" is the instance, if this is the root of its tree,
+// otherwise -1. firstTriangle is where the instance's triangles start in
+// the world space triangle positions.
+struct RefitNode
+{
+	int node;
+	int firstTriangle;
+	int tree;
+	int junk1;
+};
+
+// Builds one tree over "prims", and adds it to the end of bvh.nodes and
+// bvh.triangles. A leaf never has more than maxLeafSize primitives.
+// Returns the index of the root node.
+int buildBVH(const std::vector<BVHPrimitive>& prims, int maxLeafSize, SceneBVH& bvh);
+
+// Builds the tree of one mesh, over its triangles multiplied by "matrix",
+// and adds it to the end of the bottom level. Returns the root node, or -1
+// if the mesh is empty. Use the identity matrix to build it in object space.
+int buildMeshBVH(const Mesh& mesh, const glm::mat4x4& matrix, SceneBVH& bvh);
+
+// Builds a tree for every instance, over the triangles of its mesh after
+// they are multiplied by the instance's matrix (the same triangles that
+// the compute shader gives to the fragment shader).
+void buildSceneBVH(const Mesh* meshes, const Instance* instances, int numInstances, SceneBVH& bvh);
+
+// Throws away the old top level trees, and builds new ones over the world
+// space boxes of the instances: one over every instance for the camera rays
+// (topLevelRoot), and one over the shadow casters of every light, with the
+// boxes of their shadow LODs (shadowRoot). Instances of an empty mesh are
+// left out, so a tree can have fewer leaves than instances.
+void buildTopLevelBVH(const Instance* instances, int numInstances, const ShadowCasters& casters, SceneBVH& bvh);
+
+// The SAH cost of the tree at "root": the area of every box, times the number
+// of triangles in it (or 1 for a box with children), added up, and divided by
+// the area of the root box. That is about how many boxes and triangles a ray
+// that goes through the root box has to test.
+float bvhCost(const SceneBVH& bvh, int root);
+
+// True if every instance still uses the mesh that its tree was built from,
+// then the trees can be refit. When a mesh changes (a LOD, or the car), the
+// triangles after it move to a different place too, so every tree is rebuilt.
+bool canRefitSceneBVH(const Instance* instances, int numInstances, const SceneBVH& bvh);
+
+// Refits the tree of every instance from buildSceneBVH around "transformed"
+// (the world space copy of every instance, see cpuTransformMeshes), which
+// is what Refit.glsl does on the GPU. Returns the biggest SAH cost of a
+// tree, divided by its cost when it was built.
+float refitSceneBVH(const Mesh* transformed, int numInstances, SceneBVH& bvh);
+
+// Lists every node of every instance's tree for Refit.glsl, the deepest
+// nodes first, so the children of a node are always refit before it.
+// Level l is nodes[levelStart[l]] to nodes[levelStart[l + 1] - 1].
+void listRefitNodes(const Instance* instances, int numInstances, const SceneBVH& bvh, std::vector<RefitNode>& nodes, std::vector<int>& levelStart);
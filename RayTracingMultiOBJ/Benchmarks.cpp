@@ -0,0 +1,758 @@
+/*
+Title: Basic Ray Tracer
+File Name: Benchmarks.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <thread>
+
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+#include "FreeImage.h"
+
+#include "Benchmarks.h"
+#include "Main.h"
+#include "ObjLoader.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+
+// Makes the text of an OBJ file with a flat grid of "size" by "size" quads,
+// 2 * size * size triangles, to test how fast parseOBJ is on a big mesh.
+// Half of the rows use negative indices, so both kinds are tested.
+static std::string makeTestOBJ(int size)
+{
+	std::string text;
+	char line[200];
+
+	text.reserve((size_t)size * size * 120);
+
+	for (int y = 0; y <= size; y++)
+	{
+		for (int x = 0; x <= size; x++)
+		{
+			float u = (float)x / size;
+			float v = (float)y / size;
+
+			snprintf(line, sizeof(line), "v %f %f %f\nvt %f %f\nvn 0.0 1.0 0.0\n", 10.0f * u - 5.0f, 0.01f * (x % 7), 10.0f * v - 5.0f, u, v);
+			text += line;
+		}
+	}
+
+	int row = size + 1;
+	int numVerts = row * row;
+
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			// indices of the four corners, starting at 1
+			int a = y * row + x + 1;
+			int b = a + 1;
+			int c = a + row + 1;
+			int d = a + row;
+
+			// negative indices count back from the last vertex
+			if (y % 2 == 1)
+			{
+				a -= numVerts + 1;
+				b -= numVerts + 1;
+				c -= numVerts + 1;
+				d -= numVerts + 1;
+			}
+
+			snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+			text += line;
+		}
+	}
+
+	return text;
+}
+
+int runObjParserBenchmark(int argc, char** argv)
+{
+	int gridSize = argc > 2 ? atoi(argv[2]) : 1000;
+
+	if (gridSize < 1)
+		gridSize = 1;
+
+	// Every car, parsed a few times, because they are small
+	std::vector<std::string> cars;
+	size_t carBytes = 0;
+
+	for (int i = 0; i < numCars; i++)
+	{
+		std::ifstream file(carFileName(i), std::ios::binary);
+		std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		carBytes += text.size();
+		cars.push_back(text);
+	}
+
+	int repeats = 20;
+	int carTriangles = 0;
+	Mesh mesh;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (int r = 0; r < repeats; r++)
+	{
+		carTriangles = 0;
+
+		for (int i = 0; i < (int)cars.size(); i++)
+		{
+			parseOBJ(cars[i].data(), cars[i].size(), &mesh);
+			carTriangles += mesh.numTriangles;
+		}
+	}
+
+	double carSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+
+	printf("carsHigh:  %2d files, %8.2f MB, %9d triangles, %8.2f ms, %7.1f MB/s\n",
+		(int)cars.size(), carBytes / 1e6, carTriangles, 1000.0 * carSeconds, carBytes / 1e6 / carSeconds);
+
+	// One big grid
+	std::string grid = makeTestOBJ(gridSize);
+
+	start = std::chrono::high_resolution_clock::now();
+	parseOBJ(grid.data(), grid.size(), &mesh);
+	double gridSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	printf("synthetic: %2d files, %8.2f MB, %9d triangles, %8.2f ms, %7.1f MB/s\n",
+		1, grid.size() / 1e6, mesh.numTriangles, 1000.0 * gridSeconds, grid.size() / 1e6 / gridSeconds);
+
+	return 0;
+}
+
+int runMeshCacheBenchmark(int, char**)
+{
+	for (int i = FLOOR_MESH; i < FIRST_CAR_MESH + NUM_CAR_SLOTS; i++)
+	{
+		std::string filename = meshFileName(i);
+
+		if (!filename.empty())
+			remove(meshCachePath(filename.c_str()).c_str());
+	}
+
+	for (int i = 0; i < numCars; i++)
+		remove(meshCachePath(carFileName(i).c_str()).c_str());
+
+	printf("Cold (parse .3Dobj, write .3Dbin):\n");
+	double cold = loadAssets(false);
+
+	printf("\nWarm (map .3Dbin):\n");
+	double warm = loadAssets(false);
+
+	// Mapping the file does not read it, the operating system reads each
+	// part the first time it is used. Building the trees reads every
+	// triangle, so this counts the time of actually reading the files.
+	auto start = std::chrono::high_resolution_clock::now();
+	buildBottomLevelBVH();
+	double build = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	printf("\nCold: %.2f ms, warm: %.2f ms, %.1fx faster\n", 1000.0 * cold, 1000.0 * warm, cold / warm);
+	printf("Building the BVH of every mesh after the warm load: %.2f ms\n", 1000.0 * build);
+
+	return 0;
+}
+
+int runTextureCacheBenchmark(int, char**)
+{
+	const char* formatNames[] = { "BGRA8", "BC1", "BC3" };
+
+	double totalCold = 0.0;
+	double totalWarm = 0.0;
+	size_t totalBefore = 0;
+	size_t totalAfter = 0;
+
+	for (int i = 0; i < NUM_TEXTURES; i++)
+	{
+		const char* file = textureFileNames[i];
+		remove(textureCachePath(file).c_str());
+
+		CpuTexture cold;
+		auto start = std::chrono::high_resolution_clock::now();
+		decodeTexture(file, &cold);
+		double coldSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// Mapping the file does not read it, so read every byte,
+		// which is what glCompressedTexImage2D would do
+		CpuTexture warm;
+		unsigned int sum = 0;
+		start = std::chrono::high_resolution_clock::now();
+		bool cached = decodeTexture(file, &warm);
+		for (int level = 0; level < warm.numLevels; level++)
+			for (size_t b = 0; b < warm.levelSize[level]; b++)
+				sum += warm.levelData(level)[b];
+		double warmSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// What glTexImage2D with GL_RGBA8 and glGenerateMipmap used to keep on the GPU
+		size_t before = 0;
+		size_t after = 0;
+		for (int level = 0; level < warm.numLevels; level++)
+		{
+			before += textureLevelSize(TEXTURE_FORMAT_BGRA8, warm.levelWidth(level), warm.levelHeight(level));
+			after += warm.levelSize[level];
+		}
+
+		printf("  %-24s %4dx%-4d %2d levels %-5s  decode + bake %7.2f ms, %s %6.2f ms, %8d -> %7d bytes (checksum %u)\n",
+			file, warm.width, warm.height, warm.numLevels, formatNames[warm.format],
+			1000.0 * coldSeconds, cached ? ".3Dtex" : "again ", 1000.0 * warmSeconds, (int)before, (int)after, sum);
+
+		totalCold += coldSeconds;
+		totalWarm += warmSeconds;
+		totalBefore += before;
+		totalAfter += after;
+	}
+
+	printf("\nCold: %.2f ms, warm: %.2f ms, %.1fx faster\n", 1000.0 * totalCold, 1000.0 * totalWarm, totalCold / totalWarm);
+	printf("GPU texture memory: %d bytes -> %d bytes, %.1fx smaller\n", (int)totalBefore, (int)totalAfter, (double)totalBefore / totalAfter);
+
+	return 0;
+}
+
+int runCpuRenderer(int argc, char** argv)
+{
+	int numFrames = 10;
+
+	if (argc > 2)
+		numFrames = atoi(argv[2]);
+
+	if (numFrames < 1)
+		numFrames = 1;
+
+	const char* mode = "two level";
+
+	if (argc > 3 && (strcmp(argv[3], "linear") == 0 || strcmp(argv[3], "flat") == 0 || strcmp(argv[3], "wavefront") == 0))
+		mode = argv[3];
+
+	bool useBVH = strcmp(mode, "linear") != 0;
+	bool wavefront = strcmp(mode, "wavefront") == 0;
+	bool twoLevel = strcmp(mode, "two level") == 0 || wavefront;
+
+	// Same textures as init(), but they stay in system memory
+	loadAssets(true);
+
+	// Same textures as renderScene() gives to textureTest[],
+	// with the compressed ones decoded once, up front
+	for (int i = 0; i < (int)textureImages.size(); i++)
+		textureImages[i] = cpuDecompressTexture(textureImages[i]);
+
+	CpuScene scene;
+	for (int i = 0; i < (int)textureImages.size(); i++)
+		scene.textures.push_back(&textureImages[i]);
+
+	calcLights(scene.lights);
+
+	// loadAssets() already put the first car in the scene
+	scene.meshes = meshes.data();
+	scene.instances = instances.data();
+	scene.numInstances = (int)instances.size();
+	scene.shadowCasters = &shadowCasters;
+	scene.bounds.resize(instances.size());
+
+	// This is the CPU version of verticesCompToFrag
+	std::vector<Mesh> transformed(instances.size());
+
+	// "-cpu 10 linear" tests every triangle, the way the
+	// fragment shader used to, instead of using the BVH
+	scene.bvh = useBVH ? &sceneBVH : nullptr;
+
+	// The trees of the meshes never change, the instances
+	// move around them, so they are only built once
+	if (twoLevel)
+		buildBottomLevelBVH();
+	else
+		scene.transformed = transformed.data();
+
+	cameraPos = glm::vec3(0.0f, 5.0f, 10.0f);
+	CameraRays cam = getCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), CAMERA_FOV, (float)width / height);
+
+	unsigned char* rgba = new unsigned char[4 * width * height];
+
+	// The queues of "wavefront", made in the first frame
+	CpuWavefrontQueues wavefrontQueues;
+
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	printf("CPU renderer: %dx%d, %d frames, %d cores, %s\n", width, height, numFrames, maxThreads, useBVH ? (wavefront ? "two level BVH, wavefront" : twoLevel ? "two level BVH" : "flat BVH") : "linear");
+
+	double oneThreadRate = 0.0;
+
+	// How long "flat" spends building the trees, and refitting them
+	int numBuilds = 0;
+	int numRefits = 0;
+	double buildSeconds = 0.0;
+	double refitSeconds = 0.0;
+
+	for (int numThreads = 1; ; numThreads *= 2)
+	{
+		if (numThreads > maxThreads)
+			numThreads = maxThreads;
+
+		unsigned long long rays = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			// animate the scene as if it was a video
+			float time = (float)frame / videoFPS;
+
+			glm::mat4x4 test[NUM_MATRICES];
+			calcMatrices(time, cameraPos, test);
+
+			selectLods(test, cameraPos, CAMERA_FOV, height, instances);
+			calcInstances(test, instances);
+			calcLightMasks(scene.lights, MAX_LIGHTS, instances, shadowCasters);
+
+			if (twoLevel)
+			{
+				buildTopLevelBVH(instances.data(), scene.numInstances, shadowCasters, sceneBVH);
+			}
+			else
+			{
+				cpuTransformMeshes(meshes.data(), instances.data(), scene.numInstances, transformed.data(), test, scene.bounds.data());
+
+				// Refit the trees, like Refit.glsl does, and only
+				// build them again when they have gotten too slow
+				if (useBVH)
+				{
+					auto bvhStart = std::chrono::high_resolution_clock::now();
+					bool refit = canRefitSceneBVH(instances.data(), scene.numInstances, sceneBVH);
+
+					if (refit && refitSceneBVH(transformed.data(), scene.numInstances, sceneBVH) <= BVH_REFIT_MAX_COST_RATIO)
+					{
+						refitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - bvhStart).count();
+						numRefits++;
+					}
+					else
+					{
+						buildSceneBVH(meshes.data(), instances.data(), scene.numInstances, sceneBVH);
+						buildSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - bvhStart).count();
+						numBuilds++;
+					}
+				}
+			}
+
+			if (wavefront)
+				rays += cpuRenderFrameWavefront(scene, cam, width, height, rgba, numThreads, wavefrontQueues);
+			else
+				rays += cpuRenderFrame(scene, cam, width, height, rgba, numThreads);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		double rate = rays / seconds / 1000000.0;
+
+		if (numThreads == 1)
+			oneThreadRate = rate;
+
+		printf("%2d threads: %7.2f Mrays/s, %6.2f ms per frame, %5.2fx speedup\n",
+			numThreads, rate, 1000.0 * seconds / numFrames, rate / oneThreadRate);
+
+		if (numThreads == maxThreads)
+			break;
+	}
+
+	// A frame where the refit made the trees too slow counts as a build,
+	// with the time of the refit that was thrown away in it
+	if (numBuilds > 0)
+		printf("BVH built %d times, %.3f ms each\n", numBuilds, 1000.0 * buildSeconds / numBuilds);
+
+	if (numRefits > 0)
+		printf("BVH refit %d times, %.3f ms each\n", numRefits, 1000.0 * refitSeconds / numRefits);
+
+	// Save the last frame, FreeImage wants BGRA instead of RGBA
+	FIBITMAP* bitmap = FreeImage_Allocate(width, height, 32);
+
+	for (int y = 0; y < height; y++)
+	{
+		BYTE* row = FreeImage_GetScanLine(bitmap, y);
+
+		for (int x = 0; x < width; x++)
+		{
+			unsigned char* p = &rgba[4 * (y * width + x)];
+			row[4 * x + FI_RGBA_RED] = p[0];
+			row[4 * x + FI_RGBA_GREEN] = p[1];
+			row[4 * x + FI_RGBA_BLUE] = p[2];
+			row[4 * x + FI_RGBA_ALPHA] = p[3];
+		}
+	}
+
+	FreeImage_Save(FIF_PNG, bitmap, "cpu_frame.png");
+	FreeImage_Unload(bitmap);
+
+	delete[] rgba;
+
+	return 0;
+}
+
+int runLodBenchmark(int argc, char** argv)
+{
+	int numFrames = argc > 2 ? atoi(argv[2]) : 4;
+
+	loadAssets(true);
+
+	for (int i = 0; i < (int)textureImages.size(); i++)
+		textureImages[i] = cpuDecompressTexture(textureImages[i]);
+
+	CpuScene scene;
+	for (int i = 0; i < (int)textureImages.size(); i++)
+		scene.textures.push_back(&textureImages[i]);
+
+	calcLights(scene.lights);
+
+	scene.meshes = meshes.data();
+	scene.instances = instances.data();
+	scene.numInstances = (int)instances.size();
+	scene.shadowCasters = &shadowCasters;
+	scene.bounds.resize(instances.size());
+	scene.bvh = &sceneBVH;
+
+	buildBottomLevelBVH();
+
+	cameraPos = glm::vec3(0.0f, 5.0f, 10.0f);
+
+	struct Setting
+	{
+		const char* name;
+		int force;
+		int shadowBias;
+	};
+
+	Setting settings[] =
+	{
+		{ "LOD 0", 0, 0 },
+		{ "LOD 0, shadows LOD 1", 0, 1 },
+		{ "LOD 0, shadows LOD 2", 0, 2 },
+		{ "LOD 1", 1, 0 },
+		{ "LOD 2", 2, 0 },
+		{ "automatic", -1, 0 },
+		{ "automatic, shadow bias", -1, LOD_SHADOW_BIAS },
+	};
+
+	int numSettings = sizeof(settings) / sizeof(settings[0]);
+	int sizes[][2] = { { 640, 360 }, { 320, 180 }, { 160, 90 } };
+
+	for (int s = 0; s < 3; s++)
+	{
+		width = sizes[s][0];
+		height = sizes[s][1];
+
+		CameraRays cam = getCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), CAMERA_FOV, (float)width / height);
+
+		std::vector<unsigned char> reference(4 * width * height);
+		std::vector<unsigned char> rgba(4 * width * height);
+		double referenceSeconds = 0.0;
+
+		auto drawFrame = [&](int frame, unsigned char* out)
+		{
+			float time = (float)frame / videoFPS;
+
+			glm::mat4x4 test[NUM_MATRICES];
+			calcMatrices(time, cameraPos, test);
+
+			selectLods(test, cameraPos, CAMERA_FOV, height, instances);
+			calcInstances(test, instances);
+			calcLightMasks(scene.lights, MAX_LIGHTS, instances, shadowCasters);
+			buildTopLevelBVH(instances.data(), scene.numInstances, shadowCasters, sceneBVH);
+
+			cpuRenderFrame(scene, cam, width, height, out, 0);
+		};
+
+		printf("\n%dx%d, %d frames:\n", width, height, numFrames);
+		printf("  %-24s %11s %11s %9s %8s %11s %12s\n", "", "camera tris", "shadow tris", "ms/frame", "speedup", "mean error", "pixels > 16");
+
+		for (int k = 0; k < numSettings; k++)
+		{
+			lodSettings.force = settings[k].force;
+			lodSettings.shadowBias = settings[k].shadowBias;
+
+			// One frame that is not timed, so that the first setting
+			// doesn't pay for bringing everything into the caches
+			if (k == 0)
+				drawFrame(0, rgba.data());
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			for (int frame = 0; frame < numFrames; frame++)
+				drawFrame(frame, k == 0 ? reference.data() : rgba.data());
+
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / numFrames;
+
+			if (k == 0)
+			{
+				referenceSeconds = seconds;
+				rgba = reference;
+			}
+
+			// How many triangles each kind of ray could hit in the last frame
+			int cameraTriangles = 0;
+			int shadowTriangles = 0;
+
+			for (int i = 0; i < (int)instances.size(); i++)
+			{
+				cameraTriangles += meshes[instances[i].mesh].numTriangles;
+
+				if (instances[i].mask & INSTANCE_MASK_SHADOW)
+					shadowTriangles += meshes[instances[i].shadowMesh].numTriangles;
+			}
+
+			// How far every color is from LOD 0, out of 255
+			double totalError = 0.0;
+			int badPixels = 0;
+
+			for (int p = 0; p < width * height; p++)
+			{
+				int worst = 0;
+
+				for (int c = 0; c < 3; c++)
+				{
+					int d = abs((int)rgba[4 * p + c] - (int)reference[4 * p + c]);
+					totalError += d;
+					worst = glm::max(worst, d);
+				}
+
+				if (worst > 16)
+					badPixels++;
+			}
+
+			printf("  %-24s %11d %11d %9.2f %7.2fx %11.3f %11.2f%%\n", settings[k].name, cameraTriangles, shadowTriangles,
+				1000.0 * seconds, referenceSeconds / seconds, totalError / (3.0 * width * height), 100.0 * badPixels / (width * height));
+		}
+	}
+
+	lodSettings = LodSettings();
+
+	return 0;
+}
+
+int runTransformBenchmark(int argc, char** argv)
+{
+	int numDispatches = glm::max(argc > 2 ? atoi(argv[2]) : 10, 1);
+
+	GLint maxGroups = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroups);
+
+	struct Setting
+	{
+		const char* name;
+		int groupSize;
+		bool linearSearch;
+		bool onlyMoved;
+	};
+
+	Setting settings[] =
+	{
+		{ "1 per group, linear", 1, true, false },
+		{ "group, binary search", TRANSFORM_GROUP_SIZE, false, false },
+		{ "group, only moved", TRANSFORM_GROUP_SIZE, false, true },
+	};
+
+	int numSettings = sizeof(settings) / sizeof(settings[0]);
+	int numCopies[] = { 1, 4, 16, 64, 256 };
+
+	// Two frames that are a little apart, the second one is timed
+	glm::mat4x4 before[NUM_MATRICES];
+	glm::mat4x4 after[NUM_MATRICES];
+	calcMatrices(1.0f, cameraPos, before);
+	calcMatrices(1.0f + 1.0f / videoFPS, cameraPos, after);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, matrixBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, matrixBufferSize, after);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	GLuint buffers[5];
+	glGenBuffers(5, buffers);
+
+	GLuint copyInstanceBuffer = buffers[0];
+	GLuint copyBoundsBuffer = buffers[1];
+	GLuint copyJobBuffer = buffers[2];
+	GLuint copyVertexBuffer = buffers[3];
+	GLuint copyPositionBuffer = buffers[4];
+
+	printf("\nCompute.glsl, %d dispatches each, %d threads in a group:\n", numDispatches, TRANSFORM_GROUP_SIZE);
+	printf("  %6s %10s  %-22s %10s %10s %9s %8s %8s\n", "copies", "triangles", "", "moved tris", "groups", "ms", "speedup", "matches");
+
+	for (int c = 0; c < (int)(sizeof(numCopies) / sizeof(numCopies[0])); c++)
+	{
+		std::vector<Instance> copies;
+
+		for (int k = 0; k < numCopies[c]; k++)
+			copies.insert(copies.end(), instances.begin(), instances.end());
+
+		int numCopyInstances = (int)copies.size();
+
+		// Every copy gets its own room in the world space buffers, like
+		// calcInstanceOffsets does without TWO_LEVEL_BVH, whatever it is
+		int numVertices = 0;
+		int numTriangles = 0;
+
+		for (int i = 0; i < numCopyInstances; i++)
+		{
+			copies[i].firstVertex = numVertices;
+			copies[i].firstTriangle = numTriangles;
+			numVertices += meshRanges[copies[i].mesh].numVertices;
+			numTriangles += meshRanges[copies[i].mesh].numTriangles;
+		}
+
+		calcInstances(after, copies);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, copyInstanceBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Instance) * numCopyInstances, copies.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, copyBoundsBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::ivec4) * numCopyInstances, nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_UNIFORM_BUFFER, copyJobBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(TransformJob) * numCopyInstances, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, copyVertexBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Vertex) * numVertices, nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_UNIFORM_BUFFER, copyPositionBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(TrianglePositions) * numTriangles, nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, copyVertexBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vertexObjToComp);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, matrixBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, indexToFrag);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, copyBoundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, copyInstanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, meshRangeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, copyPositionBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, copyJobBuffer);
+
+		// The shader's arrays are as big as the copies, not the scene
+		std::string defines = shaderDefines();
+		std::string sceneInstances = "#define MAX_INSTANCES " + std::to_string(instances.size()) + "\n";
+		defines.replace(defines.find(sceneInstances), sceneInstances.size(), "#define MAX_INSTANCES " + std::to_string(numCopyInstances) + "\n");
+
+		// What the first setting wrote, the others have to write the same
+		std::vector<Vertex> referenceVertices;
+		std::vector<TrianglePositions> referencePositions;
+		double referenceSeconds = 0.0;
+
+		for (int s = 0; s < numSettings; s++)
+		{
+			std::vector<MovedInstance> moved;
+			std::vector<TransformJob> jobs;
+			int numJobTriangles = 0;
+			int numJobVertices = 0;
+
+			if (settings[s].onlyMoved)
+			{
+				// Everything was moved to where it was a frame ago
+				// (the others wrote that), and then the frame changes
+				calcInstances(before, copies);
+				calcTransformJobs(meshRanges, copies, moved, jobs, &numJobTriangles);
+				calcInstances(after, copies);
+			}
+
+			numJobVertices = calcTransformJobs(meshRanges, copies, moved, jobs, &numJobTriangles);
+
+			int numJobThreads = numJobVertices + numJobTriangles;
+			int numGroups = (numJobThreads + settings[s].groupSize - 1) / settings[s].groupSize;
+
+			printf("  %6d %10d  %-22s %10d %10d ", numCopies[c], numTriangles, settings[s].name, numJobTriangles, numGroups);
+
+			if (numGroups > maxGroups)
+			{
+				printf("%9s\n", "too many groups");
+				continue;
+			}
+
+			GLuint shader = createShader(readShader("../Assets/Compute.glsl"), GL_COMPUTE_SHADER,
+				defines + transformDefines(settings[s].groupSize, settings[s].linearSearch));
+			GLuint program = glCreateProgram();
+			glAttachShader(program, shader);
+			glLinkProgram(program);
+			glUseProgram(program);
+
+			glUniform1i(glGetUniformLocation(program, "numJobVertices"), numJobVertices);
+			glUniform1i(glGetUniformLocation(program, "numJobs"), (int)jobs.size());
+			glUniform1i(glGetUniformLocation(program, "numJobThreads"), numJobThreads);
+
+			glBindBuffer(GL_UNIFORM_BUFFER, copyJobBuffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformJob) * jobs.size(), jobs.data());
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			// One dispatch that is not timed, the driver
+			// finishes making the program on the first one
+			glDispatchCompute(numGroups, 1, 1);
+			glFinish();
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			for (int d = 0; d < numDispatches; d++)
+			{
+				glDispatchCompute(numGroups, 1, 1);
+				glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			}
+
+			glFinish();
+
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / numDispatches;
+
+			std::vector<Vertex> vertices(numVertices);
+			std::vector<TrianglePositions> positions(numTriangles);
+
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glBindBuffer(GL_UNIFORM_BUFFER, copyVertexBuffer);
+			glGetBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Vertex) * numVertices, vertices.data());
+			glBindBuffer(GL_UNIFORM_BUFFER, copyPositionBuffer);
+			glGetBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TrianglePositions) * numTriangles, positions.data());
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			if (referenceVertices.empty())
+			{
+				referenceVertices = vertices;
+				referencePositions = positions;
+
+				if (s == 0)
+					referenceSeconds = seconds;
+			}
+
+			bool matches = memcmp(vertices.data(), referenceVertices.data(), sizeof(Vertex) * numVertices) == 0 &&
+				memcmp(positions.data(), referencePositions.data(), sizeof(TrianglePositions) * numTriangles) == 0;
+
+			// The speedup is only against the old way, and that can't run
+			// when it needs more groups than one dispatch can have
+			if (referenceSeconds > 0.0)
+				printf("%9.3f %7.2fx %8s\n", 1000.0 * seconds, referenceSeconds / seconds, matches ? "yes" : "NO");
+			else
+				printf("%9.3f %8s %8s\n", 1000.0 * seconds, "-", matches ? "yes" : "NO");
+
+			glDeleteProgram(program);
+			glDeleteShader(shader);
+		}
+	}
+
+	glDeleteBuffers(5, buffers);
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+Title: Basic Ray Tracer
+File Name: Benchmarks.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Every part of the program that was made faster has a way to see how much
+faster it got, without opening a window and reading the FPS. Each one is
+run by giving its flag to the program, main() hands it the command line,
+and it reads whatever comes after the flag. They print a table and return
+what main() returns.
+
+Most of them load the scene the way the CPU renderer does, with
+loadAssets, and never touch OpenGL. runTransformBenchmark needs the
+meshes on the GPU, so main() only runs it after init().
+*/
+
+#pragma once
+
+// "-objbench [grid size]", how many MB of OBJ text parseOBJ reads per second.
+// The files are read into memory first, so only the parsing is timed, not the
+// disk. The number after it changes the size of the big test grid (1000).
+int runObjParserBenchmark(int argc, char** argv);
+
+// "-meshcache", how much faster the .3Dbin files are. The first load throws
+// away every .3Dbin file, so every .3Dobj file is parsed (and the .3Dbin
+// files are made again), the second load maps the .3Dbin files that the
+// first one made.
+int runMeshCacheBenchmark(int argc, char** argv);
+
+// "-texcache", how much faster the .3Dtex files are, and how much smaller
+// the textures are on the GPU. Like runMeshCacheBenchmark, the first load
+// throws away every .3Dtex file, so every image is decoded, and its mip
+// levels are baked, the second load maps the .3Dtex files.
+int runTextureCacheBenchmark(int argc, char** argv);
+
+// "-cpu [frames] [mode]" draws the scene on the CPU instead of the GPU, so it
+// runs on computers that can't run our shaders. It never opens a window, it
+// draws that many frames of the animation (10) with 1 thread, then 2 threads,
+// then 4, and so on until it is using every core, and prints how many rays
+// per second each one traced. The last frame is saved to cpu_frame.png so
+// you can look at it. The mode is "linear" (no BVH), "flat" (one BVH per
+// mesh in world space, refit every frame, and only rebuilt when it gets
+// BVH_REFIT_MAX_COST_RATIO slower), "wavefront" (two level, drawn one pass
+// at a time, like WAVEFRONT_TRACE), or anything else for "two level" (the
+// same as TWO_LEVEL_BVH).
+int runCpuRenderer(int argc, char** argv);
+
+// "-lodbench [frames]", how much faster the LODs make the CPU renderer (with
+// the two level BVH), and how different the picture is. Every setting draws
+// the same frames (4), and the last one is compared to the last one with
+// LOD 0 for everything, at the same size. The sizes get smaller, so that the
+// LODs that selectLods picks (the "automatic" rows) get smaller too.
+int runLodBenchmark(int argc, char** argv);
+
+// "-transformbench [dispatches]" times Compute.glsl the way it used to run
+// (one thread in every group, and every thread walking through all the
+// instances before it to find its own), against TRANSFORM_GROUP_SIZE threads
+// in a group that find their job with a binary search, first moving every
+// instance, and then only the ones that moved since the frame before. Every
+// one is dispatched that many times (10). The scene's instances are copied
+// more and more times, so that there are more triangles to move.
+// This runs after init(), because it needs the meshes on the GPU.
+int runTransformBenchmark(int argc, char** argv);
@@ -0,0 +1,111 @@
+/*
+Title: Basic Ray Tracer
+File Name: CarStreamer.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include "CarStreamer.h"
+
+// The loader thread
+static void streamCars(CarStreamer* streamer, int firstCar)
+{
+	int car = firstCar;
+
+	// A car that was loaded, but didn't fit in the queue yet
+	StreamedCar* ready = nullptr;
+
+	while (!streamer->quit.load())
+	{
+		if (ready == nullptr)
+		{
+			ready = new StreamedCar();
+			ready->car = car;
+
+			if (!streamer->load(car, ready))
+			{
+				delete ready;
+				ready = nullptr;
+			}
+
+			car = (car + 1) % streamer->numCars;
+			continue;
+		}
+
+		// Only this thread writes tail. "acquire" makes sure the other
+		// thread is really done with a slot before it is written again.
+		unsigned int tail = streamer->tail.load(std::memory_order_relaxed);
+		unsigned int head = streamer->head.load(std::memory_order_acquire);
+
+		if (tail - head < CAR_STREAM_QUEUE_SIZE)
+		{
+			streamer->queue[tail % CAR_STREAM_QUEUE_SIZE] = ready;
+			ready = nullptr;
+
+			// "release" makes sure the car is all there before the other thread sees it
+			streamer->tail.store(tail + 1, std::memory_order_release);
+		}
+		else
+		{
+			// The queue is full, the cars change about once a second,
+			// so there is no hurry, check again in a little while
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+
+	delete ready;
+}
+
+void startCarStreamer(CarStreamer& streamer, int firstCar, int numCars, std::function<bool(int, StreamedCar*)> load)
+{
+	streamer.load = load;
+	streamer.numCars = numCars;
+	streamer.quit = false;
+
+	if (numCars > 0)
+		streamer.thread = std::thread(streamCars, &streamer, firstCar % numCars);
+}
+
+StreamedCar* popStreamedCar(CarStreamer& streamer)
+{
+	// Only this thread writes head
+	unsigned int head = streamer.head.load(std::memory_order_relaxed);
+	unsigned int tail = streamer.tail.load(std::memory_order_acquire);
+
+	if (head == tail)
+		return nullptr;
+
+	StreamedCar* car = streamer.queue[head % CAR_STREAM_QUEUE_SIZE];
+	streamer.head.store(head + 1, std::memory_order_release);
+
+	return car;
+}
+
+void stopCarStreamer(CarStreamer& streamer)
+{
+	streamer.quit = true;
+
+	if (streamer.thread.joinable())
+		streamer.thread.join();
+
+	while (StreamedCar* car = popStreamedCar(streamer))
+		delete car;
+}
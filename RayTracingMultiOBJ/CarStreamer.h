@@ -0,0 +1,98 @@
+/*
+Title: Basic Ray Tracer
+File Name: CarStreamer.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Only two cars are on the GPU at a time (see NUM_CAR_SLOTS in main.cpp),
+the one that is shown, and the one that comes next. Every other car in
+the catalog stays on the disk until it is its turn.
+
+A CarStreamer loads the cars that come next on its own thread, while the
+frames are drawn, so that the frame that changes the car never waits
+for a file. Every car it loads goes into a queue, and renderScene takes
+it out of the queue when it is time to change the car. If the next car
+is not ready yet, renderScene just keeps the old car for a little longer.
+
+The queue has one thread that puts cars in (the loader), and one thread
+that takes them out (the one that draws), so it doesn't need a lock.
+Each thread only ever writes its own end of the queue, and reads the
+other end to see if there is room, or if there is something to take.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "Scene.h"
+#include "BVH.h"
+#include "Simplify.h"
+
+// How many cars the loader can get ahead of the one that is shown
+#define CAR_STREAM_QUEUE_SIZE 2
+
+// One car, loaded and ready to be copied to the GPU
+struct StreamedCar
+{
+	// which car of the catalog it is, counting from 0
+	int car = 0;
+
+	// The car as it was loaded, and its other LODs
+	Mesh lods[NUM_LODS];
+
+	// The tree of every LOD, on its own, starting at node 0
+	// and triangle 0 (only built with TWO_LEVEL_BVH)
+	SceneBVH bvh[NUM_LODS];
+	int bvhRoot[NUM_LODS];
+};
+
+struct CarStreamer
+{
+	// Loads car "car" of the catalog into "out". Runs on the loader thread.
+	// Returns false if the car can't be used, and then it is skipped.
+	std::function<bool(int car, StreamedCar* out)> load;
+
+	int numCars = 0;
+
+	// The loader puts cars in at "tail", and the thread that draws takes
+	// them out at "head". They only count up, slot i of the queue is
+	// queue[i % CAR_STREAM_QUEUE_SIZE]. When head == tail, it is empty.
+	StreamedCar* queue[CAR_STREAM_QUEUE_SIZE] = {};
+	std::atomic<unsigned int> head{ 0 };
+	std::atomic<unsigned int> tail{ 0 };
+
+	std::atomic<bool> quit{ false };
+	std::thread thread;
+};
+
+// Starts the loader thread, which loads car "firstCar", and every car after
+// it (going back to car 0 after the last one), as long as there is room in
+// the queue, until stopCarStreamer is called.
+void startCarStreamer(CarStreamer& streamer, int firstCar, int numCars, std::function<bool(int, StreamedCar*)> load);
+
+// Takes the next car out of the queue, or gives back null if the loader
+// isn't done with it yet. Never waits. The caller owns the car, and
+// deletes it when it is done with it.
+StreamedCar* popStreamedCar(CarStreamer& streamer);
+
+// Stops the loader thread, and throws away the cars that are still in the queue
+void stopCarStreamer(CarStreamer& streamer);
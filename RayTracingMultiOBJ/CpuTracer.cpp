@@ -0,0 +1,1152 @@
+/*
+Title: Basic Ray Tracer
+File Name: CpuTracer.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+#include "CpuTracer.h"
+
+// Same constant as the fragment shader
+#define MAX_SCENE_BOUNDS 100.0f
+
+// Width and height (in pixels) of the square tiles
+// that the frame is split into. Every thread grabs
+// the next tile that nobody has drawn yet, until
+// there are no tiles left.
+#define TILE_SIZE 16
+
+// Everything the shading needs to know about a hit, filled in while the ray
+// is traced (hitinfo in FragmentShader.glsl). 32 bytes, so it fits in half a cache line.
+struct HitRecord
+{
+	// where the ray hit, and how far along the ray that is
+	glm::vec3 point;
+	float dist;
+
+	// which instance, and which triangle of its mesh
+	int m;
+	int t;
+
+	// u and v from rayIntersectsTriangle, the corners
+	// are weighted (1 - u - v), u, and v
+	glm::vec2 bary;
+};
+
+// The uvs and normals of the corners of the triangle that was hit (InTriangle in
+// FragmentShader.glsl), the positions are not needed, the HitRecord says where the hit is
+struct HitTriangle
+{
+	glm::vec2 uv[3];
+	glm::vec3 normal[3];
+};
+
+void cpuTransformMeshes(const Mesh* in, const Instance* instances, int numInstances, Mesh* out, const glm::mat4x4* matrices, MeshBounds* bounds)
+{
+	for (int i = 0; i < numInstances; i++)
+	{
+		const Mesh& mesh = in[instances[i].mesh];
+		const glm::mat4x4& matrix = matrices[instances[i].transform];
+		glm::mat3 normalMatrix = glm::mat3(matrix);
+
+		out[i].numTriangles = mesh.numTriangles;
+		out[i].numVertices = mesh.numVertices;
+		out[i].vertices.resize(mesh.numVertices);
+
+		// The triangles still use the same corners, so the copy
+		// uses the indices of the mesh, instead of copying them
+		out[i].mappedIndices = mesh.indexData();
+
+		// start with an empty box, and grow it around every vertex
+		bounds[i].boundsMin = glm::vec3(FLT_MAX);
+		bounds[i].boundsMax = glm::vec3(-FLT_MAX);
+
+		const Vertex* src = mesh.vertexData();
+
+		for (int j = 0; j < mesh.numVertices; j++)
+		{
+			Vertex& dst = out[i].vertices[j];
+
+			// multiply point by model matrix
+			dst.pos = glm::vec3(matrix * glm::vec4(src[j].pos, 1.0f));
+
+			bounds[i].boundsMin = glm::min(bounds[i].boundsMin, dst.pos);
+			bounds[i].boundsMax = glm::max(bounds[i].boundsMax, dst.pos);
+
+			// multiply normal by model matrix
+			dst.normal = glm::normalize(normalMatrix * src[j].normal);
+
+			// The UVs don't move, they are just copied
+			dst.u = src[j].u;
+			dst.v = src[j].v;
+		}
+
+		// Same as transformTriangle in Compute.glsl, made
+		// from the corners that were just moved
+		out[i].calcPositions();
+	}
+}
+
+// The color of a BC1 block (or the color part of a BC3 block) at texel i
+// of the block, the same way the GPU decodes it. BC1 blocks with the
+// first color not bigger than the second have 3 colors and transparent black.
+static glm::vec4 decodeColorBlock(const unsigned char* block, int i, bool fourColors)
+{
+	unsigned short c[2];
+	unsigned int indices;
+
+	memcpy(c, block, 4);
+	memcpy(&indices, block + 4, 4);
+
+	glm::vec4 ends[2];
+
+	for (int k = 0; k < 2; k++)
+	{
+		int r = (c[k] >> 11) & 31;
+		int g = (c[k] >> 5) & 63;
+		int b = c[k] & 31;
+
+		ends[k] = glm::vec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255);
+	}
+
+	int index = (indices >> (2 * i)) & 3;
+
+	if (index < 2)
+		return ends[index];
+
+	if (fourColors || c[0] > c[1])
+		return index == 2 ? (2.0f * ends[0] + ends[1]) / 3.0f : (ends[0] + 2.0f * ends[1]) / 3.0f;
+
+	return index == 2 ? (ends[0] + ends[1]) / 2.0f : glm::vec4(0);
+}
+
+// The alpha part of a BC3 block at texel i of the block
+static float decodeAlphaBlock(const unsigned char* block, int i)
+{
+	int a0 = block[0];
+	int a1 = block[1];
+
+	unsigned long long indices = 0;
+	for (int k = 0; k < 6; k++)
+		indices |= (unsigned long long)block[2 + k] << (8 * k);
+
+	int index = (int)(indices >> (3 * i)) & 7;
+
+	if (index == 0) return (float)a0;
+	if (index == 1) return (float)a1;
+
+	// 6 steps between the ends
+	if (a0 > a1)
+		return ((8 - index) * a0 + (index - 1) * a1) / 7.0f;
+
+	// 4 steps, and then 0 and 255
+	if (index == 6) return 0.0f;
+	if (index == 7) return 255.0f;
+
+	return ((6 - index) * a0 + (index - 1) * a1) / 5.0f;
+}
+
+CpuTexture cpuDecompressTexture(const CpuTexture& tex)
+{
+	if (tex.format == TEXTURE_FORMAT_BGRA8 || tex.numLevels == 0)
+		return tex;
+
+	CpuTexture out;
+	out.width = tex.width;
+	out.height = tex.height;
+	out.format = TEXTURE_FORMAT_BGRA8;
+	out.numLevels = 1;
+	out.levelOffset[0] = 0;
+	out.levelSize[0] = 4 * (size_t)tex.width * tex.height;
+	out.texels.resize(out.levelSize[0]);
+
+	const unsigned char* level = tex.levelData(0);
+	int blocksWide = (tex.width + 3) / 4;
+
+	for (int y = 0; y < tex.height; y++)
+	{
+		for (int x = 0; x < tex.width; x++)
+		{
+			int block = (y / 4) * blocksWide + (x / 4);
+			int i = (y % 4) * 4 + (x % 4);
+
+			glm::vec4 c;
+
+			if (tex.format == TEXTURE_FORMAT_BC1)
+			{
+				c = decodeColorBlock(&level[8 * block], i, false);
+			}
+			else
+			{
+				c = decodeColorBlock(&level[16 * block + 8], i, true);
+				c.a = decodeAlphaBlock(&level[16 * block], i);
+			}
+
+			// RGBA -> BGRA
+			unsigned char* p = &out.texels[4 * ((size_t)y * tex.width + x)];
+			p[0] = (unsigned char)(c.b + 0.5f);
+			p[1] = (unsigned char)(c.g + 0.5f);
+			p[2] = (unsigned char)(c.r + 0.5f);
+			p[3] = (unsigned char)(c.a + 0.5f);
+		}
+	}
+
+	return out;
+}
+
+// Bilinear filtering with GL_REPEAT wrapping, this is what
+// texture() does in the shader when it reads mip level 0.
+// The texture has to be BGRA8, see cpuDecompressTexture.
+static glm::vec4 sampleTexture(const CpuTexture* tex, glm::vec2 uv)
+{
+	if (tex == nullptr || tex->numLevels == 0)
+		return glm::vec4(1);
+
+	// Texel centers are at half-texel offsets, just like in OpenGL
+	float x = uv.x * tex->width - 0.5f;
+	float y = uv.y * tex->height - 0.5f;
+
+	float fx = floorf(x);
+	float fy = floorf(y);
+
+	float wx = x - fx;
+	float wy = y - fy;
+
+	int x0 = (int)fx;
+	int y0 = (int)fy;
+
+	glm::vec4 c[4];
+
+	for (int i = 0; i < 4; i++)
+	{
+		// wrap the texel coordinates for GL_REPEAT
+		int tx = (x0 + (i & 1)) % tex->width;
+		int ty = (y0 + (i >> 1)) % tex->height;
+
+		if (tx < 0) tx += tex->width;
+		if (ty < 0) ty += tex->height;
+
+		const unsigned char* p = &tex->levelData(0)[4 * (ty * tex->width + tx)];
+
+		// BGRA -> RGBA
+		c[i] = glm::vec4(p[2], p[1], p[0], p[3]) / 255.0f;
+	}
+
+	return glm::mix(
+		glm::mix(c[0], c[1], wx),
+		glm::mix(c[2], c[3], wx),
+		wy);
+}
+
+// Determines whether or not a ray in a given direction hits a given triangle.
+// Returns -1.0 if it does not; otherwise returns the value t at which the ray hits the triangle.
+// See the function with the same name in FragmentShader.glsl for a step by step explanation.
+// v0 is the first corner, e1 and e2 are the edges from it (see TrianglePositions).
+// If the ray hits, bary is set to u and v.
+static float rayIntersectsTriangle(glm::vec3 p, glm::vec3 d, glm::vec3 v0, glm::vec3 e1, glm::vec3 e2, glm::vec2& bary)
+{
+	glm::vec3 h = glm::cross(d, e2);
+	float a = glm::dot(e1, h);
+
+	if (a > -0.00001f && a < 0.00001f)
+		return -1.0f;
+
+	float f = 1 / a;
+
+	glm::vec3 s = p - v0;
+	float u = f * glm::dot(s, h);
+
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	glm::vec3 q = glm::cross(s, e1);
+	float v = f * glm::dot(d, q);
+
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+
+	float t = f * glm::dot(e2, q);
+
+	if (t > 0.00001f)
+	{
+		bary = glm::vec2(u, v);
+		return t;
+	}
+
+	return -1.0f;
+}
+
+// Slab test, returns -1 if the ray misses the box,
+// otherwise the distance to where the ray enters the box
+static float rayIntersectsBox(glm::vec3 p, glm::vec3 invDir, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	glm::vec3 t0 = (boundsMin - p) * invDir;
+	glm::vec3 t1 = (boundsMax - p) * invDir;
+
+	glm::vec3 tSmall = glm::min(t0, t1);
+	glm::vec3 tBig = glm::max(t0, t1);
+
+	float tNear = glm::max(glm::max(tSmall.x, tSmall.y), tSmall.z);
+	float tFar = glm::min(glm::min(tBig.x, tBig.y), tBig.z);
+
+	if (tFar < glm::max(tNear, 0.0f))
+		return -1.0f;
+
+	return glm::max(tNear, 0.0f);
+}
+
+// 1 / direction, without dividing by zero
+static glm::vec3 inverseDirection(glm::vec3 dir)
+{
+	glm::vec3 s = glm::vec3(dir.x < 0.0f ? -1.0f : 1.0f, dir.y < 0.0f ? -1.0f : 1.0f, dir.z < 0.0f ? -1.0f : 1.0f);
+	return s / glm::max(glm::abs(dir), glm::vec3(0.00000001f));
+}
+
+// Tests a ray against the triangles of one mesh, by walking down the mesh's BVH.
+// Same as intersectMeshBVH in FragmentShader.glsl, only info.t and info.bary are set here.
+static bool intersectMeshBVH(const CpuScene& scene, const Mesh& mesh, int rootNode, glm::vec3 origin, glm::vec3 dir, glm::vec3 invDir, bool anyHit, float& smallest, HitRecord& info)
+{
+	const SceneBVH& bvh = *scene.bvh;
+
+	const TrianglePositions* positions = mesh.positions.data();
+
+	int nodeIndex = rootNode;
+
+	// empty mesh, the root box was already tested with the mesh's hitbox
+	if (nodeIndex < 0)
+		return false;
+
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	bool found = false;
+
+	while (true)
+	{
+		const BVHNode& node = bvh.nodes[nodeIndex];
+
+		if (node.count > 0)
+		{
+			// leaf, test every triangle in it
+			for (int k = 0; k < node.count; k++)
+			{
+				int j = bvh.triangles[node.leftFirst + k];
+				const TrianglePositions& p = positions[j];
+
+				glm::vec2 bary;
+				float d = rayIntersectsTriangle(origin, dir, p.v0, p.e1, p.e2, bary);
+
+				if (d != -1.0f && d < smallest)
+				{
+					smallest = d;
+					info.t = j;
+					info.bary = bary;
+
+					found = true;
+
+					if (anyHit)
+						return true;
+				}
+			}
+		}
+		else
+		{
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+
+			float dLeft = rayIntersectsBox(origin, invDir, bvh.nodes[left].boundsMin, bvh.nodes[left].boundsMax);
+			float dRight = rayIntersectsBox(origin, invDir, bvh.nodes[right].boundsMin, bvh.nodes[right].boundsMax);
+
+			if (dLeft >= smallest)
+				dLeft = -1.0f;
+
+			if (dRight >= smallest)
+				dRight = -1.0f;
+
+			// visit the closer child first
+			if (dLeft != -1.0f && dRight != -1.0f)
+			{
+				if (dRight < dLeft)
+				{
+					stack[stackSize++] = left;
+					nodeIndex = right;
+				}
+				else
+				{
+					stack[stackSize++] = right;
+					nodeIndex = left;
+				}
+
+				continue;
+			}
+
+			if (dLeft != -1.0f)
+			{
+				nodeIndex = left;
+				continue;
+			}
+
+			if (dRight != -1.0f)
+			{
+				nodeIndex = right;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+
+		nodeIndex = stack[--stackSize];
+	}
+
+	return found;
+}
+
+// Tests a ray against every instance in the top level tree at "rootNode" that has every
+// bit of "mask", by walking down the tree, and then down the tree of the mesh of every
+// instance the ray gets to. Same as intersectInstances in FragmentShader.glsl.
+static bool intersectInstances(const CpuScene& scene, int rootNode, glm::vec3 origin, glm::vec3 dir, int mask, bool anyHit, float& smallest, HitRecord& info)
+{
+	const SceneBVH& bvh = *scene.bvh;
+
+	int nodeIndex = rootNode;
+
+	if (nodeIndex < 0)
+		return false;
+
+	glm::vec3 invDir = inverseDirection(dir);
+
+	float dRoot = rayIntersectsBox(origin, invDir, bvh.nodes[nodeIndex].boundsMin, bvh.nodes[nodeIndex].boundsMax);
+
+	if (dRoot == -1.0f || dRoot >= smallest)
+		return false;
+
+	int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	bool found = false;
+
+	while (true)
+	{
+		const BVHNode& node = bvh.nodes[nodeIndex];
+
+		if (node.count > 0)
+		{
+			// leaf, test the instances in it
+			for (int k = 0; k < node.count; k++)
+			{
+				int id = bvh.triangles[node.leftFirst + k];
+				const Instance& inst = scene.instances[id];
+
+				if ((inst.mask & mask) != mask)
+					continue;
+
+				// Move the ray into the object space of the instance,
+				// without normalizing dir, so that distances stay the same
+				glm::vec3 objectOrigin = glm::vec3(inst.worldToObject * glm::vec4(origin, 1.0f));
+				glm::vec3 objectDir = glm::mat3(inst.worldToObject) * dir;
+
+				// Shadow rays go into the tree of the shadow LOD
+				bool shadow = (mask & INSTANCE_MASK_SHADOW) != 0;
+				const Mesh& mesh = scene.meshes[shadow ? inst.shadowMesh : inst.mesh];
+				int root = shadow ? inst.shadowBvhRoot : inst.bvhRoot;
+
+				if (intersectMeshBVH(scene, mesh, root, objectOrigin, objectDir, inverseDirection(objectDir), anyHit, smallest, info))
+				{
+					info.m = id;
+					found = true;
+
+					if (anyHit)
+						return true;
+				}
+			}
+		}
+		else
+		{
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+
+			float dLeft = rayIntersectsBox(origin, invDir, bvh.nodes[left].boundsMin, bvh.nodes[left].boundsMax);
+			float dRight = rayIntersectsBox(origin, invDir, bvh.nodes[right].boundsMin, bvh.nodes[right].boundsMax);
+
+			if (dLeft >= smallest)
+				dLeft = -1.0f;
+
+			if (dRight >= smallest)
+				dRight = -1.0f;
+
+			// visit the closer child first
+			if (dLeft != -1.0f && dRight != -1.0f)
+			{
+				if (dRight < dLeft)
+				{
+					stack[stackSize++] = left;
+					nodeIndex = right;
+				}
+				else
+				{
+					stack[stackSize++] = right;
+					nodeIndex = left;
+				}
+
+				continue;
+			}
+
+			if (dLeft != -1.0f)
+			{
+				nodeIndex = left;
+				continue;
+			}
+
+			if (dRight != -1.0f)
+			{
+				nodeIndex = right;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+
+		nodeIndex = stack[--stackSize];
+	}
+
+	return found;
+}
+
+// Tests a ray against every triangle in the scene, and gives back the closest hit
+static bool intersectTriangles(const CpuScene& scene, glm::vec3 origin, glm::vec3 dir, HitRecord& info)
+{
+	const Mesh* m = scene.transformed;
+
+	float smallest = MAX_SCENE_BOUNDS;
+	bool found = false;
+
+	if (m == nullptr)
+	{
+		found = intersectInstances(scene, scene.bvh->topLevelRoot, origin, dir, INSTANCE_MASK_CAMERA, false, smallest, info);
+		info.point = origin + (dir * smallest);
+		info.dist = smallest;
+		return found;
+	}
+
+	glm::vec3 invDir = inverseDirection(dir);
+
+	for (int i = 0; i < scene.numInstances; i++)
+	{
+		// Check if ray collides with mesh's hitbox
+		// before checking the triangles of the mesh
+		float dHitbox = rayIntersectsBox(origin, invDir, scene.bounds[i].boundsMin, scene.bounds[i].boundsMax);
+
+		if (dHitbox == -1.0f || dHitbox >= smallest)
+			continue;
+
+		if (scene.bvh != nullptr)
+		{
+			if (intersectMeshBVH(scene, m[i], scene.bvh->root[i], origin, dir, invDir, false, smallest, info))
+			{
+				info.m = i;
+				found = true;
+			}
+
+			continue;
+		}
+
+		// no BVH, test every triangle
+		const TrianglePositions* positions = m[i].positions.data();
+
+		for (int j = 0; j < m[i].numTriangles; j++)
+		{
+			const TrianglePositions& p = positions[j];
+
+			glm::vec2 bary;
+			float d = rayIntersectsTriangle(origin, dir, p.v0, p.e1, p.e2, bary);
+
+			if (d != -1.0f && d < smallest)
+			{
+				smallest = d;
+
+				info.m = i;
+				info.t = j;
+				info.bary = bary;
+
+				found = true;
+			}
+		}
+	}
+
+	info.point = origin + (dir * smallest);
+	info.dist = smallest;
+
+	return found;
+}
+
+// Same as occluded in FragmentShader.glsl, true if anything that can cast a
+// shadow from light "l" is on the ray closer than tMax. It stops at the first
+// triangle it finds, and only tests the instances near the light.
+static bool occluded(const CpuScene& scene, int l, glm::vec3 origin, glm::vec3 dir, float tMax)
+{
+	const Mesh* m = scene.transformed;
+
+	float smallest = tMax;
+	HitRecord info;
+
+	// down the light's own top level tree
+	if (m == nullptr)
+		return intersectInstances(scene, scene.bvh->shadowRoot[l], origin, dir, INSTANCE_MASK_SHADOW | INSTANCE_MASK_LIGHT(l), true, smallest, info);
+
+	glm::vec3 invDir = inverseDirection(dir);
+
+	const ShadowCasters& casters = *scene.shadowCasters;
+
+	for (int k = 0; k < casters.count[l]; k++)
+	{
+		int i = casters.instances[l * scene.numInstances + k];
+
+		float dHitbox = rayIntersectsBox(origin, invDir, scene.bounds[i].boundsMin, scene.bounds[i].boundsMax);
+
+		if (dHitbox == -1.0f || dHitbox >= smallest)
+			continue;
+
+		if (scene.bvh != nullptr)
+		{
+			if (intersectMeshBVH(scene, m[i], scene.bvh->root[i], origin, dir, invDir, true, smallest, info))
+				return true;
+
+			continue;
+		}
+
+		const TrianglePositions* positions = m[i].positions.data();
+
+		for (int j = 0; j < m[i].numTriangles; j++)
+		{
+			const TrianglePositions& p = positions[j];
+
+			glm::vec2 bary;
+			float d = rayIntersectsTriangle(origin, dir, p.v0, p.e1, p.e2, bary);
+
+			if (d != -1.0f && d < smallest)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+// Gives back the uvs and normals of the triangle that a ray hit, with the
+// normals in world space. Same as getHitTriangle in FragmentShader.glsl.
+static HitTriangle getHitTriangle(const CpuScene& scene, const HitRecord& i)
+{
+	// already moved into the instance's own copy of the mesh
+	bool transformed = scene.transformed != nullptr;
+	const Instance& inst = scene.instances[i.m];
+	const Mesh& mesh = transformed ? scene.transformed[i.m] : scene.meshes[inst.mesh];
+
+	const Vertex* v = mesh.vertexData();
+	const unsigned int* index = mesh.indexData() + 3 * i.t;
+
+	glm::mat3 normalMatrix = glm::transpose(glm::mat3(inst.worldToObject));
+
+	HitTriangle t;
+
+	for (int k = 0; k < 3; k++)
+	{
+		const Vertex& corner = v[index[k]];
+
+		t.uv[k] = glm::vec2(corner.u, corner.v);
+		t.normal[k] = transformed ? corner.normal : glm::normalize(normalMatrix * corner.normal);
+	}
+
+	return t;
+}
+
+// Blends the three normals together for the point that was hit,
+// with the weights that rayIntersectsTriangle already worked out
+static glm::vec3 GetInterpolatedNormal(glm::vec2 bary, glm::vec3 n1, glm::vec3 n2, glm::vec3 n3)
+{
+	float u = 1.0f - bary.x - bary.y;
+
+	return glm::normalize(u * n1 + bary.x * n2 + bary.y * n3);
+}
+
+static glm::vec2 GetInterpolatedUV(glm::vec2 bary, glm::vec2 t1, glm::vec2 t2, glm::vec2 t3)
+{
+	float u = 1.0f - bary.x - bary.y;
+
+	return u * t1 + bary.x * t2 + bary.y * t3;
+}
+
+// t is getHitTriangle(scene, i), which trace() only looks up once
+static glm::vec4 getSurfaceColor(const CpuScene& scene, const HitRecord& i, const HitTriangle& t)
+{
+	glm::vec2 uv = GetInterpolatedUV(i.bary, t.uv[0], t.uv[1], t.uv[2]);
+
+	return sampleTexture(scene.textures[scene.instances[i.m].texture], uv);
+}
+
+// How much light L puts on the point that was hit, if nothing is in the way.
+// pointToLight is the direction to the light, and dist is how far away it is.
+static glm::vec3 lightColor(const CpuScene& scene, const light& L, glm::vec3 pointToLight, float dist, const HitRecord& rayHitPoint, const HitTriangle& t)
+{
+	glm::vec3 normal = GetInterpolatedNormal(rayHitPoint.bary, t.normal[0], t.normal[1], t.normal[2]);
+
+	float NdotL = glm::clamp(glm::dot(normal, pointToLight), 0.0f, 1.0f);
+
+	// Formula for range-based attenuation
+	float atten = glm::clamp(1.0f - (dist * dist) / (L.radius * L.radius), 0.0f, 1.0f);
+
+	float diffuse = NdotL;
+
+	glm::vec3 brightness = L.brightness * glm::vec3(L.color) * atten;
+
+	glm::vec4 surfaceColor = getSurfaceColor(scene, rayHitPoint, t);
+
+	return glm::vec3(surfaceColor) * brightness * diffuse;
+}
+
+static glm::vec3 addLightColorToPixColor(const CpuScene& scene, int l, const HitRecord& rayHitPoint, const HitTriangle& t, bool checkShadows, unsigned long long& rays)
+{
+	const light& L = scene.lights[l];
+
+	// get direction from point to light
+	glm::vec3 pointToLight = glm::vec3(L.pos) - rayHitPoint.point;
+
+	// Get the distance from point on surface to light
+	float dist = glm::length(pointToLight);
+
+	// the light doesn't touch the pixel
+	if (dist > L.radius)
+		return glm::vec3(0);
+
+	pointToLight = glm::normalize(pointToLight);
+
+	if (checkShadows)
+	{
+		rays++;
+
+		// If the light hits another surface before it gets to this point, it is in shadow
+		if (occluded(scene, l, glm::vec3(L.pos), -pointToLight, dist - SHADOW_RAY_BIAS))
+			return glm::vec3(0);
+	}
+
+	return lightColor(scene, L, pointToLight, dist, rayHitPoint, t);
+}
+
+static glm::vec4 trace(const CpuScene& scene, glm::vec3 origin, glm::vec3 dirEyeToTriangle, unsigned long long& rays)
+{
+	HitRecord eyeHitTriangle;
+
+	rays++;
+
+	if (intersectTriangles(scene, origin, dirEyeToTriangle, eyeHitTriangle))
+	{
+		// the only time the normals and uvs of the triangle are read
+		HitTriangle t = getHitTriangle(scene, eyeHitTriangle);
+
+		glm::vec4 surfaceColor = getSurfaceColor(scene, eyeHitTriangle, t);
+
+		// ambient light
+		glm::vec3 pixColor = glm::vec3(surfaceColor) * 0.1f;
+
+		// which mesh the instance is a copy of
+		int mesh = scene.instances[eyeHitTriangle.m].mesh;
+
+		// skybox
+		if (mesh == 1)
+			return surfaceColor;
+
+		// Every light adds its color. Only the plane has shadows
+		// on it, the car and tires don't check for shadows.
+		for (int l = 0; l < MAX_LIGHTS; l++)
+			pixColor += addLightColorToPixColor(scene, l, eyeHitTriangle, t, mesh == 0, rays);
+
+		return glm::vec4(pixColor, 1.0f);
+	}
+
+	return glm::vec4(glm::vec3(0), 1.0f);
+}
+
+// Draws every pixel of one tile, this is the main() of the fragment shader
+// running once for every pixel in the tile
+static void renderTile(const CpuScene& scene, const CameraRays& cam, int width, int height, int tileX, int tileY, unsigned char* rgba, unsigned long long& rays)
+{
+	int endX = glm::min(tileX + TILE_SIZE, width);
+	int endY = glm::min(tileY + TILE_SIZE, height);
+
+	for (int y = tileY; y < endY; y++)
+	{
+		for (int x = tileX; x < endX; x++)
+		{
+			// Same as textureCoord in the fragment shader,
+			// which is at the center of the pixel
+			glm::vec2 pos = glm::vec2((x + 0.5f) / width, (y + 0.5f) / height);
+			glm::vec3 dir = glm::normalize(glm::mix(glm::mix(cam.r00, cam.r01, pos.y), glm::mix(cam.r10, cam.r11, pos.y), pos.x));
+
+			glm::vec4 color = glm::clamp(trace(scene, cam.eye, dir, rays), 0.0f, 1.0f);
+
+			unsigned char* p = &rgba[4 * (y * width + x)];
+			p[0] = (unsigned char)(color.r * 255.0f + 0.5f);
+			p[1] = (unsigned char)(color.g * 255.0f + 0.5f);
+			p[2] = (unsigned char)(color.b * 255.0f + 0.5f);
+			p[3] = (unsigned char)(color.a * 255.0f + 0.5f);
+		}
+	}
+}
+
+unsigned long long cpuRenderFrame(const CpuScene& scene, const CameraRays& cam, int width, int height, unsigned char* rgba, int numThreads)
+{
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	int numTiles = tilesX * tilesY;
+
+	// The next tile that has not been drawn yet
+	std::atomic<int> nextTile(0);
+
+	// Every thread counts its own rays, so that the threads never
+	// write to the same cache line while they are working
+	struct alignas(64) RayCount
+	{
+		unsigned long long rays = 0;
+	};
+
+	std::vector<RayCount> rayCounts(numThreads);
+
+	auto worker = [&](int threadIndex)
+	{
+		unsigned long long rays = 0;
+
+		for (int tile = nextTile++; tile < numTiles; tile = nextTile++)
+		{
+			int tileX = (tile % tilesX) * TILE_SIZE;
+			int tileY = (tile / tilesX) * TILE_SIZE;
+
+			renderTile(scene, cam, width, height, tileX, tileY, rgba, rays);
+		}
+
+		rayCounts[threadIndex].rays = rays;
+	};
+
+	// The calling thread does work too,
+	// so we only need numThreads - 1 new threads
+	std::vector<std::thread> threads;
+
+	for (int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(worker, i));
+
+	worker(0);
+
+	for (auto& t : threads)
+		t.join();
+
+	unsigned long long totalRays = 0;
+
+	for (auto& r : rayCounts)
+		totalRays += r.rays;
+
+	return totalRays;
+}
+
+// Runs "pass" for every group, from 0 to numGroups - 1, like a glDispatchCompute
+// of numGroups groups. The groups are shared by numThreads threads, the same
+// way cpuRenderFrame shares the tiles, and every pass waits for the one before.
+template<typename Pass>
+static void dispatchGroups(int numGroups, int numThreads, Pass pass)
+{
+	std::atomic<int> nextGroup(0);
+
+	auto worker = [&]()
+	{
+		for (int group = nextGroup++; group < numGroups; group = nextGroup++)
+			pass(group);
+	};
+
+	std::vector<std::thread> threads;
+
+	for (int i = 1; i < numThreads && i < numGroups; i++)
+		threads.push_back(std::thread(worker));
+
+	worker();
+
+	for (auto& t : threads)
+		t.join();
+}
+
+// How many groups a pass needs for "count" entries
+static int numWavefrontGroups(unsigned int count)
+{
+	return (int)((count + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE);
+}
+
+// Puts the entries that one group made at the end of a queue, with one
+// atomic add for the whole group, like pushToQueue in FragmentShader.glsl
+template<typename Entry>
+static void pushToQueue(CpuWavefrontQueues& queues, int queue, std::vector<Entry>& entries, const Entry* made, int count)
+{
+	if (count == 0)
+		return;
+
+	unsigned int first = queues.counts[queue].fetch_add(count);
+
+	memcpy(&entries[first], made, count * sizeof(Entry));
+}
+
+// Adds a color to a pixel, as fixed point, see WAVEFRONT_COLOR_SCALE
+static void addToPixel(CpuWavefrontQueues& queues, int pixel, glm::vec3 color)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		unsigned int add = (unsigned int)(glm::max(color[c], 0.0f) * WAVEFRONT_COLOR_SCALE + 0.5f);
+
+		if (add != 0)
+			queues.pixelColors[3 * pixel + c] += add;
+	}
+}
+
+// Where thread i of a group is in its tile, the same Z order as zOrderPixel in FragmentShader.glsl
+static glm::ivec2 zOrderPixel(unsigned int i)
+{
+	return glm::ivec2(
+		(i & 1u) | ((i >> 1u) & 2u) | ((i >> 2u) & 4u) | ((i >> 3u) & 8u),
+		((i >> 1u) & 1u) | ((i >> 2u) & 2u) | ((i >> 3u) & 4u) | ((i >> 4u) & 8u));
+}
+
+unsigned long long cpuRenderFrameWavefront(const CpuScene& scene, const CameraRays& cam, int width, int height, unsigned char* rgba, int numThreads, CpuWavefrontQueues& queues)
+{
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	int numPixels = width * height;
+
+	// Every queue has room for one entry for every pixel, there is one camera
+	// ray for every pixel, and at most one shadow ray for every hit
+	if (queues.numPixels != numPixels)
+	{
+		queues.rays.resize(numPixels);
+		queues.hits.resize(numPixels);
+		queues.shadowRays.resize(numPixels * MAX_LIGHTS);
+
+		// resolve sets every pixel back to 0 after it reads it
+		queues.pixelColors.reset(new std::atomic<unsigned int>[3 * numPixels]);
+
+		for (int i = 0; i < 3 * numPixels; i++)
+			queues.pixelColors[i] = 0;
+
+		queues.numPixels = numPixels;
+	}
+
+	for (int i = 0; i < NUM_WAVEFRONT_QUEUES; i++)
+		queues.counts[i] = 0;
+
+	// generate, one group for every tile
+	int tilesX = (width + WAVEFRONT_TILE_SIZE - 1) / WAVEFRONT_TILE_SIZE;
+	int tilesY = (height + WAVEFRONT_TILE_SIZE - 1) / WAVEFRONT_TILE_SIZE;
+
+	dispatchGroups(tilesX * tilesY, numThreads, [&](int group)
+	{
+		WavefrontRay made[WAVEFRONT_GROUP_SIZE];
+		int count = 0;
+
+		glm::ivec2 tile = glm::ivec2(group % tilesX, group / tilesX) * WAVEFRONT_TILE_SIZE;
+
+		for (int i = 0; i < WAVEFRONT_GROUP_SIZE; i++)
+		{
+			glm::ivec2 pixel = tile + zOrderPixel(i);
+
+			if (pixel.x >= width || pixel.y >= height)
+				continue;
+
+			// Same as textureCoord in the fragment shader,
+			// which is at the center of the pixel
+			glm::vec2 pos = glm::vec2((pixel.x + 0.5f) / width, (pixel.y + 0.5f) / height);
+
+			WavefrontRay& ray = made[count++];
+			ray.origin = cam.eye;
+			ray.pixel = pixel.y * width + pixel.x;
+			ray.dir = glm::normalize(glm::mix(glm::mix(cam.r00, cam.r01, pos.y), glm::mix(cam.r10, cam.r11, pos.y), pos.x));
+			ray.junk1 = 0.0f;
+		}
+
+		pushToQueue(queues, WAVEFRONT_RAY_QUEUE, queues.rays, made, count);
+	});
+
+	// extend, a ray that doesn't hit anything leaves its pixel black
+	unsigned int numRays = queues.counts[WAVEFRONT_RAY_QUEUE];
+
+	dispatchGroups(numWavefrontGroups(numRays), numThreads, [&](int group)
+	{
+		WavefrontHit made[WAVEFRONT_GROUP_SIZE];
+		int count = 0;
+
+		unsigned int end = glm::min(numRays, (unsigned int)(group + 1) * WAVEFRONT_GROUP_SIZE);
+
+		for (unsigned int i = group * WAVEFRONT_GROUP_SIZE; i < end; i++)
+		{
+			const WavefrontRay& ray = queues.rays[i];
+
+			HitRecord info;
+
+			if (!intersectTriangles(scene, ray.origin, ray.dir, info))
+				continue;
+
+			WavefrontHit& hit = made[count++];
+			hit.dir = ray.dir;
+			hit.pixel = ray.pixel;
+			hit.point = info.point;
+			hit.dist = info.dist;
+			hit.bary = info.bary;
+			hit.m = info.m;
+			hit.t = info.t;
+		}
+
+		pushToQueue(queues, WAVEFRONT_HIT_QUEUE, queues.hits, made, count);
+	});
+
+	// shade, the same as trace(), but the shadow rays go in the shadow queue
+	unsigned int numHits = queues.counts[WAVEFRONT_HIT_QUEUE];
+
+	dispatchGroups(numWavefrontGroups(numHits), numThreads, [&](int group)
+	{
+		WavefrontShadowRay made[WAVEFRONT_GROUP_SIZE * MAX_LIGHTS];
+		int count = 0;
+
+		unsigned int end = glm::min(numHits, (unsigned int)(group + 1) * WAVEFRONT_GROUP_SIZE);
+
+		for (unsigned int i = group * WAVEFRONT_GROUP_SIZE; i < end; i++)
+		{
+			const WavefrontHit& hit = queues.hits[i];
+
+			HitRecord info;
+			info.point = hit.point;
+			info.dist = hit.dist;
+			info.m = hit.m;
+			info.t = hit.t;
+			info.bary = hit.bary;
+
+			HitTriangle t = getHitTriangle(scene, info);
+
+			glm::vec4 surfaceColor = getSurfaceColor(scene, info, t);
+
+			// which mesh the instance is a copy of
+			int mesh = scene.instances[hit.m].mesh;
+
+			// skybox
+			if (mesh == 1)
+			{
+				addToPixel(queues, hit.pixel, glm::vec3(surfaceColor));
+				continue;
+			}
+
+			// ambient light
+			addToPixel(queues, hit.pixel, glm::vec3(surfaceColor) * 0.1f);
+
+			// one shadow ray for every light
+			for (int l = 0; l < MAX_LIGHTS; l++)
+			{
+				const light& L = scene.lights[l];
+
+				glm::vec3 pointToLight = glm::vec3(L.pos) - hit.point;
+				float dist = glm::length(pointToLight);
+
+				// the light doesn't touch the pixel
+				if (dist > L.radius)
+					continue;
+
+				pointToLight = glm::normalize(pointToLight);
+
+				glm::vec3 color = lightColor(scene, L, pointToLight, dist, info, t);
+
+				// only the plane has shadows on it
+				if (mesh != 0)
+				{
+					addToPixel(queues, hit.pixel, color);
+					continue;
+				}
+
+				WavefrontShadowRay& shadow = made[count++];
+				shadow.origin = glm::vec3(L.pos);
+				shadow.pixel = hit.pixel;
+				shadow.dir = -pointToLight;
+				shadow.dist = dist;
+				shadow.color = color;
+				shadow.light = l;
+			}
+		}
+
+		pushToQueue(queues, WAVEFRONT_SHADOW_QUEUE, queues.shadowRays, made, count);
+	});
+
+	// shadow
+	unsigned int numShadowRays = queues.counts[WAVEFRONT_SHADOW_QUEUE];
+
+	dispatchGroups(numWavefrontGroups(numShadowRays), numThreads, [&](int group)
+	{
+		unsigned int end = glm::min(numShadowRays, (unsigned int)(group + 1) * WAVEFRONT_GROUP_SIZE);
+
+		for (unsigned int i = group * WAVEFRONT_GROUP_SIZE; i < end; i++)
+		{
+			const WavefrontShadowRay& shadow = queues.shadowRays[i];
+
+			// If the light hits another surface before it gets to this point, it is in shadow
+			if (occluded(scene, shadow.light, shadow.origin, shadow.dir, shadow.dist - SHADOW_RAY_BIAS))
+				continue;
+
+			addToPixel(queues, shadow.pixel, shadow.color);
+		}
+	});
+
+	// resolve, and set every pixel back to 0 for the next frame
+	dispatchGroups(numWavefrontGroups(numPixels), numThreads, [&](int group)
+	{
+		int end = glm::min(numPixels, (group + 1) * WAVEFRONT_GROUP_SIZE);
+
+		for (int i = group * WAVEFRONT_GROUP_SIZE; i < end; i++)
+		{
+			unsigned char* p = &rgba[4 * i];
+
+			for (int c = 0; c < 3; c++)
+			{
+				float color = glm::clamp(queues.pixelColors[3 * i + c] / WAVEFRONT_COLOR_SCALE, 0.0f, 1.0f);
+				p[c] = (unsigned char)(color * 255.0f + 0.5f);
+
+				queues.pixelColors[3 * i + c] = 0;
+			}
+
+			p[3] = 255;
+		}
+	});
+
+	return (unsigned long long)numRays + numShadowRays;
+}
@@ -0,0 +1,155 @@
+/*
+Title: Basic Ray Tracer
+File Name: CpuTracer.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This is a CPU version of the ray tracer, for computers that do not have
+a GPU that can run the shaders. Every function in CpuTracer.cpp is a copy
+of the function with the same name in Compute.glsl or FragmentShader.glsl,
+so the picture should be the same as the one the GPU draws.
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "Scene.h"
+#include "BVH.h"
+#include "Wavefront.h"
+
+// How the texels of a CpuTexture are stored
+#define TEXTURE_FORMAT_BGRA8 0 // 4 bytes per texel, the way FreeImage gives them to us
+#define TEXTURE_FORMAT_BC1 1   // 8 bytes per 4x4 block, no alpha (GL_COMPRESSED_RGBA_S3TC_DXT1_EXT)
+#define TEXTURE_FORMAT_BC3 2   // 16 bytes per 4x4 block, with alpha (GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+
+// A 16384 x 16384 texture has 15 mip levels
+#define TEXTURE_MAX_LEVELS 16
+
+// A texture that is kept in system memory, so that the CPU can sample it.
+// It has every mip level, level 0 first, which is what LoadTexture() gives
+// to OpenGL. The rows are in the same order FreeImage gives them to us,
+// with the bottom row of the image first, and in the compressed formats
+// every row of 4x4 blocks starts with the bottom left block.
+struct CpuTexture
+{
+	int width = 0;
+	int height = 0;
+	int format = TEXTURE_FORMAT_BGRA8;
+
+	// Where every mip level starts, counting from texelData(), and how many bytes it is
+	int numLevels = 0;
+	size_t levelOffset[TEXTURE_MAX_LEVELS];
+	size_t levelSize[TEXTURE_MAX_LEVELS];
+
+	// The texels are in "texels" after a texture is baked (see bakeTexture),
+	// or they point into a .3Dtex file, like the vertices of a Mesh point into
+	// a .3Dbin file. "mapping" keeps the file in memory.
+	std::vector<unsigned char> texels;
+	const unsigned char* mappedTexels = nullptr;
+	std::shared_ptr<const void> mapping;
+
+	const unsigned char* texelData() const { return mappedTexels ? mappedTexels : texels.data(); }
+	const unsigned char* levelData(int level) const { return texelData() + levelOffset[level]; }
+	int levelWidth(int level) const { return width >> level > 0 ? width >> level : 1; }
+	int levelHeight(int level) const { return height >> level > 0 ? height >> level : 1; }
+};
+
+// The world space box around a mesh, like meshBoundsMin
+// and meshBoundsMax in FragmentShader.glsl
+struct MeshBounds
+{
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
+// Everything the CPU renderer needs to draw one frame.
+// meshes are in object space, like vertexObjToComp.
+struct CpuScene
+{
+	const Mesh* meshes = nullptr;
+	std::vector<const CpuTexture*> textures;
+
+	// The instance table (see initInstances in main.cpp)
+	const Instance* instances = nullptr;
+	int numInstances = 0;
+
+	// The instances near every light, the only ones its shadow rays
+	// are tested against when transformed isn't null (see calcLightMasks)
+	const ShadowCasters* shadowCasters = nullptr;
+
+	// Every instance's copy of its mesh, in world space (see cpuTransformMeshes),
+	// just like verticesCompToFrag is after the compute shader runs.
+	// If this is null, rays go through the two level BVH instead.
+	const Mesh* transformed = nullptr;
+
+	// The BVH of the transformed instances (see buildSceneBVH), or the
+	// bottom and top level trees if transformed is null (see buildTopLevelBVH).
+	// If this is null, every ray is tested against every triangle.
+	const SceneBVH* bvh = nullptr;
+
+	// The hitbox of every instance (see cpuTransformMeshes)
+	std::vector<MeshBounds> bounds;
+	light lights[MAX_LIGHTS];
+};
+
+// CPU copy of Compute.glsl, multiplies every vertex of the mesh of every
+// instance by the instance's matrix, and writes it to "out", which has one
+// mesh for every instance. The meshes in "out" use the indices of the meshes
+// in "in", so "in" must stay where it is while "out" is used. It also writes the world space box around every
+// instance to "bounds".
+void cpuTransformMeshes(const Mesh* in, const Instance* instances, int numInstances, Mesh* out, const glm::mat4x4* matrices, MeshBounds* bounds);
+
+// Gives back mip level 0 of "tex" as TEXTURE_FORMAT_BGRA8. The GPU reads BC1 and
+// BC3 blocks as they are, but the CPU renderer would have to decode a block for
+// every texel it reads, so it decodes every block once, before it starts.
+CpuTexture cpuDecompressTexture(const CpuTexture& tex);
+
+// Draws one frame into "rgba", which must hold 4 * width * height bytes.
+// The first row in the buffer is the bottom row of the image, the same as glReadPixels.
+// The frame is split into tiles, and the tiles are shared by numThreads threads
+// (0 means one thread per core). Returns the number of rays that were traced,
+// counting the camera rays and the shadow rays.
+unsigned long long cpuRenderFrame(const CpuScene& scene, const CameraRays& cam, int width, int height, unsigned char* rgba, int numThreads);
+
+// The queues of cpuRenderFrameWavefront, the same entries as the
+// queue buffers of WAVEFRONT_TRACE. They are kept from one frame
+// to the next, so that they are only made again when the size changes.
+struct CpuWavefrontQueues
+{
+	std::vector<WavefrontRay> rays;
+	std::vector<WavefrontHit> hits;
+	std::vector<WavefrontShadowRay> shadowRays;
+
+	// How many entries are in each queue, see WAVEFRONT_RAY_QUEUE
+	std::atomic<unsigned int> counts[NUM_WAVEFRONT_QUEUES];
+
+	// 3 fixed point numbers for every pixel, see WAVEFRONT_COLOR_SCALE
+	std::unique_ptr<std::atomic<unsigned int>[]> pixelColors;
+	int numPixels = 0;
+};
+
+// Same picture as cpuRenderFrame, but drawn the way WAVEFRONT_TRACE draws it, one
+// pass at a time (see Wavefront.h). Every pass is shared by numThreads threads,
+// WAVEFRONT_GROUP_SIZE entries at a time, and they add to the next queue the
+// way a group of threads on the GPU does. Returns the number of rays that were traced.
+unsigned long long cpuRenderFrameWavefront(const CpuScene& scene, const CameraRays& cam, int width, int height, unsigned char* rgba, int numThreads, CpuWavefrontQueues& queues);
@@ -0,0 +1,271 @@
+/*
+Title: Basic Ray Tracer
+File Name: FrameTimer.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include "FrameTimer.h"
+
+const char* timedPassNames[NUM_TIMED_PASSES] =
+{
+	"uploads",
+	"transform",
+	"bvh build",
+	"bvh refit",
+	"trace",
+	"render"
+};
+
+static double cpuSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reads the GPU times of one frame into the samples, if the GPU is done
+// with it. If "wait" is true, waits for the GPU to be done with it.
+static void readTimedFrame(FrameTimer& timer, TimedFrame& frame, bool wait)
+{
+	if (!frame.pending)
+		return;
+
+	frame.pending = false;
+
+	// The GPU writes the timestamps in order, so if
+	// the last one is there, every one of them is
+	if (!wait)
+	{
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+
+		if (available == GL_FALSE)
+		{
+			timer.droppedFrames++;
+			return;
+		}
+	}
+
+	for (int pass = 0; pass < NUM_TIMED_PASSES; pass++)
+	{
+		if (frame.numRanges[pass] == 0)
+			continue;
+
+		GLuint64 nanoseconds = 0;
+
+		for (int i = 0; i < frame.numRanges[pass]; i++)
+		{
+			GLuint64 start = 0;
+			GLuint64 end = 0;
+			glGetQueryObjectui64v(frame.queries[pass][i][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(frame.queries[pass][i][1], GL_QUERY_RESULT, &end);
+
+			if (end > start)
+				nanoseconds += end - start;
+		}
+
+		timer.gpuSamples[pass].push_back((float)(nanoseconds / 1.0e6));
+	}
+}
+
+void initFrameTimer(FrameTimer& timer)
+{
+	for (int f = 0; f < FRAME_TIMER_LATENCY; f++)
+	{
+		glGenQueries(NUM_TIMED_PASSES * FRAME_TIMER_MAX_RANGES * 2, &timer.frames[f].queries[0][0][0]);
+
+		for (int pass = 0; pass < NUM_TIMED_PASSES; pass++)
+			timer.frames[f].numRanges[pass] = 0;
+
+		timer.frames[f].lastQuery = 0;
+		timer.frames[f].pending = false;
+	}
+}
+
+void beginTimedFrame(FrameTimer& timer)
+{
+	double now = cpuSeconds();
+
+	if (timer.lastFrameStart >= 0.0)
+		timer.frameSamples.push_back((float)(1000.0 * (now - timer.lastFrameStart)));
+
+	timer.lastFrameStart = now;
+
+	// This frame uses the queries of the frame FRAME_TIMER_LATENCY frames ago
+	TimedFrame& frame = timer.frames[timer.current];
+	readTimedFrame(timer, frame, false);
+
+	for (int pass = 0; pass < NUM_TIMED_PASSES; pass++)
+	{
+		frame.numRanges[pass] = 0;
+		timer.passTime[pass] = -1.0;
+	}
+}
+
+void endTimedFrame(FrameTimer& timer)
+{
+	TimedFrame& frame = timer.frames[timer.current];
+
+	// A pass that was never started this frame has no sample,
+	// so that it doesn't pull the average down
+	for (int pass = 0; pass < NUM_TIMED_PASSES; pass++)
+	{
+		if (timer.passTime[pass] >= 0.0)
+		{
+			timer.cpuSamples[pass].push_back((float)(1000.0 * timer.passTime[pass]));
+			frame.pending = true;
+		}
+	}
+
+	timer.current = (timer.current + 1) % FRAME_TIMER_LATENCY;
+}
+
+void beginPass(FrameTimer& timer, int pass)
+{
+	TimedFrame& frame = timer.frames[timer.current];
+
+	if (frame.numRanges[pass] < FRAME_TIMER_MAX_RANGES)
+		glQueryCounter(frame.queries[pass][frame.numRanges[pass]][0], GL_TIMESTAMP);
+
+	if (timer.passTime[pass] < 0.0)
+		timer.passTime[pass] = 0.0;
+
+	timer.passStart[pass] = cpuSeconds();
+}
+
+void endPass(FrameTimer& timer, int pass)
+{
+	TimedFrame& frame = timer.frames[timer.current];
+
+	timer.passTime[pass] += cpuSeconds() - timer.passStart[pass];
+
+	if (frame.numRanges[pass] < FRAME_TIMER_MAX_RANGES)
+	{
+		frame.lastQuery = frame.queries[pass][frame.numRanges[pass]][1];
+		glQueryCounter(frame.lastQuery, GL_TIMESTAMP);
+		frame.numRanges[pass]++;
+	}
+}
+
+void freeFrameTimer(FrameTimer& timer)
+{
+	// Oldest first, so the samples stay in order
+	for (int f = 0; f < FRAME_TIMER_LATENCY; f++)
+	{
+		TimedFrame& frame = timer.frames[(timer.current + f) % FRAME_TIMER_LATENCY];
+		readTimedFrame(timer, frame, true);
+		glDeleteQueries(NUM_TIMED_PASSES * FRAME_TIMER_MAX_RANGES * 2, &frame.queries[0][0][0]);
+	}
+}
+
+FrameTimeStats calcFrameTimeStats(const std::vector<float>& samples, int first)
+{
+	FrameTimeStats stats = {};
+
+	if (first >= (int)samples.size())
+		return stats;
+
+	std::vector<float> sorted(samples.begin() + first, samples.end());
+	std::sort(sorted.begin(), sorted.end());
+
+	double sum = 0.0;
+	for (float s : sorted)
+		sum += s;
+
+	int n = (int)sorted.size();
+
+	// The smallest sample that "percent" percent of the samples are
+	// smaller than or the same as (the "nearest rank" percentile)
+	auto percentile = [&](float percent)
+	{
+		int rank = (int)ceil(percent / 100.0f * n);
+		return sorted[std::min(std::max(rank, 1), n) - 1];
+	};
+
+	stats.count = n;
+	stats.average = (float)(sum / n);
+	stats.p50 = percentile(50.0f);
+	stats.p95 = percentile(95.0f);
+	stats.p99 = percentile(99.0f);
+
+	return stats;
+}
+
+void printFrameTimes(const FrameTimer& timer)
+{
+	printf("%-10s %8s | %8s %8s %8s %8s | %8s %8s %8s %8s\n", "ms", "frames",
+		"CPU avg", "p50", "p95", "p99", "GPU avg", "p50", "p95", "p99");
+
+	FrameTimeStats frame = calcFrameTimeStats(timer.frameSamples);
+
+	if (frame.count > 0)
+		printf("%-10s %8d | %8.3f %8.3f %8.3f %8.3f |\n", "frame", frame.count,
+			frame.average, frame.p50, frame.p95, frame.p99);
+
+	for (int pass = 0; pass < NUM_TIMED_PASSES; pass++)
+	{
+		FrameTimeStats cpu = calcFrameTimeStats(timer.cpuSamples[pass]);
+		FrameTimeStats gpu = calcFrameTimeStats(timer.gpuSamples[pass]);
+
+		if (cpu.count == 0)
+			continue;
+
+		printf("%-10s %8d | %8.3f %8.3f %8.3f %8.3f | %8.3f %8.3f %8.3f %8.3f\n", timedPassNames[pass], cpu.count,
+			cpu.average, cpu.p50, cpu.p95, cpu.p99, gpu.average, gpu.p50, gpu.p95, gpu.p99);
+	}
+
+	if (timer.droppedFrames > 0)
+		printf("The GPU times of %d frames were not ready in time\n", timer.droppedFrames);
+}
+
+bool writeFrameTimesCsv(const FrameTimer& timer, const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "pass,cpu_samples,cpu_avg_ms,cpu_p50_ms,cpu_p95_ms,cpu_p99_ms,"
+		"gpu_samples,gpu_avg_ms,gpu_p50_ms,gpu_p95_ms,gpu_p99_ms\n");
+
+	// The time from one frame to the next only has a CPU time
+	FrameTimeStats frame = calcFrameTimeStats(timer.frameSamples);
+
+	if (frame.count > 0)
+		fprintf(f, "frame,%d,%.4f,%.4f,%.4f,%.4f,0,,,,\n",
+			frame.count, frame.average, frame.p50, frame.p95, frame.p99);
+
+	for (int pass = 0; pass < NUM_TIMED_PASSES; pass++)
+	{
+		FrameTimeStats cpu = calcFrameTimeStats(timer.cpuSamples[pass]);
+		FrameTimeStats gpu = calcFrameTimeStats(timer.gpuSamples[pass]);
+
+		if (cpu.count == 0)
+			continue;
+
+		fprintf(f, "%s,%d,%.4f,%.4f,%.4f,%.4f,%d,%.4f,%.4f,%.4f,%.4f\n", timedPassNames[pass],
+			cpu.count, cpu.average, cpu.p50, cpu.p95, cpu.p99,
+			gpu.count, gpu.average, gpu.p50, gpu.p95, gpu.p99);
+	}
+
+	return fclose(f) == 0;
+}
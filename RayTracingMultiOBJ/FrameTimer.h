@@ -0,0 +1,153 @@
+/*
+Title: Basic Ray Tracer
+File Name: FrameTimer.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+The FPS in the window title only says how many frames were drawn in the
+last second. It can't say which part of the frame got slower, and one
+slow frame in sixty barely moves it.
+
+A FrameTimer times every part of a frame (a "pass") two ways. On the CPU,
+a clock is read when the pass starts and when it ends. That is how long
+the CPU was busy with it, which for glDispatchCompute and glDrawArrays is
+only how long it took to hand the work to the driver.
+
+On the GPU, glQueryCounter asks the GPU to write down the time when it
+gets to that point in the commands. The difference is how long the GPU
+took to run the pass. Those times are not ready until the GPU is done
+with the frame, so every frame has its own set of queries, and the times
+of a frame are only read FRAME_TIMER_LATENCY frames later, when the GPU
+is long done with it, so reading them never waits for the GPU.
+
+Every time of every frame is kept, so that at the end the average and the
+50th, 95th, and 99th percentile of every pass can be worked out. The 99th
+percentile is the frame time that only 1 frame in 100 was slower than,
+which is what the hitches look like. writeFrameTimesCsv saves them all
+into a .csv file, so runs before and after a change can be compared.
+*/
+
+#pragma once
+
+#include <vector>
+#include "GL/glew.h"
+
+// How many frames old the GPU times are when they are read
+#define FRAME_TIMER_LATENCY 4
+
+// How many times one pass can be started in one frame. The uploads
+// happen in a few places, and each place is its own start and end.
+// If a pass is started more times than this, only the CPU times it.
+#define FRAME_TIMER_MAX_RANGES 8
+
+enum TimedPass
+{
+	PASS_UPLOAD,	// glBufferSubData / glBufferData, and the car uploads
+	PASS_TRANSFORM,	// the compute shader that moves the triangles
+	PASS_BVH,		// building the BVH on the CPU
+	PASS_REFIT,		// refitting the BVH on the GPU
+	PASS_TRACE,		// the full screen draw that traces the rays
+	PASS_RENDER,	// all of renderScene, everything above and the rest
+	NUM_TIMED_PASSES
+};
+
+// The names of the passes, for printing and for the .csv file
+extern const char* timedPassNames[NUM_TIMED_PASSES];
+
+// The queries of one frame
+struct TimedFrame
+{
+	// One start and one end timestamp for every time a pass was started
+	GLuint queries[NUM_TIMED_PASSES][FRAME_TIMER_MAX_RANGES][2];
+	int numRanges[NUM_TIMED_PASSES];
+
+	// The end timestamp that was asked for last
+	GLuint lastQuery;
+
+	// false until the frame has queries that were not read yet
+	bool pending;
+};
+
+struct FrameTimer
+{
+	TimedFrame frames[FRAME_TIMER_LATENCY];
+
+	// Which one of "frames" is being recorded
+	int current = 0;
+
+	// When every pass was started on the CPU, and how long it
+	// took so far in this frame, in seconds
+	double passStart[NUM_TIMED_PASSES] = {};
+	double passTime[NUM_TIMED_PASSES] = {};
+
+	// When the last frame started, -1 before the first frame
+	double lastFrameStart = -1.0;
+
+	// Every time of every frame, in milliseconds
+	std::vector<float> cpuSamples[NUM_TIMED_PASSES];
+	std::vector<float> gpuSamples[NUM_TIMED_PASSES];
+
+	// From the start of one frame to the start of the next, which is
+	// the real frame time, with glfwSwapBuffers and everything else
+	std::vector<float> frameSamples;
+
+	// Frames that the GPU still wasn't done with after FRAME_TIMER_LATENCY
+	// frames, their GPU times are thrown away
+	int droppedFrames = 0;
+};
+
+struct FrameTimeStats
+{
+	int count;
+	float average;
+	float p50;
+	float p95;
+	float p99;
+};
+
+// Makes the queries, needs an OpenGL context
+void initFrameTimer(FrameTimer& timer);
+
+// Call at the start of every frame. Reads the GPU times of the
+// frame that was recorded FRAME_TIMER_LATENCY frames ago.
+void beginTimedFrame(FrameTimer& timer);
+
+// Call at the end of every frame
+void endTimedFrame(FrameTimer& timer);
+
+// Call around every part of a frame that belongs to "pass".
+// Passes can be inside each other, but the same pass can't.
+void beginPass(FrameTimer& timer, int pass);
+void endPass(FrameTimer& timer, int pass);
+
+// Waits for the GPU to finish, reads the frames that were not read
+// yet, and deletes the queries. Every sample stays in "timer".
+void freeFrameTimer(FrameTimer& timer);
+
+// The average and the percentiles of samples[first] to the last sample
+FrameTimeStats calcFrameTimeStats(const std::vector<float>& samples, int first = 0);
+
+// Prints a table of every pass that has samples
+void printFrameTimes(const FrameTimer& timer);
+
+// Saves the same table into a .csv file, one line for every pass.
+// Returns false if the file could not be written.
+bool writeFrameTimesCsv(const FrameTimer& timer, const char* path);
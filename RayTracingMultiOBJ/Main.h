@@ -0,0 +1,160 @@
+/*
+Title: Basic Ray Tracer
+File Name: Main.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+The parts of main.cpp that the benchmarks (see Benchmarks.h) use: how the
+meshes of the scene are laid out, and the scene, the buffers, and the
+functions that load it, animate it, and make its shaders. They all live
+in main.cpp, and are described there, this only lets other files see them.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+#include "Scene.h"
+#include "BVH.h"
+#include "CpuTracer.h"
+#include "Simplify.h"
+
+// Every mesh that can be in the scene: the floor, the skybox, the wheel,
+// and the car slots. Only the car that is shown, and the car that comes
+// after it, are in memory (and on the GPU), in the two car slots. The
+// other cars are loaded from the disk while the program runs, by a
+// CarStreamer, so the catalog of cars can be as big as it wants.
+#define FLOOR_MESH 0
+#define SKYBOX_MESH 1
+#define WHEEL_MESH 2
+#define FIRST_CAR_MESH 3 // the car slots are meshes[3] and meshes[4]
+
+// The car that is shown is in one slot, and the next car is copied into
+// the other slot while it is shown, then they swap. Every slot has room
+// on the GPU for the biggest car of the catalog (see sizeCarSlots).
+#define NUM_CAR_SLOTS 2
+
+// The wheel and the car slots have NUM_LODS - 1 more meshes each, after
+// the car slots, with fewer triangles (see meshLod and Simplify.h). The
+// floor and the skybox are never simplified, they are too simple already.
+#define FIRST_LOD_MESH (FIRST_CAR_MESH + NUM_CAR_SLOTS)
+#define NUM_MESHES (FIRST_LOD_MESH + (FIRST_LOD_MESH - WHEEL_MESH) * (NUM_LODS - 1))
+
+// How far the camera sees, from the top of the screen to the bottom, in degrees
+#define CAMERA_FOV 45.0f
+
+// An instance gets the most detailed LOD that has no more than one
+// triangle for every this many pixels that it covers on the screen
+#define LOD_PIXELS_PER_TRIANGLE 8.0f
+
+// How many LODs less detail shadow rays see than camera rays
+#define LOD_SHADOW_BIAS 1
+
+// How selectLods picks the LODs, the LOD benchmark changes these
+struct LodSettings
+{
+	float pixelsPerTriangle = LOD_PIXELS_PER_TRIANGLE;
+
+	// Only the two level BVH has a tree for the shadow LOD. The flat
+	// BVH has one world space copy of every instance, and shadow rays
+	// see the same LOD as camera rays there.
+	int shadowBias = LOD_SHADOW_BIAS;
+
+	// -1 to pick LODs from the size on the screen,
+	// or the LOD that every instance gets
+	int force = -1;
+};
+
+// calcMatrices makes one matrix for the floor, the skybox,
+// the car, and each of the 4 wheels
+#define NUM_MATRICES 7
+
+// How many threads are in one group of Compute.glsl. The threads of a group
+// run side by side, so one thread per group leaves most of the GPU idle.
+#define TRANSFORM_GROUP_SIZE 64
+
+// Everything about an instance that changes where its world space copy
+// goes, or what is in it, the last time Compute.glsl moved it. If none of
+// it changed, the copy that is already in the buffers is still right.
+// The floor never moves, so it is only moved once, and the triangles
+// the compute shader has to move don't grow with the size of the floor.
+struct MovedInstance
+{
+	glm::mat4x4 objectToWorld;
+	int mesh;
+	MeshRange range;
+	int firstVertex;
+	int firstTriangle;
+};
+
+// The file of every texture, textureTest[i] in the shader is textureFileNames[i]
+#define NUM_TEXTURES 3
+
+// The scene
+extern std::vector<Mesh> meshes;
+extern std::vector<Instance> instances;
+extern std::vector<MeshRange> meshRanges;
+extern SceneBVH sceneBVH;
+extern ShadowCasters shadowCasters;
+extern LodSettings lodSettings;
+extern int numCars;
+
+// The textures, and the files they come from
+extern const char* textureFileNames[NUM_TEXTURES];
+extern std::vector<CpuTexture> textureImages;
+
+// The camera, and the window
+extern glm::vec3 cameraPos;
+extern int width;
+extern int height;
+extern int videoFPS;
+
+// The buffers that Compute.glsl reads
+extern GLuint vertexObjToComp;
+extern GLuint indexToFrag;
+extern GLuint meshRangeBuffer;
+extern GLuint matrixBuffer;
+extern int matrixBufferSize;
+
+// Loading the scene
+std::string carFileName(int car);
+std::string meshFileName(int mesh);
+bool decodeTexture(const char* file, CpuTexture* tex);
+double loadAssets(bool withTextures);
+void buildBottomLevelBVH();
+
+// Animating the scene, the same way on the GPU and on the CPU
+CameraRays getCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, float ratio);
+void calcMatrices(float time, glm::vec3 cameraPos, glm::mat4x4* test);
+void calcLights(light* lights);
+void selectLods(const glm::mat4x4* matrices, glm::vec3 eye, float fov, int screenHeight, std::vector<Instance>& instances);
+void calcInstances(const glm::mat4x4* matrices, std::vector<Instance>& instances);
+void calcLightMasks(const light* lights, int numLights, std::vector<Instance>& instances, ShadowCasters& casters);
+int calcTransformJobs(const std::vector<MeshRange>& ranges, const std::vector<Instance>& instances,
+	std::vector<MovedInstance>& moved, std::vector<TransformJob>& jobs, int* numTriangles);
+
+// Making the shaders
+std::string readShader(std::string fileName);
+std::string shaderDefines();
+std::string transformDefines(int groupSize, bool linearSearch);
+GLuint createShader(std::string sourceCode, GLenum shaderType, const std::string& defines);
@@ -0,0 +1,275 @@
+/*
+Title: Basic Ray Tracer
+File Name: MeshCache.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <memory>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "MeshCache.h"
+
+// A whole file, mapped into memory. It is unmapped when the last
+// Mesh (or CpuTexture) that points into it is destroyed (see Mesh::mapping).
+struct MappedFile
+{
+	void* base = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+
+	~MappedFile()
+	{
+		if (base)
+			UnmapViewOfFile(base);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+#else
+	~MappedFile()
+	{
+		if (base)
+			munmap(base, size);
+	}
+#endif
+};
+
+bool getFileInfo(const char* path, long long* size, long long* time)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path, &info) != 0)
+		return false;
+#else
+	struct stat info;
+	if (stat(path, &info) != 0)
+		return false;
+#endif
+
+	*size = (long long)info.st_size;
+	*time = (long long)info.st_mtime;
+	return true;
+}
+
+// Maps a whole file into memory, read only. Returns null if it can't.
+static std::shared_ptr<MappedFile> mapWholeFile(const char* path)
+{
+	std::shared_ptr<MappedFile> map = std::make_shared<MappedFile>();
+
+#ifdef _WIN32
+	map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (map->file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(map->file, &size) || size.QuadPart == 0)
+		return nullptr;
+
+	map->size = (size_t)size.QuadPart;
+
+	map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!map->mapping)
+		return nullptr;
+
+	map->base = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!map->base)
+		return nullptr;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	map->size = (size_t)info.st_size;
+
+	// The mapping stays valid after the file is closed
+	void* base = mmap(nullptr, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return nullptr;
+
+	map->base = base;
+#endif
+
+	return map;
+}
+
+std::shared_ptr<const void> mapFile(const char* path, const unsigned char** data, size_t* size)
+{
+	std::shared_ptr<MappedFile> map = mapWholeFile(path);
+	if (!map)
+		return nullptr;
+
+	*data = (const unsigned char*)map->base;
+	*size = map->size;
+	return map;
+}
+
+std::string meshCachePath(const char* sourcePath)
+{
+	std::string path = sourcePath;
+
+	// only look for the dot after the last slash, because
+	// the paths start with "../", which has dots in it
+	size_t slash = path.find_last_of("/\\");
+	size_t dot = path.find_last_of('.');
+
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		path.erase(dot);
+
+	return path + ".3Dbin";
+}
+
+bool loadMeshCache(const char* sourcePath, Mesh* m)
+{
+	long long sourceSize, sourceTime;
+	if (!getFileInfo(sourcePath, &sourceSize, &sourceTime))
+		return false;
+
+	const unsigned char* data;
+	size_t size;
+
+	std::shared_ptr<const void> map = mapFile(meshCachePath(sourcePath).c_str(), &data, &size);
+	if (!map || size < sizeof(MeshCacheHeader))
+		return false;
+
+	const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+
+	// Made by a different version of this program, or from
+	// a different version of the .3Dobj file, so make it again
+	if (header->magic != MESH_CACHE_MAGIC ||
+		header->version != MESH_CACHE_VERSION ||
+		header->vertexSize != (int)sizeof(Vertex) ||
+		header->sourceSize != sourceSize ||
+		header->sourceTime != sourceTime)
+		return false;
+
+	// The file was cut short, maybe the program
+	// was closed while it was being written
+	size_t vertexBytes = sizeof(Vertex) * (size_t)header->numVertices;
+	size_t indexBytes = 3 * sizeof(unsigned int) * (size_t)header->numTriangles;
+
+	if (header->numTriangles < 0 || header->numVertices < 0 || size != sizeof(MeshCacheHeader) + vertexBytes + indexBytes)
+		return false;
+
+	*m = Mesh();
+	m->numTriangles = header->numTriangles;
+	m->numVertices = header->numVertices;
+	m->mappedVertices = (const Vertex*)(header + 1);
+	m->mappedIndices = (const unsigned int*)((const char*)m->mappedVertices + vertexBytes);
+	m->mapping = map;
+
+	return true;
+}
+
+bool writeMeshCache(const char* sourcePath, const Mesh& m)
+{
+	MeshCacheHeader header;
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.numTriangles = m.numTriangles;
+	header.numVertices = m.numVertices;
+	header.vertexSize = (int)sizeof(Vertex);
+	header.junk1 = 0;
+	header.junk2 = 0;
+	header.junk3 = 0;
+
+	if (!getFileInfo(sourcePath, &header.sourceSize, &header.sourceTime))
+		return false;
+
+	FILE* f = fopen(meshCachePath(sourcePath).c_str(), "wb");
+	if (!f)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	if (ok && m.numVertices > 0)
+		ok = fwrite(m.vertexData(), sizeof(Vertex), m.numVertices, f) == (size_t)m.numVertices;
+
+	if (ok && m.numTriangles > 0)
+		ok = fwrite(m.indexData(), 3 * sizeof(unsigned int), m.numTriangles, f) == (size_t)m.numTriangles;
+
+	// If anything failed, throw away the half written file
+	// (loadMeshCache would also see that it is too short)
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (!ok)
+		remove(meshCachePath(sourcePath).c_str());
+
+	return ok;
+}
+
+bool loadMeshCatalogInfo(const char* path, MeshCatalogInfo* info)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	MeshCatalogInfo read;
+	bool ok = fread(&read, sizeof(read), 1, f) == 1;
+	fclose(f);
+
+	if (!ok || read.magic != MESH_CATALOG_MAGIC || read.version != MESH_CATALOG_VERSION)
+		return false;
+
+	*info = read;
+	return true;
+}
+
+bool writeMeshCatalogInfo(const char* path, const MeshCatalogInfo& info)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+
+	bool ok = fwrite(&info, sizeof(info), 1, f) == 1;
+
+	if (fclose(f) != 0)
+		ok = false;
+
+	// A half written file is too short, and is never read
+	if (!ok)
+		remove(path);
+
+	return ok;
+}
@@ -0,0 +1,134 @@
+/*
+Title: Basic Ray Tracer
+File Name: MeshCache.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Reading a .3Dobj file means reading every line of text, and turning the
+numbers in it back into floats, which is slow. The first time a .3Dobj
+file is loaded, its vertices and indices are saved into a .3Dbin file next
+to it, exactly the way they are stored in memory (struct Mesh in Scene.h).
+
+The next time, the .3Dbin file is mapped into memory instead of read,
+so nothing is parsed or copied. The mesh points straight into the file,
+and the operating system only loads the parts of the file that are used.
+The pointer can be given right to glBufferSubData.
+
+The .3Dbin file remembers the size and the time of the .3Dobj file it was
+made from. If the .3Dobj file changes, the .3Dbin file is made again.
+
+A .3Dbin file is a MeshCacheHeader, followed by numVertices vertices,
+followed by 3 * numTriangles indices.
+
+A folder of meshes that are numbered from 1 (the car catalog) also gets a
+.3Dcat file, a MeshCatalogInfo, which remembers how many triangles and
+vertices the biggest mesh in the folder has. Then the program does not
+need to load every mesh in the folder to find out.
+*/
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include "Scene.h"
+
+// "3DBN", so that a file that is not a .3Dbin file is never read as one
+#define MESH_CACHE_MAGIC 0x4E424433
+
+// Change this when struct Vertex or MeshCacheHeader change,
+// so that old .3Dbin files are made again instead of being read
+#define MESH_CACHE_VERSION 3
+
+// 48 bytes, so the vertices after it start 16 byte aligned, like a vec4
+struct MeshCacheHeader
+{
+	int magic;
+	int version;
+	int numTriangles;
+	int numVertices;
+
+	// sizeof(Vertex) when the file was made
+	int vertexSize;
+
+	int junk1;
+	int junk2;
+	int junk3;
+
+	// Size and last write time of the .3Dobj file
+	long long sourceSize;
+	long long sourceTime;
+};
+
+// The name of the .3Dbin file for a .3Dobj file, the
+// same name and folder, with a different extension
+std::string meshCachePath(const char* sourcePath);
+
+// Maps the .3Dbin file of "sourcePath" into memory, and points "m" at
+// the vertices and indices in it. Returns false, and leaves "m" alone, if there is no
+// .3Dbin file, or if it was made from a different version of the .3Dobj file.
+bool loadMeshCache(const char* sourcePath, Mesh* m);
+
+// Saves the vertices and indices of "m" into the .3Dbin file of "sourcePath".
+// Returns false if the file could not be written.
+bool writeMeshCache(const char* sourcePath, const Mesh& m);
+
+// "3DCT", so that a file that is not a .3Dcat file is never read as one
+#define MESH_CATALOG_MAGIC 0x54434433
+
+// Change this when MeshCatalogInfo changes
+#define MESH_CATALOG_VERSION 1
+
+// 32 bytes, everything in a .3Dcat file
+struct MeshCatalogInfo
+{
+	int magic;
+	int version;
+
+	// Meshes 1 to numMeshes of the folder were looked at,
+	// and the biggest one had this many triangles and vertices
+	int numMeshes;
+	int maxTriangles;
+	int maxVertices;
+
+	int junk1;
+
+	// The newest last write time of their .3Dobj files. A mesh
+	// with a newer one changed after the file was written.
+	long long newestSourceTime;
+};
+
+// Reads the .3Dcat file at "path" into "info". Returns false, and leaves
+// "info" alone, if there is no file, or it was made by a different version.
+bool loadMeshCatalogInfo(const char* path, MeshCatalogInfo* info);
+
+// Saves "info" into the .3Dcat file at "path".
+// Returns false if the file could not be written.
+bool writeMeshCatalogInfo(const char* path, const MeshCatalogInfo& info);
+
+// These two are also used for the .3Dtex files of TextureCache.cpp
+
+// Gets the size and last write time of a file, returns false if it does not exist
+bool getFileInfo(const char* path, long long* size, long long* time);
+
+// Maps a whole file into memory, read only, and sets "data" and "size" to
+// where it is. The file stays mapped until the last copy of the pointer that
+// is returned is destroyed. Returns null if the file can't be mapped.
+std::shared_ptr<const void> mapFile(const char* path, const unsigned char** data, size_t* size);
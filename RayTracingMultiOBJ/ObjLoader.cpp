@@ -0,0 +1,325 @@
+/*
+Title: Basic Ray Tracer
+File Name: ObjLoader.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <charconv>
+#include <vector>
+#include <unordered_map>
+
+#include "glm/gtx/hash.hpp"
+
+#include "ObjLoader.h"
+
+// One corner of a face, after the indices are turned into
+// indices that start at 0. -1 means the corner didn't have one.
+struct ObjCorner
+{
+	int pos;
+	int uv;
+	int normal;
+};
+
+// Lets a Vertex be the key of an unordered_map, so that two
+// corners that are the same in every way become one vertex
+struct VertexHash
+{
+	size_t operator()(const Vertex& v) const
+	{
+		size_t h = std::hash<glm::vec3>()(v.pos);
+		hashCombine(h, std::hash<glm::vec3>()(v.normal));
+		hashCombine(h, std::hash<glm::vec2>()(glm::vec2(v.u, v.v)));
+		return h;
+	}
+
+	static void hashCombine(size_t& seed, size_t hash)
+	{
+		seed ^= hash + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	}
+};
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skipSpaces(const char* p, const char* end)
+{
+	while (p < end && isSpace(*p))
+		p++;
+
+	return p;
+}
+
+static inline const char* skipLine(const char* p, const char* end)
+{
+	while (p < end && *p != '\n')
+		p++;
+
+	return p < end ? p + 1 : p;
+}
+
+// Reads one float, and moves "p" past it
+static inline bool readFloat(const char*& p, const char* end, float& f)
+{
+	p = skipSpaces(p, end);
+
+	// from_chars doesn't accept a + in front of a number
+	if (p < end && *p == '+')
+		p++;
+
+	std::from_chars_result r = std::from_chars(p, end, f);
+
+	if (r.ec != std::errc())
+		return false;
+
+	p = r.ptr;
+	return true;
+}
+
+// Reads one index of a face corner, and turns it into an index that starts
+// at 0. "count" is how many positions (or uvs, or normals) there are so far,
+// for negative indices. Returns false if there is no number here.
+static inline bool readIndex(const char*& p, const char* end, int count, int& index)
+{
+	std::from_chars_result r = std::from_chars(p, end, index);
+
+	if (r.ec != std::errc())
+		return false;
+
+	p = r.ptr;
+
+	// 0 is not a real index, and a negative index can count back
+	// past the first one. -2 makes sure the face is skipped later,
+	// because -1 already means that the corner doesn't have one.
+	if (index > 0)
+		index = index - 1;
+	else if (index < 0 && count + index >= 0)
+		index = count + index;
+	else
+		index = -2;
+
+	return true;
+}
+
+// Reads the corners of a face, until the end of the line
+static bool readFace(const char*& p, const char* end, int numPos, int numUV, int numNormal, std::vector<ObjCorner>& corners)
+{
+	corners.clear();
+
+	while (true)
+	{
+		p = skipSpaces(p, end);
+
+		if (p >= end || *p == '\n' || *p == '#')
+			break;
+
+		ObjCorner c = { -1, -1, -1 };
+
+		if (!readIndex(p, end, numPos, c.pos))
+			return false;
+
+		if (p < end && *p == '/')
+		{
+			p++;
+
+			// "v//vn" has no uv
+			if (p < end && *p != '/')
+				if (!readIndex(p, end, numUV, c.uv))
+					return false;
+
+			if (p < end && *p == '/')
+			{
+				p++;
+
+				if (!readIndex(p, end, numNormal, c.normal))
+					return false;
+			}
+		}
+
+		corners.push_back(c);
+	}
+
+	return corners.size() >= 3;
+}
+
+bool parseOBJ(const char* text, size_t size, Mesh* m)
+{
+	const char* p = text;
+	const char* end = text + size;
+
+	std::vector<glm::vec3> pos;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> norms;
+
+	// Three corners for every triangle, after the faces are cut into triangles
+	std::vector<ObjCorner> faces;
+	std::vector<ObjCorner> corners;
+
+	// A car is about 100 bytes of text per triangle
+	faces.reserve(size / 32);
+
+	int badFaces = 0;
+
+	while (p < end)
+	{
+		p = skipSpaces(p, end);
+
+		if (p >= end)
+			break;
+
+		char c0 = *p;
+		char c1 = p + 1 < end ? p[1] : '\n';
+
+		if (c0 == 'v' && isSpace(c1))
+		{
+			p++;
+			glm::vec3 v;
+
+			if (readFloat(p, end, v.x) && readFloat(p, end, v.y) && readFloat(p, end, v.z))
+				pos.push_back(v);
+		}
+		else if (c0 == 'v' && c1 == 't')
+		{
+			p += 2;
+			glm::vec2 v;
+
+			if (readFloat(p, end, v.x) && readFloat(p, end, v.y))
+				uvs.push_back(v);
+		}
+		else if (c0 == 'v' && c1 == 'n')
+		{
+			p += 2;
+			glm::vec3 v;
+
+			if (readFloat(p, end, v.x) && readFloat(p, end, v.y) && readFloat(p, end, v.z))
+				norms.push_back(v);
+		}
+		else if (c0 == 'f' && isSpace(c1))
+		{
+			p++;
+
+			if (readFace(p, end, (int)pos.size(), (int)uvs.size(), (int)norms.size(), corners))
+			{
+				// cut the face into triangles like a fan
+				for (int i = 1; i + 1 < (int)corners.size(); i++)
+				{
+					faces.push_back(corners[0]);
+					faces.push_back(corners[i]);
+					faces.push_back(corners[i + 1]);
+				}
+			}
+			else
+			{
+				badFaces++;
+			}
+		}
+
+		// Anything else (comments, "o", "s", "usemtl", ...) is
+		// skipped, and so is anything left at the end of this line
+		p = skipLine(p, end);
+	}
+
+	// Every index was made relative to the start when it was read, so now
+	// the indices can be checked against how many of each there are in total
+	*m = Mesh();
+	m->indices.reserve(faces.size());
+
+	// The vertex that every different corner became. A corner is usually
+	// shared by about six triangles, so most corners are found in here.
+	// The same position with a different normal or uv (at a hard edge, or
+	// at a seam in the texture) is a different vertex.
+	std::unordered_map<Vertex, unsigned int, VertexHash> vertexIndex;
+	vertexIndex.reserve(faces.size() / 2);
+
+	for (size_t i = 0; i + 2 < faces.size(); i += 3)
+	{
+		const ObjCorner* c = &faces[i];
+		bool ok = true;
+
+		for (int j = 0; j < 3; j++)
+		{
+			ok = ok && c[j].pos >= 0 && c[j].pos < (int)pos.size();
+			ok = ok && c[j].uv >= -1 && c[j].uv < (int)uvs.size();
+			ok = ok && c[j].normal >= -1 && c[j].normal < (int)norms.size();
+		}
+
+		if (!ok)
+		{
+			badFaces++;
+			continue;
+		}
+
+		m->numTriangles++;
+
+		// The normal of the triangle, for corners that don't have one
+		glm::vec3 flat = glm::cross(pos[c[1].pos] - pos[c[0].pos], pos[c[2].pos] - pos[c[0].pos]);
+		float length = glm::length(flat);
+		flat = length > 0.0f ? flat / length : glm::vec3(0, 1, 0);
+
+		for (int j = 0; j < 3; j++)
+		{
+			glm::vec2 uv = c[j].uv >= 0 ? uvs[c[j].uv] : glm::vec2(0.0f);
+			glm::vec3 n = c[j].normal >= 0 ? norms[c[j].normal] : flat;
+
+			Vertex v = { pos[c[j].pos], uv.x, n, uv.y };
+
+			// use the vertex that is already there, or add a new one
+			auto found = vertexIndex.emplace(v, (unsigned int)m->vertices.size());
+
+			if (found.second)
+				m->vertices.push_back(v);
+
+			m->indices.push_back(found.first->second);
+		}
+	}
+
+	m->numVertices = (int)m->vertices.size();
+
+	if (badFaces > 0)
+		printf("OBJ: skipped %d faces with missing or wrong indices\n", badFaces);
+
+	return m->numTriangles > 0;
+}
+
+bool loadOBJ(const char* path, Mesh* m)
+{
+	FILE* f = fopen(path, "rb");
+
+	if (!f)
+	{
+		printf("Could not open %s\n", path);
+		return false;
+	}
+
+	// Read the whole file at once
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	std::vector<char> text(size > 0 ? size : 0);
+	size_t read = size > 0 ? fread(text.data(), 1, size, f) : 0;
+	fclose(f);
+
+	return parseOBJ(text.data(), read, m);
+}
@@ -0,0 +1,66 @@
+/*
+Title: Basic Ray Tracer
+File Name: ObjLoader.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This reads Wavefront OBJ files (the .3Dobj files are OBJ files).
+The whole file is read into memory, and then read once from start to end,
+without splitting it into lines first, so a line can be as long as it wants.
+The numbers are read with std::from_chars, which is much faster than sscanf,
+because it doesn't need to figure out a format string for every number.
+from_chars for floats needs C++17 and Visual Studio 2019 16.4 or newer,
+which is why the project builds with the v142 toolset and /std:c++17.
+
+These lines are understood, everything else is skipped:
+	v x y z          position
+	vt u v           texture coordinate
+	vn x y z         normal
+	f a b c ...      face, with 3 or more corners
+
+Each corner of a face can be "v", "v/vt", "v//vn", or "v/vt/vn".
+Indices start at 1, and a negative index counts back from the last
+one so far (-1 is the last position, normal, or uv that was read).
+A face with more than 3 corners is cut into triangles like a fan,
+(0, 1, 2), (0, 2, 3), (0, 3, 4), and so on, which works for any
+face that is convex, like the quads that most programs export.
+
+If a corner has no uv, it gets (0, 0), and if it has no normal,
+it gets the normal of its triangle (the mesh looks flat there).
+
+Corners that have the same position, uv, and normal are shared by all
+of the triangles that use them, so every different corner is stored
+once, as a Vertex, and every triangle is 3 indices of its vertices.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include "Scene.h"
+
+// Reads the OBJ text from "text" (which does not need to end with a 0),
+// and turns it into vertices and triangles in "m". Returns false if nothing could be
+// read. Faces that use an index that does not exist are skipped.
+bool parseOBJ(const char* text, size_t size, Mesh* m);
+
+// Reads a whole OBJ file and parses it with parseOBJ.
+// Returns false if the file can't be read.
+bool loadOBJ(const char* path, Mesh* m);
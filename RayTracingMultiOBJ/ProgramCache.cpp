@@ -0,0 +1,128 @@
+/*
+Title: Basic Ray Tracer
+File Name: ProgramCache.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <vector>
+
+#include "ProgramCache.h"
+#include "MeshCache.h"
+
+unsigned long long programCacheKey(const std::vector<std::string>& texts)
+{
+	unsigned long long hash = 14695981039346656037ull;
+
+	for (const std::string& text : texts)
+	{
+		unsigned long long length = text.size();
+
+		for (int i = 0; i < 8; i++)
+		{
+			hash ^= (length >> (8 * i)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+
+		for (unsigned char c : text)
+		{
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return hash;
+}
+
+bool loadProgramCache(const char* path, unsigned long long key, GLuint program, float* compileMilliseconds)
+{
+	const unsigned char* data;
+	size_t size;
+
+	std::shared_ptr<const void> map = mapFile(path, &data, &size);
+	if (!map || size < sizeof(ProgramCacheHeader))
+		return false;
+
+	const ProgramCacheHeader* header = (const ProgramCacheHeader*)data;
+
+	if (header->magic != PROGRAM_CACHE_MAGIC ||
+		header->version != PROGRAM_CACHE_VERSION ||
+		header->key != key ||
+		header->binarySize <= 0 ||
+		sizeof(ProgramCacheHeader) + header->binarySize > size)
+		return false;
+
+	glProgramBinary(program, header->binaryFormat, data + sizeof(ProgramCacheHeader), header->binarySize);
+
+	// A driver can refuse a binary even if the key is the same,
+	// if the binary was made by a build of it that works differently
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+	if (linked != GL_TRUE)
+		return false;
+
+	*compileMilliseconds = header->compileMilliseconds;
+	return true;
+}
+
+bool writeProgramCache(const char* path, unsigned long long key, GLuint program, float compileMilliseconds)
+{
+	GLint binarySize = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+
+	if (binarySize <= 0)
+		return false;
+
+	std::vector<unsigned char> binary(binarySize);
+	GLenum binaryFormat = 0;
+	GLsizei length = 0;
+
+	glGetProgramBinary(program, binarySize, &length, &binaryFormat, binary.data());
+
+	if (length <= 0)
+		return false;
+
+	ProgramCacheHeader header;
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.binaryFormat = binaryFormat;
+	header.binarySize = length;
+	header.key = key;
+	header.compileMilliseconds = compileMilliseconds;
+	header.junk1 = 0;
+
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(binary.data(), 1, length, f) == (size_t)length;
+
+	// If anything failed, throw away the half written file
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (!ok)
+		remove(path);
+
+	return ok;
+}
@@ -0,0 +1,92 @@
+/*
+Title: Basic Ray Tracer
+File Name: ProgramCache.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Every time the program starts, init() compiles the three shaders from their
+source code, and links them into the draw program and the transform program.
+The fragment shader is big, so that takes a while, and it is the same work
+every time, unless a shader, a #define from shaderDefines(), or the driver
+changed.
+
+After a program is linked, glGetProgramBinary gives back the program the
+way the driver stores it, already compiled for the GPU, and it is saved in
+a .3Dprog file. The next time, glProgramBinary gives it back to the driver,
+and nothing is compiled at all.
+
+A binary only works with the driver (and the GPU) that made it, so every
+.3Dprog file has a key, a hash of the source code of every shader, the
+defines, and the strings that name the driver. If the key is different, or
+the driver says no to the binary anyway, the program is compiled again, and
+the .3Dprog file is made again.
+
+A .3Dprog file is a ProgramCacheHeader, followed by binarySize bytes of binary.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "GL/glew.h"
+
+// "3DPG", so that a file that is not a .3Dprog file is never read as one
+#define PROGRAM_CACHE_MAGIC 0x47504433
+
+// Change this when ProgramCacheHeader changes
+#define PROGRAM_CACHE_VERSION 1
+
+// 32 bytes
+struct ProgramCacheHeader
+{
+	int magic;
+	int version;
+
+	// What glGetProgramBinary said the binary is, and how big it is
+	unsigned int binaryFormat;
+	int binarySize;
+
+	// See programCacheKey
+	unsigned long long key;
+
+	// How long the program took to compile and link, when this file was made,
+	// so that loading the file can say how much time it saved
+	float compileMilliseconds;
+
+	int junk1;
+};
+
+// A 64 bit FNV-1a hash of every string in "texts", one after another.
+// The length of every string goes into the hash too, so moving text
+// from the end of one string to the start of the next changes it.
+unsigned long long programCacheKey(const std::vector<std::string>& texts);
+
+// Gives the binary in the .3Dprog file at "path" to "program" (made with
+// glCreateProgram, with nothing attached). Returns false if there is no
+// file, if it was made with a different key, or if the driver doesn't take
+// the binary, and then the program has to be compiled and linked instead.
+// "compileMilliseconds" gets how long that took when the file was made.
+bool loadProgramCache(const char* path, unsigned long long key, GLuint program, float* compileMilliseconds);
+
+// Saves the binary of "program" into the .3Dprog file at "path". The program
+// has to be linked after GL_PROGRAM_BINARY_RETRIEVABLE_HINT was set on it.
+// Returns false if the driver has no binary for it, or the file could not be written.
+bool writeProgramCache(const char* path, unsigned long long key, GLuint program, float compileMilliseconds);
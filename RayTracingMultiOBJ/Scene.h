@@ -0,0 +1,308 @@
+/*
+Title: Basic Ray Tracer
+File Name: Scene.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+The structures in this file are shared by the OpenGL renderer in main.cpp
+and the CPU renderer in CpuTracer.cpp. They match the layout of the structs
+in Compute.glsl and FragmentShader.glsl byte for byte, so if you change
+one of them here, you must change it in the shaders as well.
+*/
+
+#pragma once
+
+#include <float.h>
+#include <vector>
+#include <memory>
+#include "glm/glm.hpp"
+
+// The shaders do not have any of these typed into them. The number of
+// meshes, instances, and textures are counted after the scene is loaded,
+// and createShader() in main.cpp puts them, and the defines in this file,
+// at the top of every shader before it is compiled (see shaderDefines).
+#define MAX_LIGHTS 1
+
+// 1: Every mesh has a BVH in object space that is built once, and
+//    rays are moved into each instance's object space to trace it.
+//    The triangles are never transformed, so Compute.glsl is not used.
+// 0: Compute.glsl moves every triangle into world space every frame,
+//    and the BVH of every mesh is refit around them by Refit.glsl, and
+//    only rebuilt when it gets too slow (see BVH_REFIT_MAX_COST_RATIO).
+#define TWO_LEVEL_BVH 1
+
+// Which kinds of rays can hit an instance (Instance::mask)
+#define INSTANCE_MASK_CAMERA 1 // rays from the eye
+#define INSTANCE_MASK_SHADOW 2 // rays from a light, looking for shadows
+
+// Shadow rays from light l, the instances that are close enough to light l
+// to cast a shadow from it (see calcLightMasks in main.cpp). An instance has
+// to have every bit of a ray's mask, so a shadow ray from light l looks for
+// INSTANCE_MASK_SHADOW | INSTANCE_MASK_LIGHT(l). The bits after the first
+// two of an int only have room for 29 lights, 4 << 30 doesn't fit in an int.
+#define INSTANCE_MASK_LIGHT(l) (4 << (l))
+static_assert(MAX_LIGHTS <= 29, "INSTANCE_MASK_LIGHT needs a bit of the instance mask for every light");
+
+// A shadow ray goes from the light to the point that it lights, and stops
+// this much short of the point, so it doesn't hit the surface the point is on
+#define SHADOW_RAY_BIAS 0.1f
+
+// One triangle with everything about its three corners written out.
+// This is how every mesh used to be stored, 144 bytes per triangle, even
+// though most corners are shared by about six triangles. Now the meshes
+// are stored as vertices and indices (see Mesh), and this is only made
+// for a triangle that a ray hit, so that it can be shaded, just like
+// InTriangle in FragmentShader.glsl.
+struct triangle
+{
+	glm::vec4 pos[3];
+	glm::vec4 uv[3];
+	glm::vec4 normal[3];
+};
+
+// One corner of one or more triangles, this matches struct Vertex in
+// Compute.glsl and FragmentShader.glsl. The u and v of the texture
+// coordinate go into the 4th float after each vec3, where the shaders
+// would put padding anyway, so a vertex is only 32 bytes.
+struct Vertex
+{
+	glm::vec3 pos;
+	float u;
+	glm::vec3 normal;
+	float v;
+
+	bool operator==(const Vertex& other) const
+	{
+		return pos == other.pos && u == other.u && normal == other.normal && v == other.v;
+	}
+};
+
+// The corners of one triangle, only what a ray needs to test it: the first
+// corner, and the two edges that go from it to the other two corners, which
+// rayIntersectsTriangle would have to work out for every ray otherwise.
+// 36 bytes with nothing in between, this matches the 9 floats of every
+// triangle in trianglePositions in FragmentShader.glsl.
+struct TrianglePositions
+{
+	glm::vec3 v0;
+	glm::vec3 e1;
+	glm::vec3 e2;
+};
+
+// The triangles of one mesh on the CPU side. The GPU never sees this,
+// the vertices and indices of every mesh are put one after another into
+// two buffers (see packMeshes in main.cpp), and a MeshRange says where
+// each mesh is in those buffers.
+struct Mesh
+{
+	int numTriangles = 0;
+	int numVertices = 0;
+
+	// Every different corner in the mesh, only once (see parseOBJ)
+	std::vector<Vertex> vertices;
+
+	// 3 for every triangle, the vertices at its corners.
+	// They start at 0 in every mesh.
+	std::vector<unsigned int> indices;
+
+	// If the mesh was loaded from a .3Dbin file (see MeshCache.h), the two
+	// vectors are empty, and the vertices and indices are read straight from
+	// the file in memory. "mapping" keeps the file in memory for as long as
+	// any copy of the mesh uses it.
+	const Vertex* mappedVertices = nullptr;
+	const unsigned int* mappedIndices = nullptr;
+	std::shared_ptr<const void> mapping;
+
+	// One for every triangle, made from the vertices by calcPositions.
+	// Rays are tested against these, and the vertices (with the normals
+	// and uvs) are only read for the one triangle that a ray hits.
+	std::vector<TrianglePositions> positions;
+
+	// A sphere around the mesh, in object space, made by calcPositions.
+	// It says how big the mesh is on the screen (see selectLods in main.cpp).
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
+
+	// Use these to read the vertices and indices, they work for both kinds of mesh
+	const Vertex* vertexData() const { return mappedVertices ? mappedVertices : vertices.data(); }
+	const unsigned int* indexData() const { return mappedIndices ? mappedIndices : indices.data(); }
+
+	// Fills in "positions" and the bounding sphere, after the vertices and indices are loaded
+	void calcPositions()
+	{
+		const Vertex* v = vertexData();
+		const unsigned int* index = indexData();
+
+		positions.resize(numTriangles);
+
+		for (int t = 0; t < numTriangles; t++)
+		{
+			glm::vec3 p0 = v[index[3 * t]].pos;
+
+			positions[t].v0 = p0;
+			positions[t].e1 = v[index[3 * t + 1]].pos - p0;
+			positions[t].e2 = v[index[3 * t + 2]].pos - p0;
+		}
+
+		// The sphere goes through the corners of the box around
+		// the mesh, it is a little too big, but it is quick to find
+		glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+		glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+
+		for (int i = 0; i < numVertices; i++)
+		{
+			boundsMin = glm::min(boundsMin, v[i].pos);
+			boundsMax = glm::max(boundsMax, v[i].pos);
+		}
+
+		boundsCenter = numVertices > 0 ? (boundsMin + boundsMax) * 0.5f : glm::vec3(0.0f);
+		boundsRadius = numVertices > 0 ? glm::length(boundsMax - boundsMin) * 0.5f : 0.0f;
+	}
+
+	// Looks up the three corners of triangle "t"
+	triangle getTriangle(int t) const
+	{
+		const Vertex* v = vertexData();
+		const unsigned int* index = indexData() + 3 * t;
+
+		triangle tri;
+
+		for (int k = 0; k < 3; k++)
+		{
+			const Vertex& corner = v[index[k]];
+
+			tri.pos[k] = glm::vec4(corner.pos, 1.0f);
+			tri.uv[k] = glm::vec4(corner.u, corner.v, 0.0f, 0.0f);
+			tri.normal[k] = glm::vec4(corner.normal, 1.0f);
+		}
+
+		return tri;
+	}
+};
+
+// Where the indices and the vertices of one mesh are in the packed buffers,
+// this matches struct MeshRange in Compute.glsl. Triangle t of the mesh is
+// indices 3 * (firstTriangle + t) to 3 * (firstTriangle + t) + 2, and those
+// indices count from firstVertex.
+struct MeshRange
+{
+	int firstTriangle;
+	int numTriangles;
+	int firstVertex;
+	int numVertices;
+};
+
+// One instance that the compute shader moves into world space this frame,
+// this matches struct TransformJob in Compute.glsl. firstVertex and
+// firstTriangle count how many vertices and triangles all the jobs before
+// this one have, the threads of this job start right after them.
+struct TransformJob
+{
+	int instance;
+	int firstVertex;
+	int firstTriangle;
+	int junk1;
+};
+
+struct light {
+	glm::vec4 pos;
+	glm::vec4 color;
+	float radius;
+	float brightness;
+	float junk1;
+	float junk2;
+};
+
+// One copy of a mesh in the scene, this matches struct Instance in FragmentShader.glsl
+// and Compute.glsl. Many instances can use the same mesh, the four wheels are
+// one mesh with four instances, so the wheel's triangles are only stored once.
+// The mesh's triangles stay in object space, and rays are multiplied by
+// worldToObject to move them into the same space as the triangles.
+struct Instance
+{
+	// The matrix at "transform", and its inverse,
+	// filled in every frame by calcInstances
+	glm::mat4x4 objectToWorld;
+	glm::mat4x4 worldToObject;
+
+	// which mesh's triangles this is a copy of (m[mesh] in the shader),
+	// this is the LOD of "model" that camera rays see this frame
+	int mesh;
+
+	// which of the matrices from calcMatrices moves this instance
+	int transform;
+
+	// which texture is on this instance (textureTest[texture] in the shader)
+	int texture;
+
+	// INSTANCE_MASK_ bits for the rays that can hit this instance
+	int mask;
+
+	// root node of the BVH that the rays go into for this instance
+	int bvhRoot;
+
+	// Where the triangles of this instance are in the triangle positions,
+	// and where the vertices that its indices count from start. With
+	// TWO_LEVEL_BVH, that is the instance's mesh in the object space buffers,
+	// otherwise it is this instance's own copy of the mesh in world space
+	// (see calcInstanceOffsets in main.cpp)
+	int firstTriangle;
+	int firstVertex;
+
+	// Where the indices of the instance's mesh start in the index buffer,
+	// the instances of a mesh always share them
+	int firstIndex;
+
+	// LOD 0 of "mesh", the mesh that the instance is made from.
+	// selectLods (in main.cpp) picks "mesh" from it every frame.
+	int model;
+
+	// The LOD of "model" that shadow rays see, its tree, and where its
+	// triangles start. Shadow rays only need to know if they hit
+	// something, so they never read the vertices or the indices.
+	int shadowMesh;
+	int shadowBvhRoot;
+	int shadowFirstTriangle;
+};
+
+// The instances that can cast a shadow from each light, the ones with the
+// light's INSTANCE_MASK_LIGHT bit (see calcLightMasks in main.cpp). Light l
+// has count[l] of them, starting at instances[l * number of instances].
+// The shadow rays of a light only go through these: with TWO_LEVEL_BVH each
+// light has its own top level tree over them (see buildTopLevelBVH),
+// otherwise the shader goes through the list of each light.
+struct ShadowCasters
+{
+	int count[MAX_LIGHTS];
+	std::vector<int> instances;
+};
+
+// The camera position and the four corner rays of the camera's view.
+// The fragment shader gets these as uniforms, the CPU renderer gets
+// them as a struct, both interpolate between them the same way.
+struct CameraRays
+{
+	glm::vec3 eye;
+	glm::vec3 r00;
+	glm::vec3 r01;
+	glm::vec3 r10;
+	glm::vec3 r11;
+};
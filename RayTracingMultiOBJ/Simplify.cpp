@@ -0,0 +1,487 @@
+/*
+Title: Basic Ray Tracer
+File Name: Simplify.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+#include "Simplify.h"
+
+// Moving a point that was on the edge of a hole away from it costs this many
+// times more than moving it away from a triangle, so the holes keep their shape
+#define SIMPLIFY_BORDER_WEIGHT 10.0
+
+// A triangle that would turn more than this far away from where it faced
+// (the cosine of the angle) stops an edge from collapsing
+#define SIMPLIFY_MIN_NORMAL_DOT 0.2
+
+// The sum of the squared distances from a point to some planes. A plane
+// n.p + d = 0 adds (n.p + d)^2 = p.(n n^T) p + 2 d (n.p) + d^2 for a point p,
+// and n n^T is symmetric, so only these 10 numbers are needed for any number of planes.
+struct Quadric
+{
+	double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+	double dx = 0, dy = 0, dz = 0;
+	double dd = 0;
+
+	void addPlane(glm::dvec3 n, double d, double weight)
+	{
+		xx += weight * n.x * n.x; xy += weight * n.x * n.y; xz += weight * n.x * n.z;
+		yy += weight * n.y * n.y; yz += weight * n.y * n.z; zz += weight * n.z * n.z;
+		dx += weight * d * n.x; dy += weight * d * n.y; dz += weight * d * n.z;
+		dd += weight * d * d;
+	}
+
+	void add(const Quadric& q)
+	{
+		xx += q.xx; xy += q.xy; xz += q.xz;
+		yy += q.yy; yz += q.yz; zz += q.zz;
+		dx += q.dx; dy += q.dy; dz += q.dz;
+		dd += q.dd;
+	}
+
+	double error(glm::dvec3 p) const
+	{
+		return xx * p.x * p.x + 2.0 * xy * p.x * p.y + 2.0 * xz * p.x * p.z
+			+ yy * p.y * p.y + 2.0 * yz * p.y * p.z + zz * p.z * p.z
+			+ 2.0 * (dx * p.x + dy * p.y + dz * p.z) + dd;
+	}
+};
+
+// One triangle of the mesh while it is simplified
+struct SimplifyTriangle
+{
+	// The positions at its corners, these change when an edge collapses
+	int point[3];
+
+	// The vertices of "in" that the corners were, for their uvs and normals, these never change
+	int vertex[3];
+
+	bool alive;
+};
+
+// Collapsing point "from" onto point "to" costs "cost". "fromVersion" and
+// "toVersion" say how the points were when the cost was found, if either
+// point changed after that, there is a newer candidate for the edge.
+struct Candidate
+{
+	double cost;
+	int from;
+	int to;
+	int fromVersion;
+	int toVersion;
+
+	// std::priority_queue puts the biggest first, this makes it the cheapest
+	bool operator<(const Candidate& other) const { return cost > other.cost; }
+};
+
+struct Simplifier
+{
+	std::vector<glm::vec3> points;
+	std::vector<Quadric> quadrics;
+	std::vector<bool> pointAlive;
+	std::vector<bool> border;
+	std::vector<int> version;
+
+	// Every triangle that a point is in, or was in before it was thrown away
+	std::vector<std::vector<int>> pointTriangles;
+
+	std::vector<SimplifyTriangle> triangles;
+	int numAlive = 0;
+
+	std::priority_queue<Candidate> candidates;
+
+	// How many living triangles have both a and b in them
+	int countShared(int a, int b) const
+	{
+		int n = 0;
+
+		for (int t : pointTriangles[a])
+		{
+			const SimplifyTriangle& tri = triangles[t];
+
+			if (tri.alive && (tri.point[0] == b || tri.point[1] == b || tri.point[2] == b))
+				n++;
+		}
+
+		return n;
+	}
+
+	void addCandidate(int from, int to)
+	{
+		Quadric q = quadrics[from];
+		q.add(quadrics[to]);
+
+		Candidate c;
+		c.cost = q.error(glm::dvec3(points[to]));
+		c.from = from;
+		c.to = to;
+		c.fromVersion = version[from];
+		c.toVersion = version[to];
+
+		candidates.push(c);
+	}
+
+	// Every edge of every living triangle that "p" is in, both ways
+	void addCandidates(int p)
+	{
+		for (int t : pointTriangles[p])
+		{
+			const SimplifyTriangle& tri = triangles[t];
+
+			if (!tri.alive)
+				continue;
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (tri.point[k] != p)
+				{
+					addCandidate(p, tri.point[k]);
+					addCandidate(tri.point[k], p);
+				}
+			}
+		}
+	}
+
+	bool canCollapse(int from, int to) const
+	{
+		int shared = countShared(from, to);
+
+		// Not an edge anymore
+		if (shared == 0)
+			return false;
+
+		// A point on the edge of a hole can only slide along it
+		if (border[from] && shared != 1)
+			return false;
+
+		// Every neighbor that "from" and "to" have in common has to be
+		// across the edge, in one of the triangles that is thrown away
+		std::vector<int> fromNeighbors;
+
+		for (int t : pointTriangles[from])
+		{
+			const SimplifyTriangle& tri = triangles[t];
+
+			if (tri.alive)
+				for (int k = 0; k < 3; k++)
+					if (tri.point[k] != from && tri.point[k] != to)
+						fromNeighbors.push_back(tri.point[k]);
+		}
+
+		std::vector<int> common;
+
+		for (int t : pointTriangles[to])
+		{
+			const SimplifyTriangle& tri = triangles[t];
+
+			if (!tri.alive)
+				continue;
+
+			for (int k = 0; k < 3; k++)
+			{
+				int p = tri.point[k];
+
+				if (p == from || p == to)
+					continue;
+
+				for (int n : fromNeighbors)
+				{
+					if (n == p)
+					{
+						bool seen = false;
+
+						for (int c : common)
+							seen = seen || c == p;
+
+						if (!seen)
+							common.push_back(p);
+
+						break;
+					}
+				}
+			}
+		}
+
+		if ((int)common.size() > shared)
+			return false;
+
+		// No triangle that stays can turn around
+		for (int t : pointTriangles[from])
+		{
+			const SimplifyTriangle& tri = triangles[t];
+
+			if (!tri.alive || tri.point[0] == to || tri.point[1] == to || tri.point[2] == to)
+				continue;
+
+			glm::vec3 before[3];
+			glm::vec3 after[3];
+
+			for (int k = 0; k < 3; k++)
+			{
+				before[k] = points[tri.point[k]];
+				after[k] = tri.point[k] == from ? points[to] : before[k];
+			}
+
+			glm::vec3 nBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 nAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+
+			float lengths = glm::length(nBefore) * glm::length(nAfter);
+
+			if (lengths == 0.0f || glm::dot(nBefore, nAfter) < SIMPLIFY_MIN_NORMAL_DOT * lengths)
+				return false;
+		}
+
+		return true;
+	}
+
+	void collapse(int from, int to)
+	{
+		for (int t : pointTriangles[from])
+		{
+			SimplifyTriangle& tri = triangles[t];
+
+			if (!tri.alive)
+				continue;
+
+			if (tri.point[0] == to || tri.point[1] == to || tri.point[2] == to)
+			{
+				tri.alive = false;
+				numAlive--;
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++)
+				if (tri.point[k] == from)
+					tri.point[k] = to;
+
+			pointTriangles[to].push_back(t);
+		}
+
+		quadrics[to].add(quadrics[from]);
+		pointAlive[from] = false;
+		version[to]++;
+
+		addCandidates(to);
+	}
+};
+
+void simplifyMesh(const Mesh& in, int targetTriangles, Mesh* out)
+{
+	const Vertex* vertices = in.vertexData();
+	const unsigned int* indices = in.indexData();
+
+	Simplifier s;
+
+	// Vertices that are in the same place are one point, and the
+	// vertices that have the same uv and normal share an "attribute"
+	std::map<std::tuple<float, float, float>, int> pointIds;
+	std::map<std::tuple<float, float, float, float, float>, int> attributeIds;
+	std::vector<int> pointOf(in.numVertices);
+	std::vector<int> attributeOf(in.numVertices);
+
+	for (int v = 0; v < in.numVertices; v++)
+	{
+		const Vertex& vertex = vertices[v];
+
+		auto point = pointIds.insert({ std::make_tuple(vertex.pos.x, vertex.pos.y, vertex.pos.z), (int)s.points.size() });
+
+		if (point.second)
+			s.points.push_back(vertex.pos);
+
+		auto attribute = attributeIds.insert({ std::make_tuple(vertex.u, vertex.v, vertex.normal.x, vertex.normal.y, vertex.normal.z), v });
+
+		pointOf[v] = point.first->second;
+		attributeOf[v] = attribute.first->second;
+	}
+
+	int numPoints = (int)s.points.size();
+
+	s.quadrics.resize(numPoints);
+	s.pointAlive.assign(numPoints, true);
+	s.border.assign(numPoints, false);
+	s.version.assign(numPoints, 0);
+	s.pointTriangles.resize(numPoints);
+
+	// How many triangles use every edge, the smaller point first
+	std::map<std::pair<int, int>, int> edgeUses;
+
+	for (int t = 0; t < in.numTriangles; t++)
+	{
+		SimplifyTriangle tri;
+		tri.alive = true;
+
+		for (int k = 0; k < 3; k++)
+		{
+			tri.vertex[k] = indices[3 * t + k];
+			tri.point[k] = pointOf[tri.vertex[k]];
+		}
+
+		// A triangle that is already flat, two corners in the same place
+		if (tri.point[0] == tri.point[1] || tri.point[1] == tri.point[2] || tri.point[2] == tri.point[0])
+			continue;
+
+		int id = (int)s.triangles.size();
+		s.triangles.push_back(tri);
+
+		glm::dvec3 p0 = s.points[tri.point[0]];
+		glm::dvec3 p1 = s.points[tri.point[1]];
+		glm::dvec3 p2 = s.points[tri.point[2]];
+
+		// Big triangles count more than small ones, so
+		// the plane is weighted by the triangle's area
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(n);
+
+		if (area > 0.0)
+		{
+			n /= area;
+
+			for (int k = 0; k < 3; k++)
+				s.quadrics[tri.point[k]].addPlane(n, -glm::dot(n, p0), area * 0.5);
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			int a = tri.point[k];
+			int b = tri.point[(k + 1) % 3];
+
+			edgeUses[std::make_pair(glm::min(a, b), glm::max(a, b))]++;
+			s.pointTriangles[a].push_back(id);
+		}
+	}
+
+	s.numAlive = (int)s.triangles.size();
+
+	// An edge with one triangle is on the edge of a hole. Its points get a
+	// plane that goes through the edge, straight up from the triangle, so
+	// moving them away from the hole costs a lot. An edge with more than two
+	// triangles is not a surface there, so its points are treated the same.
+	for (const SimplifyTriangle& tri : s.triangles)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int a = tri.point[k];
+			int b = tri.point[(k + 1) % 3];
+
+			int uses = edgeUses[std::make_pair(glm::min(a, b), glm::max(a, b))];
+
+			if (uses == 2)
+				continue;
+
+			s.border[a] = true;
+			s.border[b] = true;
+
+			if (uses != 1)
+				continue;
+
+			glm::dvec3 pa = s.points[a];
+			glm::dvec3 pb = s.points[b];
+			glm::dvec3 pc = s.points[tri.point[(k + 2) % 3]];
+
+			glm::dvec3 faceNormal = glm::cross(pb - pa, pc - pa);
+			glm::dvec3 n = glm::cross(pb - pa, faceNormal);
+			double length = glm::length(n);
+
+			if (length == 0.0)
+				continue;
+
+			n /= length;
+
+			double weight = SIMPLIFY_BORDER_WEIGHT * glm::dot(pb - pa, pb - pa);
+			s.quadrics[a].addPlane(n, -glm::dot(n, pa), weight);
+			s.quadrics[b].addPlane(n, -glm::dot(n, pa), weight);
+		}
+	}
+
+	for (int p = 0; p < numPoints; p++)
+		for (int t : s.pointTriangles[p])
+			for (int k = 0; k < 3; k++)
+				if (s.triangles[t].point[k] != p)
+					s.addCandidate(p, s.triangles[t].point[k]);
+
+	while (s.numAlive > targetTriangles && !s.candidates.empty())
+	{
+		Candidate c = s.candidates.top();
+		s.candidates.pop();
+
+		if (!s.pointAlive[c.from] || !s.pointAlive[c.to])
+			continue;
+
+		if (c.fromVersion != s.version[c.from] || c.toVersion != s.version[c.to])
+			continue;
+
+		if (!s.canCollapse(c.from, c.to))
+			continue;
+
+		s.collapse(c.from, c.to);
+	}
+
+	// Every corner that is left is a point, with the uv and normal of the
+	// vertex it was, and the corners that are the same are one vertex again
+	std::map<std::pair<int, int>, unsigned int> newVertices;
+
+	out->vertices.clear();
+	out->indices.clear();
+	out->mappedVertices = nullptr;
+	out->mappedIndices = nullptr;
+	out->mapping.reset();
+
+	for (const SimplifyTriangle& tri : s.triangles)
+	{
+		if (!tri.alive)
+			continue;
+
+		for (int k = 0; k < 3; k++)
+		{
+			int attribute = attributeOf[tri.vertex[k]];
+			auto found = newVertices.insert({ std::make_pair(tri.point[k], attribute), (unsigned int)out->vertices.size() });
+
+			if (found.second)
+			{
+				Vertex vertex = vertices[attribute];
+				vertex.pos = s.points[tri.point[k]];
+				out->vertices.push_back(vertex);
+			}
+
+			out->indices.push_back(found.first->second);
+		}
+	}
+
+	out->numVertices = (int)out->vertices.size();
+	out->numTriangles = (int)out->indices.size() / 3;
+	out->calcPositions();
+}
+
+void buildLods(const Mesh& mesh, Mesh* lods)
+{
+	float ratio = 1.0f;
+
+	for (int lod = 1; lod < NUM_LODS; lod++)
+	{
+		ratio *= LOD_TRIANGLE_RATIO;
+		simplifyMesh(mesh, (int)(mesh.numTriangles * ratio), &lods[lod - 1]);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+Title: Basic Ray Tracer
+File Name: Simplify.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Description:
+Makes smaller versions of a mesh, with fewer triangles, for when the mesh is
+far away and only covers a few pixels, and for shadow rays, which only need
+to know that they hit something, not what it looked like. These are the
+LODs (levels of detail) of the mesh. LOD 0 is the mesh as it was loaded.
+
+The triangles are removed by collapsing edges, one at a time. Collapsing
+the edge from corner a to corner b moves a onto b, the two triangles on the
+edge get flat and are thrown away, and every other triangle of a now uses b.
+
+Which edge goes next is decided by quadric error metrics (Garland and
+Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997).
+Every corner keeps the planes of the triangles that were around it in the
+first mesh, and the error of moving it somewhere is the sum of the squared
+distances from there to those planes. The planes are added together in a
+Quadric, which is only 10 numbers, however many planes there are. When a
+moves onto b, b gets the planes of a too, and the edge that moves the mesh
+the least away from where it was always goes first.
+
+The mesh is simplified by position, not by Vertex. The corners that were
+split for the uvs or the normals (see ObjLoader.h) stay together, so
+collapsing an edge never tears the mesh open along a seam. Every corner
+of a triangle keeps its own uv and normal, only its position moves.
+
+An edge is not collapsed if:
+- a is on the edge of a hole, and the edge is not, so holes keep their shape
+- it would turn a triangle around, so that it faces the other way
+- a and b have another neighbor in common, besides the corners across the
+  edge, because the mesh would fold over into two sheets there
+*/
+
+#pragma once
+
+#include "Scene.h"
+
+// How many LODs every mesh that has them has, counting LOD 0. Every LOD
+// after LOD 0 has about LOD_TRIANGLE_RATIO times the triangles of the one
+// before it, if there are enough edges that can be collapsed.
+#define NUM_LODS 3
+#define LOD_TRIANGLE_RATIO 0.5f
+
+// Collapses edges of "in" until it has no more than "targetTriangles"
+// triangles, or until no edge can be collapsed, and writes the result to
+// "out" with its own vertices, indices, and positions. "in" can be mapped
+// from a .3Dbin file, "out" never is.
+void simplifyMesh(const Mesh& in, int targetTriangles, Mesh* out);
+
+// Makes LOD 1 to LOD NUM_LODS - 1 of "mesh", and writes them to lods[0] to
+// lods[NUM_LODS - 2]. Each one is simplified from "mesh", down to LOD_TRIANGLE_RATIO,
+// LOD_TRIANGLE_RATIO squared, and so on, of its triangles.
+void buildLods(const Mesh& mesh, Mesh* lods);
@@ -0,0 +1,465 @@
+/*
+Title: Basic Ray Tracer
+File Name: TextureCache.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cfloat>
+#include <vector>
+
+#include "TextureCache.h"
+#include "MeshCache.h"
+
+size_t textureLevelSize(int format, int width, int height)
+{
+	if (format == TEXTURE_FORMAT_BGRA8)
+		return 4 * (size_t)width * height;
+
+	// A level that is smaller than 4x4 still needs a whole block
+	size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+
+	return blocks * (format == TEXTURE_FORMAT_BC1 ? 8 : 16);
+}
+
+// Makes the next mip level, half as wide and half as high, where every
+// texel is the average of 2x2 texels. If the width or height is odd,
+// the last column or row is left out, like glGenerateMipmap does.
+static void halveImage(const unsigned char* src, int width, int height, unsigned char* dst)
+{
+	int newWidth = width > 1 ? width / 2 : 1;
+	int newHeight = height > 1 ? height / 2 : 1;
+
+	for (int y = 0; y < newHeight; y++)
+	{
+		int y0 = glm::min(2 * y, height - 1);
+		int y1 = glm::min(2 * y + 1, height - 1);
+
+		for (int x = 0; x < newWidth; x++)
+		{
+			int x0 = glm::min(2 * x, width - 1);
+			int x1 = glm::min(2 * x + 1, width - 1);
+
+			for (int c = 0; c < 4; c++)
+			{
+				int sum =
+					src[4 * (y0 * width + x0) + c] +
+					src[4 * (y0 * width + x1) + c] +
+					src[4 * (y1 * width + x0) + c] +
+					src[4 * (y1 * width + x1) + c];
+
+				dst[4 * (y * newWidth + x) + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+// 8 bit color to 5:6:5, and back again the way the GPU does it
+static unsigned short packColor(glm::vec3 rgb)
+{
+	int r = (int)(glm::clamp(rgb.r, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	int g = (int)(glm::clamp(rgb.g, 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+	int b = (int)(glm::clamp(rgb.b, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static glm::vec3 unpackColor(unsigned short c)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+
+	return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+// Compresses the colors of 16 texels (RGB, 0 to 255) into an 8 byte BC1 block.
+// The two end colors are the texels that are furthest apart along the line
+// that the colors of the block are spread the most along, and every texel
+// picks the closest of the 4 colors on that line.
+static void compressColorBlock(const glm::vec3* texels, unsigned char* out)
+{
+	glm::vec3 mean = glm::vec3(0);
+	glm::vec3 lo = texels[0];
+	glm::vec3 hi = texels[0];
+
+	for (int i = 0; i < 16; i++)
+	{
+		mean += texels[i];
+		lo = glm::min(lo, texels[i]);
+		hi = glm::max(hi, texels[i]);
+	}
+
+	mean /= 16.0f;
+
+	// How the colors spread around the mean (the covariance)
+	glm::mat3 spread = glm::mat3(0);
+
+	for (int i = 0; i < 16; i++)
+	{
+		glm::vec3 d = texels[i] - mean;
+		spread += glm::outerProduct(d, d);
+	}
+
+	// The line they spread the most along, found by multiplying
+	// any direction by the spread a few times
+	glm::vec3 axis = hi - lo;
+
+	for (int i = 0; i < 4; i++)
+	{
+		axis = spread * axis;
+
+		float length = glm::length(axis);
+		if (length < 0.0001f)
+			break;
+
+		axis /= length;
+	}
+
+	if (glm::length(axis) < 0.0001f)
+		axis = glm::vec3(1);
+
+	int first = 0;
+	int last = 0;
+	float smallest = glm::dot(texels[0], axis);
+	float biggest = smallest;
+
+	for (int i = 1; i < 16; i++)
+	{
+		float d = glm::dot(texels[i], axis);
+
+		if (d < smallest) { smallest = d; first = i; }
+		if (d > biggest) { biggest = d; last = i; }
+	}
+
+	unsigned short c0 = packColor(texels[last]);
+	unsigned short c1 = packColor(texels[first]);
+
+	// c0 has to be the bigger one, or the GPU reads
+	// the block as 3 colors and a transparent black
+	if (c0 < c1)
+	{
+		unsigned short c = c0;
+		c0 = c1;
+		c1 = c;
+	}
+
+	glm::vec3 palette[4];
+	palette[0] = unpackColor(c0);
+	palette[1] = unpackColor(c1);
+	palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+	unsigned int indices = 0;
+
+	// if both ends are the same color, every texel is color 0
+	if (c0 != c1)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			float bestDistance = FLT_MAX;
+
+			for (int k = 0; k < 4; k++)
+			{
+				glm::vec3 d = texels[i] - palette[k];
+				float distance = glm::dot(d, d);
+
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = k;
+				}
+			}
+
+			indices |= (unsigned int)best << (2 * i);
+		}
+	}
+
+	memcpy(out, &c0, 2);
+	memcpy(out + 2, &c1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+// Compresses the alpha of 16 texels into the 8 byte alpha part of a BC3 block.
+// The ends are the smallest and biggest alpha, with 6 steps between them.
+static void compressAlphaBlock(const int* alpha, unsigned char* out)
+{
+	int a0 = alpha[0];
+	int a1 = alpha[0];
+
+	for (int i = 1; i < 16; i++)
+	{
+		a0 = glm::max(a0, alpha[i]);
+		a1 = glm::min(a1, alpha[i]);
+	}
+
+	int palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+
+	for (int k = 2; k < 8; k++)
+		palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+
+	unsigned long long indices = 0;
+
+	if (a0 != a1)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+
+			for (int k = 1; k < 8; k++)
+				if (abs(alpha[i] - palette[k]) < abs(alpha[i] - palette[best]))
+					best = k;
+
+			indices |= (unsigned long long)best << (3 * i);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+
+	// 16 indices of 3 bits, 6 bytes
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// Compresses one level into BC1 or BC3 blocks. A block at the edge of
+// a level that isn't a multiple of 4 repeats the last row or column.
+static void compressLevel(const unsigned char* bgra, int width, int height, int format, unsigned char* out)
+{
+	int blockSize = format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+
+	for (int by = 0; by < (height + 3) / 4; by++)
+	{
+		for (int bx = 0; bx < (width + 3) / 4; bx++)
+		{
+			glm::vec3 colors[16];
+			int alpha[16];
+
+			for (int i = 0; i < 16; i++)
+			{
+				int x = glm::min(4 * bx + (i & 3), width - 1);
+				int y = glm::min(4 * by + (i >> 2), height - 1);
+
+				const unsigned char* p = &bgra[4 * (y * width + x)];
+
+				colors[i] = glm::vec3(p[2], p[1], p[0]);
+				alpha[i] = p[3];
+			}
+
+			if (format == TEXTURE_FORMAT_BC3)
+			{
+				compressAlphaBlock(alpha, out);
+				compressColorBlock(colors, out + 8);
+			}
+			else
+			{
+				compressColorBlock(colors, out);
+			}
+
+			out += blockSize;
+		}
+	}
+}
+
+int bestTextureFormat(const unsigned char* bgra, int width, int height)
+{
+	if (!TEXTURE_CACHE_COMPRESS)
+		return TEXTURE_FORMAT_BGRA8;
+
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		if (bgra[4 * i + 3] != 255)
+			return TEXTURE_FORMAT_BC3;
+
+	return TEXTURE_FORMAT_BC1;
+}
+
+void bakeTexture(const unsigned char* bgra, int width, int height, int format, CpuTexture* tex)
+{
+	*tex = CpuTexture();
+	tex->width = width;
+	tex->height = height;
+	tex->format = format;
+
+	// Every level down to 1x1
+	int numLevels = 1;
+	while (numLevels < TEXTURE_MAX_LEVELS && ((width >> numLevels) > 0 || (height >> numLevels) > 0))
+		numLevels++;
+
+	tex->numLevels = numLevels;
+
+	size_t total = 0;
+
+	for (int i = 0; i < numLevels; i++)
+	{
+		tex->levelOffset[i] = total;
+		tex->levelSize[i] = textureLevelSize(format, tex->levelWidth(i), tex->levelHeight(i));
+		total += tex->levelSize[i];
+	}
+
+	tex->texels.resize(total);
+
+	// The level that is being compressed, and the next one, as BGRA8
+	std::vector<unsigned char> level(bgra, bgra + 4 * (size_t)width * height);
+	std::vector<unsigned char> next;
+
+	for (int i = 0; i < numLevels; i++)
+	{
+		int w = tex->levelWidth(i);
+		int h = tex->levelHeight(i);
+
+		if (format == TEXTURE_FORMAT_BGRA8)
+			memcpy(&tex->texels[tex->levelOffset[i]], level.data(), level.size());
+		else
+			compressLevel(level.data(), w, h, format, &tex->texels[tex->levelOffset[i]]);
+
+		// every level is made from the uncompressed level before it
+		if (i + 1 < numLevels)
+		{
+			next.resize(textureLevelSize(TEXTURE_FORMAT_BGRA8, tex->levelWidth(i + 1), tex->levelHeight(i + 1)));
+			halveImage(level.data(), w, h, next.data());
+			level.swap(next);
+		}
+	}
+}
+
+std::string textureCachePath(const char* sourcePath)
+{
+	std::string path = sourcePath;
+
+	// only look for the dot after the last slash, like meshCachePath
+	size_t slash = path.find_last_of("/\\");
+	size_t dot = path.find_last_of('.');
+
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		path.erase(dot);
+
+	return path + ".3Dtex";
+}
+
+bool loadTextureCache(const char* sourcePath, CpuTexture* tex)
+{
+	long long sourceSize, sourceTime;
+	if (!getFileInfo(sourcePath, &sourceSize, &sourceTime))
+		return false;
+
+	const unsigned char* data;
+	size_t size;
+
+	std::shared_ptr<const void> map = mapFile(textureCachePath(sourcePath).c_str(), &data, &size);
+	if (!map || size < sizeof(TextureCacheHeader))
+		return false;
+
+	const TextureCacheHeader* header = (const TextureCacheHeader*)data;
+
+	// Made by a different version of this program, or from
+	// a different version of the image file, so make it again
+	if (header->magic != TEXTURE_CACHE_MAGIC ||
+		header->version != TEXTURE_CACHE_VERSION ||
+		header->sourceSize != sourceSize ||
+		header->sourceTime != sourceTime)
+		return false;
+
+	if (header->format < TEXTURE_FORMAT_BGRA8 || header->format > TEXTURE_FORMAT_BC3 ||
+		header->width <= 0 || header->height <= 0 ||
+		header->numLevels <= 0 || header->numLevels > TEXTURE_MAX_LEVELS)
+		return false;
+
+	CpuTexture t;
+	t.width = header->width;
+	t.height = header->height;
+	t.format = header->format;
+	t.numLevels = header->numLevels;
+
+	// Walk through the levels, and check that every one is
+	// as big as it should be, and that the file isn't cut short
+	size_t offset = sizeof(TextureCacheHeader);
+
+	for (int i = 0; i < t.numLevels; i++)
+	{
+		unsigned int levelSize;
+
+		if (offset + sizeof(levelSize) > size)
+			return false;
+
+		memcpy(&levelSize, data + offset, sizeof(levelSize));
+		offset += sizeof(levelSize);
+
+		if (levelSize != textureLevelSize(t.format, t.levelWidth(i), t.levelHeight(i)) || offset + levelSize > size)
+			return false;
+
+		t.levelOffset[i] = offset;
+		t.levelSize[i] = levelSize;
+		offset += levelSize;
+	}
+
+	if (offset != size)
+		return false;
+
+	t.mappedTexels = data;
+	t.mapping = map;
+
+	*tex = t;
+	return true;
+}
+
+bool writeTextureCache(const char* sourcePath, const CpuTexture& tex)
+{
+	TextureCacheHeader header;
+	header.magic = TEXTURE_CACHE_MAGIC;
+	header.version = TEXTURE_CACHE_VERSION;
+	header.format = tex.format;
+	header.width = tex.width;
+	header.height = tex.height;
+	header.numLevels = tex.numLevels;
+	header.junk1 = 0;
+	header.junk2 = 0;
+
+	if (!getFileInfo(sourcePath, &header.sourceSize, &header.sourceTime))
+		return false;
+
+	FILE* f = fopen(textureCachePath(sourcePath).c_str(), "wb");
+	if (!f)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	for (int i = 0; ok && i < tex.numLevels; i++)
+	{
+		unsigned int levelSize = (unsigned int)tex.levelSize[i];
+
+		ok = fwrite(&levelSize, sizeof(levelSize), 1, f) == 1 &&
+			fwrite(tex.levelData(i), 1, levelSize, f) == levelSize;
+	}
+
+	// If anything failed, throw away the half written file
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (!ok)
+		remove(textureCachePath(sourcePath).c_str());
+
+	return ok;
+}
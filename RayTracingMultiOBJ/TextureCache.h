@@ -0,0 +1,106 @@
+/*
+Title: Basic Ray Tracer
+File Name: TextureCache.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Loading a texture used to mean decoding a PNG with FreeImage, giving all
+of its texels to OpenGL as RGBA8, and letting glGenerateMipmap make the
+smaller mip levels, every time the program started.
+
+The first time a texture is loaded, bakeTexture makes every mip level on
+the CPU, and (if TEXTURE_CACHE_COMPRESS is 1) compresses every level into
+BC1 blocks, or BC3 blocks if the texture has any alpha that is not 255.
+A 4x4 block of texels is 8 bytes in BC1 and 16 in BC3, instead of 64,
+so the texture takes 8 (or 4) times less memory on the GPU, and every
+texture() in getSurfaceColor reads that much less memory too.
+
+The levels are saved into a .3Dtex file next to the image, and the next
+time the .3Dtex file is mapped into memory (like a .3Dbin file, see
+MeshCache.h), and LoadTexture gives the levels to OpenGL as they are.
+
+A .3Dtex file is laid out like a KTX file: a TextureCacheHeader, and then
+for every level, level 0 first, the size of the level in bytes as an
+unsigned int, followed by the bytes of the level. Every level size is a
+multiple of 4 bytes, so every level starts 4 byte aligned.
+*/
+
+#pragma once
+
+#include <string>
+#include "CpuTracer.h"
+
+// "3DTX", so that a file that is not a .3Dtex file is never read as one
+#define TEXTURE_CACHE_MAGIC 0x58544433
+
+// Change this when TextureCacheHeader, or the way the levels
+// are made, changes, so that old .3Dtex files are made again
+#define TEXTURE_CACHE_VERSION 1
+
+// 1 to save BC1 / BC3 blocks, 0 to save every level as BGRA8.
+// Change TEXTURE_CACHE_VERSION too, so that the files are made again.
+#define TEXTURE_CACHE_COMPRESS 1
+
+// 48 bytes, so the first level starts 16 byte aligned
+struct TextureCacheHeader
+{
+	int magic;
+	int version;
+
+	// TEXTURE_FORMAT_BGRA8, TEXTURE_FORMAT_BC1, or TEXTURE_FORMAT_BC3
+	int format;
+
+	int width;
+	int height;
+	int numLevels;
+
+	int junk1;
+	int junk2;
+
+	// Size and last write time of the image file
+	long long sourceSize;
+	long long sourceTime;
+};
+
+// How many bytes one mip level is
+size_t textureLevelSize(int format, int width, int height);
+
+// Makes every mip level of a BGRA8 image (the bottom row first, like
+// FreeImage gives it), and puts them into "tex" in "format". Every level
+// is half the size of the one before, made by averaging 2x2 texels.
+void bakeTexture(const unsigned char* bgra, int width, int height, int format, CpuTexture* tex);
+
+// TEXTURE_FORMAT_BC1 if every texel has an alpha of 255, otherwise TEXTURE_FORMAT_BC3,
+// or TEXTURE_FORMAT_BGRA8 if TEXTURE_CACHE_COMPRESS is 0
+int bestTextureFormat(const unsigned char* bgra, int width, int height);
+
+// The name of the .3Dtex file of an image file, the
+// same name and folder, with a different extension
+std::string textureCachePath(const char* sourcePath);
+
+// Maps the .3Dtex file of "sourcePath" into memory, and points "tex" at the levels
+// in it. Returns false, and leaves "tex" alone, if there is no .3Dtex file, or if
+// it was made from a different version of the image file.
+bool loadTextureCache(const char* sourcePath, CpuTexture* tex);
+
+// Saves every level of "tex" into the .3Dtex file of "sourcePath".
+// Returns false if the file could not be written.
+bool writeTextureCache(const char* sourcePath, const CpuTexture& tex);
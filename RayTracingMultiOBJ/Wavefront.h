@@ -0,0 +1,147 @@
+/*
+Title: Basic Ray Tracer
+File Name: Wavefront.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Normally every pixel is traced from start to end by one big shader: the
+camera ray, the shading, and the shadow ray all in one function. Every
+thread holds the registers of the biggest part of it the whole time, and
+threads next to each other wait for each other whenever they go down a
+different branch (the road casts a shadow ray, the car and the sky don't).
+
+With WAVEFRONT_TRACE (see main.cpp), the work is split into small compute
+passes, and each pass does one step for every ray that needs it:
+
+generate - makes the camera ray of every pixel, and puts it in the ray queue
+extend   - finds the closest triangle of every ray in the ray queue,
+           and puts every ray that hit something in the hit queue
+shade    - works out the color of every hit, adds it to its pixel, and puts
+           a shadow ray in the shadow queue for every light that has to be tested
+shadow   - tests every shadow ray, and adds its light to its pixel
+           if nothing is in the way
+resolve  - turns the colors that were added up into traceImage
+
+A queue is a buffer of entries, and a count in queueCountBuffer. A pass
+that adds to a queue gets room for a whole group of threads with one
+atomicAdd, and raises numGroupsX at the same time, which is the number of
+groups glDispatchComputeIndirect starts for the pass that reads the queue.
+The CPU never has to read a count back to know how big the next pass is.
+
+Many entries can add to one pixel (more lights, or more bounces, later on),
+so the colors are added up with atomicAdd too, as fixed point numbers,
+which is why the pixels are uints until resolve.
+
+These structs are the std430 layout of the queues in FragmentShader.glsl,
+and cpuRenderFrameWavefront (see CpuTracer.h) uses the same ones.
+*/
+
+#pragma once
+
+#include "glm/glm.hpp"
+
+// Which pass main.cpp is compiling FragmentShader.glsl
+// into, it is the WAVEFRONT_STAGE #define of the shader
+#define WAVEFRONT_GENERATE 1
+#define WAVEFRONT_EXTEND 2
+#define WAVEFRONT_SHADE 3
+#define WAVEFRONT_SHADOW 4
+#define WAVEFRONT_RESOLVE 5
+#define NUM_WAVEFRONT_PASSES 5
+
+// Every group of threads generates the camera rays of a WAVEFRONT_TILE_SIZE x
+// WAVEFRONT_TILE_SIZE tile of pixels, so that rays that are next to each other
+// in the queues go through the same boxes of the BVH. Every other pass has
+// groups of the same size, that take the next WAVEFRONT_GROUP_SIZE entries.
+#define WAVEFRONT_TILE_SIZE 8
+#define WAVEFRONT_GROUP_SIZE (WAVEFRONT_TILE_SIZE * WAVEFRONT_TILE_SIZE)
+
+// The colors of the pixels are added up as uints, 1.0 is WAVEFRONT_COLOR_SCALE.
+// A step is far smaller than one step of an 8 bit color, and a pixel can
+// still add up to 4096 before it runs out of bits.
+#define WAVEFRONT_COLOR_SCALE 1048576.0f
+
+// Which queue a WavefrontQueueCount is for, queueCounts[i] in the shader
+#define WAVEFRONT_RAY_QUEUE 0
+#define WAVEFRONT_HIT_QUEUE 1
+#define WAVEFRONT_SHADOW_QUEUE 2
+#define NUM_WAVEFRONT_QUEUES 3
+
+// 32 bytes, a ray that still has to be traced
+struct WavefrontRay
+{
+	glm::vec3 origin;
+
+	// which pixel the ray adds its color to, y * width + x
+	int pixel;
+
+	glm::vec3 dir;
+	float junk1;
+};
+
+// 48 bytes, a ray that hit a triangle, and everything
+// that intersectTriangles found out about the hit
+struct WavefrontHit
+{
+	glm::vec3 dir;
+	int pixel;
+
+	glm::vec3 point;
+	float dist;
+
+	glm::vec2 bary;
+	int m;
+	int t;
+};
+
+// 48 bytes, a ray from a light to a point that a ray hit. If nothing is
+// hit on the way, "color" is added to the pixel. It goes from the light
+// to the point, the same way addLightColorToPixColor traces it.
+struct WavefrontShadowRay
+{
+	// where the light is
+	glm::vec3 origin;
+	int pixel;
+
+	glm::vec3 dir;
+
+	// how far the point is from the light, anything that is hit
+	// more than SHADOW_RAY_BIAS closer than that to the light is in the way
+	float dist;
+
+	glm::vec3 color;
+
+	// which light it comes from, only the instances
+	// near it are tested (see ShadowCasters in Scene.h)
+	int light;
+};
+
+// 16 bytes, how many entries are in a queue, followed by the numbers
+// that glDispatchComputeIndirect reads, which start a group of threads
+// for every WAVEFRONT_GROUP_SIZE entries. A queue is empty when count
+// and numGroupsX are 0, and numGroupsY and numGroupsZ are 1.
+struct WavefrontQueueCount
+{
+	unsigned int count;
+	unsigned int numGroupsX;
+	unsigned int numGroupsY;
+	unsigned int numGroupsZ;
+};
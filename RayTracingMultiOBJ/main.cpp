@@ -27,6 +27,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string>
 #include <fstream>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cfloat>
 #include <windows.h>
 using namespace std;
 
@@ -38,62 +43,207 @@ using namespace std;
 
 #include "FreeImage.h"
 
-#define MAX_LIGHTS 1
-#define MAX_MESHES 7
-#define MAX_TRIANGLES_PER_MESH 1486 // biggest mesh is 1486 triangles
-#define NUM_TRIANGLES_IN_SCENE 1554 // This is calculated in the console window
-#define MAX_TEXTURES 3
-
-struct triangle
-{
-	glm::vec4 pos[3];
-	glm::vec4 uv[3];
-	glm::vec4 normal[3];
-};
-
-struct Mesh
-{
-	int numTriangles;
-	int junk1;
-	int junk2;
-	int junk3;
-	triangle triangles[MAX_TRIANGLES_PER_MESH];
-};
-
-Mesh* meshes;
-Mesh* cars;
-
-struct light {
-	glm::vec4 pos;
-	glm::vec4 color;
-	float radius;
-	float brightness;
-	float junk1;
-	float junk2;
-};
-
-GLuint trianglesCompToFrag;
-int trianglesCompToFragSize = sizeof(Mesh) * MAX_MESHES;
-
-GLuint triangleObjToComp;
-int triangleObjToCompSize = sizeof(Mesh) * MAX_MESHES;
+#include "Scene.h"
+#include "BVH.h"
+#include "CpuTracer.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "ProgramCache.h"
+#include "FrameTimer.h"
+#include "ObjLoader.h"
+#include "Simplify.h"
+#include "CarStreamer.h"
+#include "Wavefront.h"
+#include "Main.h"
+#include "Benchmarks.h"
+
+// Every mesh that can be in the scene, see FLOOR_MESH and the
+// others in Main.h for which mesh is which
+std::vector<Mesh> meshes;
+
+// How selectLods picks the LODs, the LOD benchmark changes these
+LodSettings lodSettings;
+
+// How many cars are in ../Assets/carsHigh (1.3Dobj, 2.3Dobj, ...), see countCars
+int numCars = 0;
+
+// How many triangles and vertices every car slot has room for, as many as
+// the biggest car of the catalog has. init() sets them with sizeCarSlots,
+// the CPU renderer never streams cars, so they stay 0 there.
+int carSlotTriangles = 0;
+int carSlotVertices = 0;
+
+// Which instance in the instance table is the car (see initInstances)
+#define CAR_INSTANCE 2
+
+// Where the vertices of each mesh are in vertexObjToComp, and where
+// its triangles are in indexToFrag. Both have every mesh in them,
+// one mesh after another.
+std::vector<MeshRange> meshRanges;
+
+GLuint meshRangeBuffer;
+
+// Every instance has its own copy of its mesh's vertices in here, in world
+// space. It is made big enough for the biggest car in init(), so it never
+// needs to grow when the car changes. The indices are not copied, every
+// instance uses the indices of its mesh, counting from its own firstVertex.
+GLuint verticesCompToFrag;
+int verticesCompToFragSize = 0;
+
+GLuint vertexObjToComp;
+int vertexObjToCompSize = 0;
+
+// 3 indices for every triangle of every mesh, they never change
+GLuint indexToFrag;
+int indexToFragSize = 0;
+
+// The TrianglePositions of every mesh, in the same order as indexToFrag.
+// The rays only read these, and only read the vertices of the triangle
+// that they hit. Without TWO_LEVEL_BVH, every instance gets its own copy
+// in world space in positionsCompToFrag, like verticesCompToFrag.
+GLuint positionObjToComp;
+int positionObjToCompSize = 0;
+
+GLuint positionsCompToFrag;
+int positionsCompToFragSize = 0;
 
 GLuint lightToFrag;
 int lightToFragSize = sizeof(light) * MAX_LIGHTS;
 
+// The matrices from calcMatrices, NUM_MATRICES of them
 GLuint matrixBuffer;
-int matrixBufferSize = sizeof(glm::mat4x4) * MAX_MESHES;
+int matrixBufferSize = sizeof(glm::mat4x4) * NUM_MATRICES;
+
+// The BVH of every mesh, given to the fragment shader in these two buffers.
+// With TWO_LEVEL_BVH, the trees of the meshes (and every car) are built once
+// in init(), and only the top level tree is rebuilt every frame.
+// Without it, every tree is refit around the moved triangles by Refit.glsl,
+// and only rebuilt when it gets too slow, or an instance changes its mesh.
+SceneBVH sceneBVH;
+GLuint bvhNodeBuffer;
+GLuint bvhTriangleBuffer;
+int bvhNodeBufferSize;
+int bvhTriangleBufferSize;
+
+// The instance table, which mesh, matrix, and texture every
+// instance in the scene uses, and where it is in the world
+std::vector<Instance> instances;
+GLuint instanceBuffer;
+
+// The instances near every light, which its shadow rays go through,
+// made every frame by calcLightMasks
+ShadowCasters shadowCasters;
+
+// The world space box around every instance, made by the compute shader
+GLuint meshBoundsBuffer;
+
+// Number of vertices, and triangles, in every instance put together.
+// The compute shader only moves the instances that moved (see
+// calcTransformJobs), but there is room for all of them.
+int numInstanceVertices = 0;
+int numInstanceTriangles = 0;
+
+// The instances that Compute.glsl moves this frame, one TransformJob
+// each, and the buffer that it reads them from
+std::vector<TransformJob> transformJobs;
+GLuint transformJobBuffer;
+
+// What every instance was last moved with, see MovedInstance
+std::vector<MovedInstance> movedInstances;
+
+// How many threads are in one group of Refit.glsl
+#define REFIT_GROUP_SIZE 64
+
+// Without TWO_LEVEL_BVH, while every instance keeps its mesh, the trees are
+// only refit by Refit.glsl, and only built again when they get too slow
+// (see BVH.h). These are the nodes that it refits, one level after another,
+// and where each level starts (see listRefitNodes), the cost of every
+// node, and the cost of every tree that it works out on the way up.
+std::vector<RefitNode> refitNodes;
+std::vector<int> refitLevelStart;
+GLuint refitNodeBuffer;
+GLuint nodeCostBuffer;
+GLuint treeCostBuffer;
+
+// A copy of treeCostBuffer, that the CPU reads, and the fence that is set
+// after the copy. It is only read once the GPU is done with the copy, so
+// reading it never waits for the GPU.
+GLuint treeCostReadBuffer;
+GLsync refitFence = 0;
+
+// How many times the trees were built, and refit
+int numBvhBuilds = 0;
+int numBvhRefits = 0;
 
 // This is your reference to your shader program.
 // This will be assigned with glCreateProgram().
 // This program will run on your GPU.
 GLuint draw_program;
 GLuint transform_program;
+GLuint refit_program;
+
+// 1 to trace the rays in a compute shader, one group of threads for every
+// TRACE_TILE_SIZE x TRACE_TILE_SIZE tile of pixels, into traceImage, which
+// is then copied to the screen. 0 to trace them in the fragment shader of
+// a full screen draw. Both are FragmentShader.glsl, with a different main(),
+// and draw the same picture. Which one is faster depends on the GPU, time
+// both with "-timings" (see FrameTimer.h) before changing it.
+// The tile size has to be a power of 2, 16 at most (see main() in the shader).
+#define COMPUTE_TRACE 0
+#define TRACE_TILE_SIZE 8
+
+// draw_program writes every pixel into traceImage, with an image store in
+// COMPUTE_TRACE, or by drawing into traceFramebuffer otherwise, and
+// traceFramebuffer is how glBlitFramebuffer reads it
+GLuint traceImage = 0;
+GLuint traceFramebuffer = 0;
+
+// 1 to trace the rays in a few small compute passes, that hand the rays to each
+// other through queues (see Wavefront.h), instead of in one big shader. It draws
+// the same picture into traceImage, and COMPUTE_TRACE doesn't matter when this is 1.
+// Time it with "-timings" against the others before changing it, like COMPUTE_TRACE.
+#define WAVEFRONT_TRACE 0
+
+// One pass of WAVEFRONT_TRACE, FragmentShader.glsl compiled with its WAVEFRONT_STAGE,
+// and where its uniforms are. The passes don't all use every uniform, and
+// glProgramUniform skips the ones that a pass doesn't have (they are -1).
+struct WavefrontPass
+{
+	GLuint program = 0;
+	GLuint shader = 0;
+
+	GLint eye;
+	GLint ray00;
+	GLint ray01;
+	GLint ray10;
+	GLint ray11;
+	GLint screenSize;
+	GLint bvhRoot;
+	GLint topLevelRoot;
+	GLint shadowRoot;
+	GLint numShadowCasters;
+	GLint shadowCasters;
+	std::vector<GLint> textures;
+};
+
+// wavefrontPasses[WAVEFRONT_GENERATE - 1] is the first pass, and so on
+WavefrontPass wavefrontPasses[NUM_WAVEFRONT_PASSES];
+
+// The queues, with room for one entry for every pixel (MAX_LIGHTS
+// for every pixel in the shadow queue), how many entries are
+// in each one (NUM_WAVEFRONT_QUEUES WavefrontQueueCounts), and the colors
+// that every pixel adds up (3 uints for every pixel)
+GLuint rayQueueBuffer = 0;
+GLuint hitQueueBuffer = 0;
+GLuint shadowQueueBuffer = 0;
+GLuint queueCountBuffer = 0;
+GLuint pixelColorBuffer = 0;
 
 // These are your references to your actual compiled shaders
 GLuint vertex_shader;
 GLuint fragment_shader;
 GLuint compute_shader;
+GLuint refit_shader;
 
 // These are your uniform variables.
 GLuint eye_loc;		// Specifies where cameraPos is in the GLSL shader
@@ -102,12 +252,37 @@ GLuint ray00;
 GLuint ray01;
 GLuint ray10;
 GLuint ray11;
+GLuint bvh_root_loc;
+GLuint top_level_root_loc;
+GLuint shadow_root_loc;
+GLuint num_shadow_casters_loc;
+GLuint shadow_casters_loc;
+
+// In Compute.glsl, threads before numJobVertices move vertices, the rest move triangles
+GLuint num_job_vertices_loc;
+GLuint num_jobs_loc;
+GLuint num_job_threads_loc;
+
+// In Refit.glsl, the level of the trees that one dispatch refits
+GLuint refit_level_start_loc;
+GLuint refit_level_count_loc;
 
 // texture information
-GLuint tex_loc[MAX_MESHES];
-GLuint m_texture[MAX_TEXTURES];
+std::vector<GLuint> tex_loc;
+std::vector<GLuint> m_texture;
 GLuint sampler = 0;
 
+// The file of every texture, textureTest[i] in the shader is textureFileNames[i]
+const char* textureFileNames[NUM_TEXTURES] =
+{
+	"../Assets/road.png",
+	"../Assets/CarColor.png",
+	"../Assets/night1.png",
+};
+
+// The textures after they are decoded, before they are given to OpenGL
+std::vector<CpuTexture> textureImages;
+
 // A variable used to describe the position of the camera.
 glm::vec3 cameraPos;
 
@@ -120,11 +295,75 @@ int totalFrame = 0;
 double dtime = 0.0;
 double timebase = 0.0;
 double totalTime = 0.0;
-int fps = 0;
+double fps = 0.0;
+
+// Press space to stop the animation, and again to start it where it
+// stopped. pausedAt is when it stopped, and pausedFor is how long it
+// has been stopped for in total, so the animation never jumps ahead.
+bool paused = false;
+double pausedAt = 0.0;
+double pausedFor = 0.0;
+
+// sceneVersion counts up every time something that the picture depends on
+// changes (see uploadChanged), and tracedVersion is the sceneVersion that
+// traceImage was last traced with. When they are the same, the frame would
+// come out exactly like the last one, so traceImage is shown again instead.
+unsigned int sceneVersion = 1;
+unsigned int tracedVersion = 0;
+
+// What was last sent to instanceBuffer, matrixBuffer, and lightToFrag, and
+// the camera rays draw_program has, so only what changed is sent again
+std::vector<Instance> uploadedInstances;
+std::vector<glm::mat4x4> uploadedMatrices;
+std::vector<light> uploadedLights;
+CameraRays uploadedCamera;
+
+// Times every pass of every frame, on the CPU and on the GPU
+FrameTimer frameTimer;
+
+// How many samples frameTimer had when the window title was last changed,
+// so the title only shows the frames since then
+int titleFrameSample = 0;
+int titleTraceSample = 0;
+
+// Run with "-timings" to save the frame times into this .csv file at the
+// end, and, if timedFrames isn't 0, close the window after that many frames
+const char* timingsPath = nullptr;
+int timedFrames = 0;
 
 double carTimer = 0.0;
 int carIndex = -1;
 
+// Loads the cars that come next, on its own thread
+CarStreamer carStreamer;
+
+// Which car slot the car instance shows
+int visibleCarSlot = 0;
+
+// Where the tree of every LOD of each car slot starts in bvhNodeBuffer
+// and bvhTriangleBuffer, there is room for the biggest tree a car
+// in the slot can have after that (only used with TWO_LEVEL_BVH)
+int carSlotFirstNode[NUM_CAR_SLOTS][NUM_LODS];
+int carSlotFirstTriangle[NUM_CAR_SLOTS][NUM_LODS];
+
+// The next car goes through this buffer on its way to its car slot.
+// It is mapped once, in init(), and stays mapped, so the car is put
+// in it with a memcpy, and the GPU copies it from there to the slot.
+GLuint stagingBuffer;
+unsigned char* stagingMemory = nullptr;
+int stagingBufferSize = 0;
+
+// A car that the GPU is copying from stagingBuffer into a car slot.
+// The fence is signaled when the GPU is done with the copies.
+struct CarUpload
+{
+	StreamedCar* car = nullptr;
+	int slot = 0;
+	GLsync fence = nullptr;
+};
+
+CarUpload carUpload;
+
 int width = 640;
 int height = 360;
 int videoFPS = 60;
@@ -136,7 +375,7 @@ int videoFPS = 60;
 // Then it takes a float defining the verticle field of view angle. It also takes a float defining the ratio of the screen (in this case, 800/600 pixels).
 // The last four parameters are actually just variables for this function to output data into. They should be pointers to pre-defined vec4 variables.
 // For a visual reference, see this image: https://camo.githubusercontent.com/21a84a8b21d6a4bc98b9992e8eaeb7d7acb1185d/687474703a2f2f63646e2e6c776a676c2e6f72672f7475746f7269616c732f3134313230385f676c736c5f636f6d707574652f726179696e746572706f6c6174696f6e2e706e67
-void calcCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, float ratio)
+CameraRays getCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, float ratio)
 {
 	// Grab a ray from the camera position toward where the camera is to be centered on.
 	glm::vec3 centerRay = center - eye;
@@ -165,82 +404,32 @@ void calcCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, fl
 	glm::vec4 r10 = glm::vec4(centerRay, 1.0f) * glm::rotate(glm::mat4(), glm::radians(fov * ratio / 2.0f), v) * glm::rotate(glm::mat4(), glm::radians(fov / 2.0f), glm::vec3(uRotateRight));
 	glm::vec4 r11 = glm::vec4(centerRay, 1.0f) * glm::rotate(glm::mat4(), glm::radians(fov * ratio / 2.0f), v) * glm::rotate(glm::mat4(), glm::radians(-fov / 2.0f), glm::vec3(uRotateRight));
 
-	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
-	glUniform3f(eye_loc, eye.x, eye.y, eye.z);
-	glUniform3f(ray00, r00.x, r00.y, r00.z);
-	glUniform3f(ray01, r01.x, r01.y, r01.z);
-	glUniform3f(ray10, r10.x, r10.y, r10.z);
-	glUniform3f(ray11, r11.x, r11.y, r11.z);
+	CameraRays cam;
+	cam.eye = eye;
+	cam.r00 = glm::vec3(r00);
+	cam.r01 = glm::vec3(r01);
+	cam.r10 = glm::vec3(r10);
+	cam.r11 = glm::vec3(r11);
+	return cam;
 }
 
-// This function runs every frame
-void renderScene()
+// Gives the rays from getCameraRays to the fragment shader
+void setCameraUniforms(const CameraRays& cam)
 {
-	// Used for FPS
-	dtime = glfwGetTime();
-	totalTime = dtime;
-
-	// Every second, basically.
-	if (dtime - timebase > 1 || carIndex == -1)
-	{
-		// default value
-		fps = 0;
-
-		// change when possible
-		if ((int)(dtime - timebase) != 0)
-		{
-			// Calculate the FPS and set the window title to display it.
-			fps = tempFrame / (int)(dtime - timebase);
-			timebase = dtime;
-			tempFrame = 0;
-		}
-
-		// change window title
-		std::string s = "FPS: " + std::to_string(fps);
-		glfwSetWindowTitle(window, s.c_str());
-
-		// change the car
-		carIndex++;
-		if (carIndex > 15) // 0-15 = 1-16
-			carIndex = 0;
-
-		memcpy(&meshes[2], &cars[carIndex], sizeof(Mesh));
-
-		printf("%d\n", carIndex);
-
-		// This sends our OBJ data to the Compute Shader
-		// This data will be constant, and it will never be modified
-		glGenBuffers(1, &triangleObjToComp);
-		glBindBuffer(GL_UNIFORM_BUFFER, triangleObjToComp);
-		glBufferData(GL_UNIFORM_BUFFER, triangleObjToCompSize, meshes, GL_STATIC_DRAW); // static because CPU won't touch it
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-		// This sends our OBJ data to the Fragment Shader
-		// Some of this data will not be modified, like the number
-		// of triangles per mesh, and the color of each mesh, but
-		// the vertices will be modified and overwritten by the 
-		// compute shader, then send the modifications to the fragment shader
-		glGenBuffers(1, &trianglesCompToFrag);
-		glBindBuffer(GL_UNIFORM_BUFFER, trianglesCompToFrag);
-		glBufferData(GL_UNIFORM_BUFFER, trianglesCompToFragSize, meshes, GL_STATIC_DRAW); // static because CPU won't touch it
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	}
-
-	// set camera position
-	cameraPos = glm::vec3(
-		0.0f,
-		5.0f,
-		10.0f
-	);
-
-	// This is a game tutorial, os it must be real-time
-	float time = (float)totalTime;
-
-	// start using transform program
-	glUseProgram(transform_program);
+	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
+	glUniform3f(eye_loc, cam.eye.x, cam.eye.y, cam.eye.z);
+	glUniform3f(ray00, cam.r00.x, cam.r00.y, cam.r00.z);
+	glUniform3f(ray01, cam.r01.x, cam.r01.y, cam.r01.z);
+	glUniform3f(ray10, cam.r10.x, cam.r10.y, cam.r10.z);
+	glUniform3f(ray11, cam.r11.x, cam.r11.y, cam.r11.z);
+}
 
-	glm::mat4x4 test[MAX_MESHES];
-	
+// This builds the model matrix of every instance in the scene,
+// for a given time (in seconds) since the program started.
+// The GPU renderer and the CPU renderer both use this,
+// so that both of them animate the scene the same way.
+void calcMatrices(float time, glm::vec3 cameraPos, glm::mat4x4* test)
+{
 	// scale the floor
 	test[0] = glm::mat4();
 	test[0] = glm::translate(test[0],glm::vec3(0, -0.5, 0));
@@ -292,299 +481,1943 @@ void renderScene()
 
 		test[3 + i] = glm::rotate(test[3 + i], time * 3, glm::vec3(1, 0, 0));
 	}
+}
 
-	glBindBuffer(GL_UNIFORM_BUFFER, matrixBuffer);
-	glBufferData(GL_UNIFORM_BUFFER, matrixBufferSize, test, GL_DYNAMIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, trianglesCompToFrag);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, triangleObjToComp);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, matrixBuffer);
-	glDispatchCompute(NUM_TRIANGLES_IN_SCENE, 1, 1);
-
-	//=================================================================
-
-	// start using draw program
-	glUseProgram(draw_program);
-
-	light lights[MAX_LIGHTS];
-
+// This fills in all the lights in the scene
+void calcLights(light* lights)
+{
 	// white light
 	lights[0].color = glm::vec4(1.0, 1.0, 1.0, 0.0);
 	lights[0].radius = 10;
 	lights[0].brightness = 1;
 
 	lights[0].pos = glm::vec4(0, 3, 3, 0);
+}
 
-	glBindBuffer(GL_UNIFORM_BUFFER, lightToFrag); // 'lights' is a pointer
-	glBufferData(GL_UNIFORM_BUFFER, lightToFragSize, lights, GL_DYNAMIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+// The biggest scale of the matrix (the longest of its x, y and z axes), so a
+// sphere around a mesh, times this, is always around the moved mesh too
+float maxScale(const glm::mat4x4& matrix)
+{
+	return glm::max(glm::length(glm::vec3(matrix[0])), glm::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+}
+
+// Gives every instance that can cast a shadow the INSTANCE_MASK_LIGHT bit of
+// every light it can cast a shadow from, and lists it in "casters" under those
+// lights. A point farther from a light than its radius gets no light, so no
+// shadow ray is traced for it, and every shadow ray stays inside the light's
+// sphere. An instance can only be in the way if the sphere around it touches
+// the light's sphere. The shadow rays of a light only go through its list
+// (or its top level tree, made from the list by buildTopLevelBVH), so what
+// they cost depends on how many instances are near the light, and the
+// instances far away from it are never looked at.
+void calcLightMasks(const light* lights, int numLights, std::vector<Instance>& instances, ShadowCasters& casters)
+{
+	int numInstances = (int)instances.size();
 
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, trianglesCompToFrag);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightToFrag);
+	casters.instances.resize(MAX_LIGHTS * numInstances);
 
-	// Call the function we created to calculate the corner rays.
-	// We use the camera position, the focus position, and the up direction (just like glm::lookAt)
-	// We use Field of View, and aspect ratio (just like glm::perspective)
-	calcCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 45.0f, (float)width / height);
+	for (int l = 0; l < MAX_LIGHTS; l++)
+		casters.count[l] = 0;
 
-	// Give Template texture to quad
-	glUniform1i(tex_loc[0], m_texture[0]);
+	for (int i = 0; i < numInstances; i++)
+	{
+		Instance& inst = instances[i];
 
-	// Give skybox texture to cube
-	glUniform1i(tex_loc[1], m_texture[2]);
+		for (int l = 0; l < numLights; l++)
+			inst.mask &= ~INSTANCE_MASK_LIGHT(l);
 
-	// Give Car texture to car
-	glUniform1i(tex_loc[2], m_texture[1]);
+		// Only the instances that shadow rays can hit
+		if ((inst.mask & INSTANCE_MASK_SHADOW) == 0)
+			continue;
 
-	// Give Car texture to wheel
-	for(int i = 0; i < 4; i++)
-		glUniform1i(tex_loc[3+i], m_texture[1]);
+		const glm::mat4x4& matrix = inst.objectToWorld;
 
-	// Draw an image on the screen
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		float scale = maxScale(matrix);
 
-	// help us keep track of FPS
-	tempFrame++;
-	totalFrame++;
+		// The camera rays and the shadow rays can see different LODs, and a
+		// LOD doesn't always fit in the sphere of another one, so the sphere
+		// of the camera LOD grows until the shadow LOD's sphere fits in it too
+		const Mesh& mesh = meshes[inst.mesh];
+		const Mesh& shadowMesh = meshes[inst.shadowMesh];
+
+		glm::vec3 center = glm::vec3(matrix * glm::vec4(mesh.boundsCenter, 1.0f));
+		glm::vec3 shadowCenter = glm::vec3(matrix * glm::vec4(shadowMesh.boundsCenter, 1.0f));
+		float radius = glm::max(mesh.boundsRadius * scale, glm::length(shadowCenter - center) + shadowMesh.boundsRadius * scale);
+
+		for (int l = 0; l < numLights; l++)
+		{
+			if (glm::length(center - glm::vec3(lights[l].pos)) <= lights[l].radius + radius)
+			{
+				inst.mask |= INSTANCE_MASK_LIGHT(l);
+				casters.instances[l * numInstances + casters.count[l]++] = i;
+			}
+		}
+	}
 }
 
-// This method reads the text from a file.
-// Realistically, we wouldn't want plain text shaders hardcoded in, we'd rather read them in from a separate file so that the shader code is separated.
-std::string readShader(std::string fileName)
+// How many LODs "mesh" has, counting LOD 0
+int numLods(int mesh)
 {
-	std::string shaderCode;
-	std::string line;
+	return mesh < WHEEL_MESH ? 1 : NUM_LODS;
+}
 
-	// We choose ifstream and std::ios::in because we are opening the file for input into our program.
-	// If we were writing to the file, we would use ofstream and std::ios::out.
-	std::ifstream file(fileName, std::ios::binary);
+// Which mesh is LOD "lod" of "mesh", LOD 0 is the mesh itself
+int meshLod(int mesh, int lod)
+{
+	if (lod == 0 || mesh < WHEEL_MESH)
+		return mesh;
 
-	// This checks to make sure that we didn't encounter any errors when getting the file.
-	if (!file.good())
+	return FIRST_LOD_MESH + (mesh - WHEEL_MESH) * (NUM_LODS - 1) + lod - 1;
+}
+
+// The other way around from meshLod, which mesh meshes[mesh]
+// is a LOD of, and which LOD of it it is
+int lodOf(int mesh, int* lod)
+{
+	if (mesh < FIRST_LOD_MESH)
 	{
-		std::cout << "Can't read file: " << fileName.data() << std::endl;
+		*lod = 0;
+		return mesh;
+	}
 
-		// Return so we don't error out.
-		return "";
+	*lod = (mesh - FIRST_LOD_MESH) % (NUM_LODS - 1) + 1;
+	return WHEEL_MESH + (mesh - FIRST_LOD_MESH) / (NUM_LODS - 1);
+}
+
+// True if meshes[mesh] is one of the car slots, or a LOD of one
+bool isCarSlot(int mesh)
+{
+	int lod;
+	mesh = lodOf(mesh, &lod);
+
+	return mesh >= FIRST_CAR_MESH && mesh < FIRST_CAR_MESH + NUM_CAR_SLOTS;
+}
+
+// This puts the meshes one after another, and writes where each mesh
+// starts, and how many triangles and vertices it has, into "ranges".
+// Returns how many triangles there are in total, and writes how many
+// vertices there are to "numVertices". The GPU gets the meshes this way,
+// so the buffers are exactly as big as the meshes, instead of having
+// room for the biggest mesh in every mesh. Only the car slots have
+// room for a bigger car than the one that is in them.
+int packMeshes(const std::vector<Mesh>& meshes, std::vector<MeshRange>& ranges, int* numVertices)
+{
+	int total = 0;
+	int totalVertices = 0;
+	ranges.resize(meshes.size());
+
+	for (int i = 0; i < (int)meshes.size(); i++)
+	{
+		ranges[i].firstTriangle = total;
+		ranges[i].numTriangles = meshes[i].numTriangles;
+		ranges[i].firstVertex = totalVertices;
+		ranges[i].numVertices = meshes[i].numVertices;
+
+		// A car slot gets room for any car that
+		// can be streamed into it later
+		if (isCarSlot(i))
+		{
+			total += glm::max(meshes[i].numTriangles, carSlotTriangles);
+			totalVertices += glm::max(meshes[i].numVertices, carSlotVertices);
+		}
+		else
+		{
+			total += meshes[i].numTriangles;
+			totalVertices += meshes[i].numVertices;
+		}
 	}
 
-	// Get size of file
-	file.seekg(0, std::ios::end);					
-	shaderCode.resize((unsigned int)file.tellg());	
-	file.seekg(0, std::ios::beg);					
+	*numVertices = totalVertices;
+	return total;
+}
 
-	// Dump the file into our array
-	file.read(&shaderCode[0], shaderCode.size());
+// Points every instance at the indices of its mesh in indexToFrag.
+// When TWO_LEVEL_BVH is 0, the compute shader gives every instance its own
+// copy of its mesh's vertices and triangle positions in world space. This
+// decides where each copy starts in verticesCompToFrag and positionsCompToFrag,
+// and returns how many vertices there are in total. The number of triangles
+// in total is written to "numTriangles".
+int calcInstanceOffsets(const std::vector<MeshRange>& ranges, std::vector<Instance>& instances, int* numTriangles)
+{
+	int total = 0;
+	int totalTriangles = 0;
 
-	// close the file
-	file.close();
+	for (int i = 0; i < (int)instances.size(); i++)
+	{
+		const MeshRange& range = ranges[instances[i].mesh];
+
+		instances[i].firstIndex = 3 * range.firstTriangle;
+#if TWO_LEVEL_BVH
+		instances[i].firstTriangle = range.firstTriangle;
+		instances[i].firstVertex = range.firstVertex;
+		instances[i].shadowFirstTriangle = ranges[instances[i].shadowMesh].firstTriangle;
+#else
+		instances[i].firstTriangle = totalTriangles;
+		instances[i].firstVertex = total;
+		instances[i].shadowFirstTriangle = totalTriangles;
+#endif
+		total += range.numVertices;
+		totalTriangles += range.numTriangles;
+	}
 
-	return shaderCode;
+	*numTriangles = totalTriangles;
+	return total;
 }
 
-// This method will consolidate some of the shader code we've written to return a GLuint to the compiled shader.
-// It only requires the shader source code and the shader type.
-GLuint createShader(std::string sourceCode, GLenum shaderType)
+// Makes a TransformJob for every instance that has to be moved again, because
+// its matrix, its mesh, or where its world space copy goes, changed since the
+// last time (see MovedInstance), and remembers what it was moved with in
+// "moved". The jobs get the vertices and triangles of all the jobs before them
+// added up, so the compute shader can find the job of every thread. Returns
+// how many vertices the jobs have, and writes how many triangles they have
+// to "numTriangles". When "moved" is empty, every instance is moved.
+int calcTransformJobs(const std::vector<MeshRange>& ranges, const std::vector<Instance>& instances,
+	std::vector<MovedInstance>& moved, std::vector<TransformJob>& jobs, int* numTriangles)
 {
-	// glCreateShader, creates a shader given a type (such as GL_VERTEX_SHADER) and returns a GLuint reference to that shader.
-	GLuint shader = glCreateShader(shaderType);
-	const char *shader_code_ptr = sourceCode.c_str(); // We establish a pointer to our shader code string
-	const int shader_code_size = sourceCode.size();   // And we get the size of that string.
+	bool all = moved.size() != instances.size();
 
-	// glShaderSource replaces the source code in a shader object
-	// It takes the reference to the shader (a GLuint), a count of the number of elements in the string array (in case you're passing in multiple strings), a pointer to the string array
-	// that contains your source code, and a size variable determining the length of the array.
-	glShaderSource(shader, 1, &shader_code_ptr, &shader_code_size);
-	glCompileShader(shader); // This just compiles the shader, given the source code.
+	if (all)
+		moved.resize(instances.size());
 
-	GLint isCompiled = 0;
+	jobs.clear();
 
-	// Check the compile status to see if the shader compiled correctly.
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+	int total = 0;
+	int totalTriangles = 0;
 
-	if (isCompiled == GL_FALSE)
+	for (int i = 0; i < (int)instances.size(); i++)
 	{
-		char infolog[1024];
-		glGetShaderInfoLog(shader, 1024, NULL, infolog);
+		MovedInstance now;
+		now.objectToWorld = instances[i].objectToWorld;
+		now.mesh = instances[i].mesh;
+		now.range = ranges[instances[i].mesh];
+		now.firstVertex = instances[i].firstVertex;
+		now.firstTriangle = instances[i].firstTriangle;
+
+		// Nothing in a MovedInstance needs padding, so
+		// the bytes can be compared, even the floats
+		if (!all && memcmp(&now, &moved[i], sizeof(MovedInstance)) == 0)
+			continue;
+
+		moved[i] = now;
+
+		TransformJob job;
+		job.instance = i;
+		job.firstVertex = total;
+		job.firstTriangle = totalTriangles;
+		job.junk1 = 0;
+		jobs.push_back(job);
+
+		total += now.range.numVertices;
+		totalTriangles += now.range.numTriangles;
+	}
 
-		if (shaderType == GL_VERTEX_SHADER)
-			printf("Vertex Shader\n");
+	*numTriangles = totalTriangles;
+	return total;
+}
 
-		if (shaderType == GL_FRAGMENT_SHADER)
-			printf("Fragment Shader\n");
+// This builds the tree of every mesh, and every car slot, in object space.
+// Nothing in the trees depends on where the meshes are, so this only
+// needs to happen once, after the meshes are loaded. The tree of a car
+// that is streamed in later is built by the CarStreamer, and copied
+// into the room that is left here for the tree of its car slot.
+void buildBottomLevelBVH()
+{
+	sceneBVH.nodes.clear();
+	sceneBVH.triangles.clear();
 
-		if (shaderType == GL_COMPUTE_SHADER)
-			printf("Compute Shader\n");
+	sceneBVH.root.resize(meshes.size());
 
-		// Print the compile error.
-		std::cout << "The shader failed to compile with the error:" << std::endl << infolog << std::endl;
+	for (int i = 0; i < (int)meshes.size(); i++)
+	{
+		int firstNode = (int)sceneBVH.nodes.size();
+		int firstTriangle = (int)sceneBVH.triangles.size();
 
-		// Provide the infolog in whatever manor you deem best.
-		// Exit with failure.
-		glDeleteShader(shader); // Don't leak the shader.
+		sceneBVH.root[i] = buildMeshBVH(meshes[i], glm::mat4(), sceneBVH);
 
-		// NOTE: I almost always put a break point here, so that instead of the program continuing with a deleted/failed shader, it stops and gives me a chance to look at what may
-		// have gone wrong. You can check the console output to see what the error was, and usually that will point you in the right direction.
+		if (isCarSlot(i))
+		{
+			int lod;
+			int slot = lodOf(i, &lod) - FIRST_CAR_MESH;
+			carSlotFirstNode[slot][lod] = firstNode;
+			carSlotFirstTriangle[slot][lod] = firstTriangle;
+
+			// A tree never has more than 2 nodes per triangle
+			int numTriangles = glm::max(meshes[i].numTriangles, carSlotTriangles);
+			sceneBVH.nodes.resize(firstNode + 2 * numTriangles);
+			sceneBVH.triangles.resize(firstTriangle + numTriangles);
+
+			sceneBVH.bottomLevelNodes = (int)sceneBVH.nodes.size();
+			sceneBVH.bottomLevelTriangles = (int)sceneBVH.triangles.size();
+		}
 	}
+}
 
-	return shader;
+// This fills in the instance table. Every instance says which mesh it is
+// a copy of, which matrix from calcMatrices moves it, and which texture
+// is on it. The four wheels are four instances of the same wheel mesh,
+// so the wheel's triangles are only loaded, stored, and uploaded once.
+void initInstances(std::vector<Instance>& instances)
+{
+	// mesh, transform, texture
+	int table[][3] =
+	{
+		{ FLOOR_MESH, 0, 0 }, // floor, road texture
+		{ SKYBOX_MESH, 1, 2 }, // skybox, night texture
+		{ FIRST_CAR_MESH, 2, 1 }, // car, car texture (CAR_INSTANCE)
+		{ WHEEL_MESH, 3, 1 }, // front left wheel
+		{ WHEEL_MESH, 4, 1 }, // back left wheel
+		{ WHEEL_MESH, 5, 1 }, // back right wheel
+		{ WHEEL_MESH, 6, 1 }, // front right wheel
+	};
+
+	instances.resize(sizeof(table) / sizeof(table[0]));
+
+	for (int i = 0; i < (int)instances.size(); i++)
+	{
+		instances[i] = Instance();
+		instances[i].model = table[i][0];
+		instances[i].mesh = table[i][0];
+		instances[i].shadowMesh = table[i][0];
+		instances[i].transform = table[i][1];
+		instances[i].texture = table[i][2];
+
+		// Only the car and the tires cast shadows,
+		// the floor and the skybox are only seen
+		if (instances[i].mesh == FLOOR_MESH || instances[i].mesh == SKYBOX_MESH)
+			instances[i].mask = INSTANCE_MASK_CAMERA;
+		else
+			instances[i].mask = INSTANCE_MASK_CAMERA | INSTANCE_MASK_SHADOW;
+	}
 }
 
-void loadOBJ(char* path, Mesh* m)
+// Picks the LOD of every instance for this frame, from how big it is on the
+// screen. The sphere around the instance's model is moved by its matrix from
+// calcMatrices, and looked at from "eye", with the same field of view that
+// getCameraRays uses, "fov" degrees over "screenHeight" pixels. The instance
+// gets the most detailed LOD that has no more than one triangle for every
+// lodSettings.pixelsPerTriangle pixels in the circle that the sphere covers,
+// and its shadow LOD is lodSettings.shadowBias LODs after that.
+void selectLods(const glm::mat4x4* matrices, glm::vec3 eye, float fov, int screenHeight, std::vector<Instance>& instances)
 {
-	// Part 1
-	// Initialize variables and pointers
+	// How many pixels something 1 unit big is, 1 unit away
+	float pixelsPerUnit = screenHeight / (2.0f * tanf(glm::radians(fov) / 2.0f));
 
-	FILE *f = fopen(path, "r");
-	//delete path;
+	for (int i = 0; i < (int)instances.size(); i++)
+	{
+		int model = instances[i].model;
+		int lod = lodSettings.force;
 
-	float x[3];
-	unsigned short y[9];
+		if (lod < 0)
+		{
+			const Mesh& mesh = meshes[model];
+			const glm::mat4x4& matrix = matrices[instances[i].transform];
 
-	std::vector<float>pos;
-	std::vector<float>uvs;
-	std::vector<float>norms;
-	std::vector<unsigned short>faces;
-	char line[100];
+			// The biggest scale of the matrix, so the sphere is never too small
+			float scale = maxScale(matrix);
 
+			glm::vec3 center = glm::vec3(matrix * glm::vec4(mesh.boundsCenter, 1.0f));
+			float radius = mesh.boundsRadius * scale;
+			float distance = glm::length(center - eye);
 
-	// Part 2
-	// Fill vectors for pos, uvs, norms, and faces
+			lod = 0;
 
-	while (fgets(line, sizeof(line), f))
-	{
-		if (sscanf(line, "v %f %f %f", &x[0], &x[1], &x[2]) == 3)
-			for (int i = 0; i < 3; i++)
-				pos.push_back(x[i]);
+			// If the camera is in the sphere, the mesh can cover the whole screen
+			if (distance > radius)
+			{
+				float pixels = radius / distance * pixelsPerUnit;
+				float area = 3.14159265f * pixels * pixels;
 
-		if (sscanf(line, "vt %f %f", &x[0], &x[1]) == 2)
-			for (int i = 0; i < 2; i++)
-				uvs.push_back(x[i]);
+				while (lod + 1 < numLods(model) && meshes[meshLod(model, lod + 1)].numTriangles > 0 &&
+					meshes[meshLod(model, lod)].numTriangles * lodSettings.pixelsPerTriangle > area)
+					lod++;
+			}
+		}
 
-		if (sscanf(line, "vn %f %f %f", &x[0], &x[1], &x[2]) == 3)
-			for (int i = 0; i < 3; i++)
-				norms.push_back(x[i]);
+		lod = glm::min(lod, numLods(model) - 1);
+		int shadowLod = glm::min(lod + lodSettings.shadowBias, numLods(model) - 1);
 
-		if (sscanf(line, "f %hu/%hu/%hu %hu/%hu/%hu %hu/%hu/%hu", &y[0], &y[1], &y[2], &y[3], &y[4], &y[5], &y[6], &y[7], &y[8]) == 9)
-			for (int i = 0; i < 9; i++)
-				faces.push_back(y[i] - 1);
+		instances[i].mesh = meshLod(model, lod);
+		instances[i].shadowMesh = meshLod(model, shadowLod);
 	}
+}
 
+// This moves every instance to where its matrix from calcMatrices says,
+// and points it at the trees of its LODs (only used with TWO_LEVEL_BVH)
+void calcInstances(const glm::mat4x4* matrices, std::vector<Instance>& instances)
+{
+	for (int i = 0; i < (int)instances.size(); i++)
+	{
+		instances[i].objectToWorld = matrices[instances[i].transform];
+		instances[i].worldToObject = glm::inverse(instances[i].objectToWorld);
+
+		// Every LOD's tree is already built, so when the car or the LOD
+		// changes, the instance just points to the tree of its new mesh.
+		// Without TWO_LEVEL_BVH, buildBottomLevelBVH never runs, and
+		// the trees of the instances are found with the bvhRoot uniform
+		if (instances[i].mesh < (int)sceneBVH.root.size())
+		{
+			instances[i].bvhRoot = sceneBVH.root[instances[i].mesh];
+			instances[i].shadowBvhRoot = sceneBVH.root[instances[i].shadowMesh];
+		}
+		else
+		{
+			instances[i].bvhRoot = -1;
+			instances[i].shadowBvhRoot = -1;
+		}
+	}
+}
 
-	// Part 3
-	// Initialize more variables and pointers
+// Sends the elements of "data" that are not the same as in "uploaded" (what was
+// sent the last time) to "buffer", with one glBufferSubData for every run of
+// changed elements next to each other, and keeps them in "uploaded". The first
+// time, or when the count changes, every element is sent. Returns how many
+// elements changed, and if any did, sceneVersion counts up.
+template <typename T>
+int uploadChanged(GLuint buffer, const T* data, int count, std::vector<T>& uploaded)
+{
+	bool all = (int)uploaded.size() != count;
 
-	int numVerts = 3 * (int)faces.size() / 9;
+	if (all)
+		uploaded.assign(data, data + count);
 
-	m->numTriangles = numVerts / 3;
+	int changed = 0;
 
-	// Part 4
-	// Build final Vertex Buffer
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
 
-	// for every triangle
-	for (int i = 0; i < (int)numVerts / 3; i++)
+	for (int i = 0; i < count;)
 	{
-		// for every point
-		for (int j = 0; j < 3; j++)
+		// The structs that are sent have nothing in between their
+		// members, so the bytes can be compared, even the floats
+		if (!all && memcmp(&data[i], &uploaded[i], sizeof(T)) == 0)
 		{
-			// X, Y, and Z
-			for (int k = 0; k < 3; k++)
-			{
-				int coordIndex = 3 * faces[9 * i + 3 * j + 0] + k;
-				m->triangles[i].pos[j][k] = pos[coordIndex];
-			}
+			i++;
+			continue;
+		}
 
-			for (int k = 0; k < 2; k++)
-			{
-				int uvIndex = 2 * faces[9 * i + 3 * j + 1] + k;
-				m->triangles[i].uv[j][k] = uvs[uvIndex];
-			}
+		int end = i + 1;
 
-			for (int k = 0; k < 3; k++)
-			{
-				int normalIndex = 3 * faces[9 * i + 3 * j + 2] + k;
-				m->triangles[i].normal[j][k] = norms[normalIndex];
-			}
+		while (end < count && (all || memcmp(&data[end], &uploaded[end], sizeof(T)) != 0))
+			end++;
 
-			m->triangles[i].pos[j][3] = 1.0f;
-			m->triangles[i].normal[j][3] = 1.0f;
-		}
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(T) * i, sizeof(T) * (end - i), &data[i]);
+		std::copy(data + i, data + end, uploaded.begin() + i);
+
+		changed += end - i;
+		i = end;
 	}
 
-	fclose(f);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	if (changed > 0)
+		sceneVersion++;
 
+	return changed;
 }
 
-void LoadTexture(char* file, int index)
+// Same as floatToOrderedInt in Compute.glsl
+int floatToOrderedInt(float f)
 {
-	// Load the file.
-	FIBITMAP* bitmap = FreeImage_Load(FreeImage_GetFileType(file), file);
-	// Convert the file to 32 bits so we can use it.
-	FIBITMAP* bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
+	int i;
+	memcpy(&i, &f, sizeof(int));
+	return i >= 0 ? i : i ^ 0x7FFFFFFF;
+}
 
-	// Create an OpenGL texture.
-	glGenTextures(1, &m_texture[index]);
-	glActiveTexture(GL_TEXTURE0 + m_texture[index]);
-	glBindTexture(GL_TEXTURE_2D, m_texture[index]);
+// Starts copying the next car into the car slot that is not shown.
+// The car is already loaded (by carStreamer), so this only copies it
+// into stagingBuffer, and tells the GPU to copy it from there into the
+// slot. Nothing here waits, finishCarUpload swaps the car in once the
+// GPU is done. If the next car isn't loaded yet, the old car stays.
+void beginCarUpload()
+{
+	if (carUpload.car != nullptr)
+		return;
 
-	// common parameters for all textures
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	StreamedCar* car = popStreamedCar(carStreamer);
 
-	// make the sampler if it does not exist
-	if (sampler == 0)
-		glGenSamplers(1, &sampler);
+	if (car == nullptr)
+		return;
 
-	// bind the sampler to the texture
-	glBindSampler(m_texture[index], sampler);
+	int slot = (visibleCarSlot + 1) % NUM_CAR_SLOTS;
 
-	// GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT = 34047
-	// GL_TEXTURE_MAX_ANISOTROPY_EXT = 34046
+	// Where everything goes, first in stagingBuffer, then in the slot
+	struct Copy
+	{
+		GLuint buffer;
+		int offset;
+		int size;
+		const void* data;
+	};
 
-	GLfloat maxAnisotropy = 0.0f;
-	glGetFloatv(34047, &maxAnisotropy);
+	std::vector<Copy> copies;
 
-	// Trilinear Mipmapping
-	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glSamplerParameteri(sampler, 34046, (GLint)maxAnisotropy);
+	// Every LOD of the car goes into the same LOD of the slot
+	for (int lod = 0; lod < NUM_LODS; lod++)
+	{
+		const MeshRange& range = meshRanges[meshLod(FIRST_CAR_MESH + slot, lod)];
+		const Mesh& mesh = car->lods[lod];
+
+		copies.push_back({ vertexObjToComp, (int)sizeof(Vertex) * range.firstVertex, (int)sizeof(Vertex) * mesh.numVertices, mesh.vertexData() });
+		copies.push_back({ indexToFrag, 3 * (int)sizeof(unsigned int) * range.firstTriangle, 3 * (int)sizeof(unsigned int) * mesh.numTriangles, mesh.indexData() });
+		copies.push_back({ positionObjToComp, (int)sizeof(TrianglePositions) * range.firstTriangle, (int)sizeof(TrianglePositions) * mesh.numTriangles, mesh.positions.data() });
+
+#if TWO_LEVEL_BVH
+		// The tree of the car was built on its own, starting at node 0 and
+		// triangle 0, so it is moved to where the tree of the slot starts.
+		// The triangles of a leaf count from the start of the mesh, so
+		// only where the children and the leaves start has to change.
+		SceneBVH& bvh = car->bvh[lod];
+		int firstNode = carSlotFirstNode[slot][lod];
+		int firstTriangle = carSlotFirstTriangle[slot][lod];
+
+		for (int i = 0; i < (int)bvh.nodes.size(); i++)
+		{
+			BVHNode& node = bvh.nodes[i];
+			node.leftFirst += node.count == 0 ? firstNode : firstTriangle;
+		}
 
-	// Fill our openGL side texture object.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, FreeImage_GetWidth(bitmap32), FreeImage_GetHeight(bitmap32),
-		0, GL_BGRA, GL_UNSIGNED_BYTE, static_cast<void*>(FreeImage_GetBits(bitmap32)));
-	glGenerateMipmap(GL_TEXTURE_2D);
+		if (car->bvhRoot[lod] >= 0)
+			car->bvhRoot[lod] += firstNode;
 
-	// We can unload the images now that the texture data has been buffered with opengl
-	FreeImage_Unload(bitmap);
-	FreeImage_Unload(bitmap32);
-}
+		copies.push_back({ bvhNodeBuffer, (int)sizeof(BVHNode) * firstNode, (int)sizeof(BVHNode) * (int)bvh.nodes.size(), bvh.nodes.data() });
+		copies.push_back({ bvhTriangleBuffer, (int)sizeof(int) * firstTriangle, (int)sizeof(int) * (int)bvh.triangles.size(), bvh.triangles.data() });
+#endif
+	}
 
-// Initialization code
-void init()
-{
-	glewExperimental = GL_TRUE;
-	// Initializes the glew library
-	glewInit();
+	glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+
+	int stagingOffset = 0;
+
+	for (int i = 0; i < (int)copies.size(); i++)
+	{
+		if (copies[i].size == 0)
+			continue;
+
+		memcpy(stagingMemory + stagingOffset, copies[i].data, copies[i].size);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, copies[i].buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagingOffset, copies[i].offset, copies[i].size);
+
+		stagingOffset += copies[i].size;
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	carUpload.car = car;
+	carUpload.slot = slot;
+	carUpload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Checks if the GPU is done with the copies of beginCarUpload, without
+// waiting for it, and if it is, the car instance shows the new car
+void finishCarUpload()
+{
+	if (carUpload.car == nullptr)
+		return;
+
+	GLenum status = glClientWaitSync(carUpload.fence, 0, 0);
+
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return;
+
+	glDeleteSync(carUpload.fence);
+
+	StreamedCar* car = carUpload.car;
+	int slot = carUpload.slot;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, meshRangeBuffer);
+
+	for (int lod = 0; lod < NUM_LODS; lod++)
+	{
+		int slotMesh = meshLod(FIRST_CAR_MESH + slot, lod);
+
+		meshes[slotMesh] = std::move(car->lods[lod]);
+
+		// The slot stays where it is, only how much of it is used changes
+		meshRanges[slotMesh].numTriangles = meshes[slotMesh].numTriangles;
+		meshRanges[slotMesh].numVertices = meshes[slotMesh].numVertices;
+
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(MeshRange) * slotMesh, sizeof(MeshRange), &meshRanges[slotMesh]);
+
+#if TWO_LEVEL_BVH
+		// Keep the CPU copy of the trees the same as the GPU copy
+		const SceneBVH& bvh = car->bvh[lod];
+		std::copy(bvh.nodes.begin(), bvh.nodes.end(), sceneBVH.nodes.begin() + carSlotFirstNode[slot][lod]);
+		std::copy(bvh.triangles.begin(), bvh.triangles.end(), sceneBVH.triangles.begin() + carSlotFirstTriangle[slot][lod]);
+		sceneBVH.root[slotMesh] = car->bvhRoot[lod];
+#endif
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	sceneVersion++;
+
+	carIndex = car->car;
+	visibleCarSlot = slot;
+
+	printf("%d\n", carIndex);
+
+	// renderScene picks the LOD of the new car, and moves the
+	// instances after it around, like it does every frame
+	instances[CAR_INSTANCE].model = FIRST_CAR_MESH + slot;
+
+	delete car;
+	carUpload = CarUpload();
+}
+
+#if !TWO_LEVEL_BVH
+// Gives back the biggest SAH cost of a tree after the last refit that the
+// GPU is done with, divided by its cost when it was built, or 0 if there
+// is no refit that it is done with yet. It never waits for the GPU, so the
+// cost it gives back can be a few frames old, but the trees only get
+// slower a little at a time, so it is not too late to build them again.
+float refitCostRatio()
+{
+	if (refitFence == 0)
+		return 0.0f;
+
+	GLenum status = glClientWaitSync(refitFence, 0, 0);
+
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return 0.0f;
+
+	glDeleteSync(refitFence);
+	refitFence = 0;
+
+	int numInstances = (int)instances.size();
+	std::vector<float> treeCosts(numInstances);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, treeCostReadBuffer);
+	glGetBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(float) * numInstances, treeCosts.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	float worst = 0.0f;
+
+	for (int i = 0; i < numInstances; i++)
+		if (sceneBVH.root[i] >= 0 && sceneBVH.builtCost[i] > 0.0f)
+			worst = std::max(worst, treeCosts[i] / sceneBVH.builtCost[i]);
+
+	return worst;
+}
+
+// Refits every tree around the triangles that Compute.glsl is moving,
+// with one dispatch of Refit.glsl for every level, the deepest first
+void refitTrees()
+{
+	glUseProgram(refit_program);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, refitNodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nodeCostBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bvhNodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bvhTriangleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, treeCostBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, positionsCompToFrag);
+
+	for (int level = 0; level + 1 < (int)refitLevelStart.size(); level++)
+	{
+		// The first level waits for the triangles, the
+		// others wait for the level before them
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		int count = refitLevelStart[level + 1] - refitLevelStart[level];
+		glUniform1i(refit_level_start_loc, refitLevelStart[level]);
+		glUniform1i(refit_level_count_loc, count);
+		glDispatchCompute((count + REFIT_GROUP_SIZE - 1) / REFIT_GROUP_SIZE, 1, 1);
+	}
+
+	// If the costs of the last refit were read, copy the costs of this one
+	// where refitCostRatio reads them. The refits after this one write
+	// treeCostBuffer again, but not treeCostReadBuffer, so reading it
+	// never waits for them.
+	if (refitFence == 0)
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, treeCostBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, treeCostReadBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(float) * instances.size());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		refitFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+#endif
+
+// Where the glDispatchComputeIndirect numbers of a queue are in queueCountBuffer
+GLintptr queueDispatchOffset(int queue)
+{
+	return queue * sizeof(WavefrontQueueCount) + offsetof(WavefrontQueueCount, numGroupsX);
+}
+
+// Gives one pass of WAVEFRONT_TRACE the camera, the trees, and the textures,
+// the same things renderScene gives draw_program
+void setWavefrontUniforms(const WavefrontPass& pass, const CameraRays& cam)
+{
+	glProgramUniform3f(pass.program, pass.eye, cam.eye.x, cam.eye.y, cam.eye.z);
+	glProgramUniform3f(pass.program, pass.ray00, cam.r00.x, cam.r00.y, cam.r00.z);
+	glProgramUniform3f(pass.program, pass.ray01, cam.r01.x, cam.r01.y, cam.r01.z);
+	glProgramUniform3f(pass.program, pass.ray10, cam.r10.x, cam.r10.y, cam.r10.z);
+	glProgramUniform3f(pass.program, pass.ray11, cam.r11.x, cam.r11.y, cam.r11.z);
+	glProgramUniform2i(pass.program, pass.screenSize, width, height);
+
+#if TWO_LEVEL_BVH
+	glProgramUniform1i(pass.program, pass.topLevelRoot, sceneBVH.topLevelRoot);
+	glProgramUniform1iv(pass.program, pass.shadowRoot, MAX_LIGHTS, sceneBVH.shadowRoot.data());
+#else
+	glProgramUniform1iv(pass.program, pass.bvhRoot, (int)sceneBVH.root.size(), sceneBVH.root.data());
+	glProgramUniform1iv(pass.program, pass.numShadowCasters, MAX_LIGHTS, shadowCasters.count);
+	glProgramUniform1iv(pass.program, pass.shadowCasters, (int)shadowCasters.instances.size(), shadowCasters.instances.data());
+#endif
+
+	for (int i = 0; i < (int)pass.textures.size(); i++)
+		glProgramUniform1i(pass.program, pass.textures[i], m_texture[i]);
+}
+
+// Traces the frame one pass at a time with WAVEFRONT_TRACE (see Wavefront.h),
+// into traceImage. The buffers of the scene have to be
+// bound already, the same way they are for draw_program.
+void traceWavefront(const CameraRays& cam)
+{
+	// Empty every queue. The counts were written by the passes of the
+	// last frame, so wait for them before they are written over.
+	WavefrontQueueCount empty[NUM_WAVEFRONT_QUEUES];
+
+	for (int i = 0; i < NUM_WAVEFRONT_QUEUES; i++)
+		empty[i] = { 0, 0, 1, 1 };
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_UNIFORM_BUFFER, queueCountBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(empty), empty);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, rayQueueBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, hitQueueBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, shadowQueueBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, queueCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, pixelColorBuffer);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queueCountBuffer);
+	glBindImageTexture(0, traceImage, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+	for (int i = 0; i < NUM_WAVEFRONT_PASSES; i++)
+		setWavefrontUniforms(wavefrontPasses[i], cam);
+
+	// Every pass reads the queue that the pass before it wrote,
+	// and the count of that queue says how many groups it needs
+	GLbitfield betweenPasses = GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT;
+
+	// generate and resolve start one group for every tile of the picture
+	int tilesX = (width + WAVEFRONT_TILE_SIZE - 1) / WAVEFRONT_TILE_SIZE;
+	int tilesY = (height + WAVEFRONT_TILE_SIZE - 1) / WAVEFRONT_TILE_SIZE;
+
+	glUseProgram(wavefrontPasses[WAVEFRONT_GENERATE - 1].program);
+	glDispatchCompute(tilesX, tilesY, 1);
+	glMemoryBarrier(betweenPasses);
+
+	glUseProgram(wavefrontPasses[WAVEFRONT_EXTEND - 1].program);
+	glDispatchComputeIndirect(queueDispatchOffset(WAVEFRONT_RAY_QUEUE));
+	glMemoryBarrier(betweenPasses);
+
+	glUseProgram(wavefrontPasses[WAVEFRONT_SHADE - 1].program);
+	glDispatchComputeIndirect(queueDispatchOffset(WAVEFRONT_HIT_QUEUE));
+	glMemoryBarrier(betweenPasses);
+
+	glUseProgram(wavefrontPasses[WAVEFRONT_SHADOW - 1].program);
+	glDispatchComputeIndirect(queueDispatchOffset(WAVEFRONT_SHADOW_QUEUE));
+	glMemoryBarrier(betweenPasses);
+
+	glUseProgram(wavefrontPasses[WAVEFRONT_RESOLVE - 1].program);
+	glDispatchCompute(tilesX, tilesY, 1);
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
+// Copies traceImage to the screen, after whatever traced it is done
+// writing it. It is still there in the next frame, so a frame where
+// nothing changed is only this copy.
+void presentTraceImage()
+{
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, traceFramebuffer);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+// This function runs every frame
+void renderScene()
+{
+	beginTimedFrame(frameTimer);
+	beginPass(frameTimer, PASS_RENDER);
+
+	// If the next car got to the GPU, show it
+	beginPass(frameTimer, PASS_UPLOAD);
+	finishCarUpload();
+	endPass(frameTimer, PASS_UPLOAD);
+
+	// Used for FPS
+	dtime = glfwGetTime();
+	totalTime = dtime;
+
+	// Every second, basically.
+	if (dtime - timebase > 1 || carIndex == -1)
+	{
+		// Calculate the FPS, without rounding it to a whole number
+		if (dtime > timebase)
+		{
+			fps = tempFrame / (dtime - timebase);
+			timebase = dtime;
+			tempFrame = 0;
+		}
+
+		// The FPS is an average, it can't show a frame that was slow,
+		// so the title shows the 99th percentile frame time too, and
+		// how long the trace took on the GPU (see FrameTimer.h)
+		FrameTimeStats frameStats = calcFrameTimeStats(frameTimer.frameSamples, titleFrameSample);
+		FrameTimeStats traceStats = calcFrameTimeStats(frameTimer.gpuSamples[PASS_TRACE], titleTraceSample);
+		titleFrameSample = (int)frameTimer.frameSamples.size();
+		titleTraceSample = (int)frameTimer.gpuSamples[PASS_TRACE].size();
+
+		// change window title
+		char title[256];
+		snprintf(title, sizeof(title), "FPS: %.1f, frame %.2f ms (p99 %.2f ms), trace %.2f ms on the GPU",
+			fps, frameStats.average, frameStats.p99, traceStats.average);
+		glfwSetWindowTitle(window, title);
+
+		// change the car, the first car is already in slot 0
+		// (see loadAssets), every car after it is streamed in
+		if (carIndex == -1)
+		{
+			carIndex = 0;
+			printf("%d\n", carIndex);
+		}
+		else if (!paused)
+		{
+			// the car doesn't change while the animation is paused either
+			beginPass(frameTimer, PASS_UPLOAD);
+			beginCarUpload();
+			endPass(frameTimer, PASS_UPLOAD);
+		}
+	}
+
+	// set camera position
+	cameraPos = glm::vec3(
+		0.0f,
+		5.0f,
+		10.0f
+	);
+
+	// This is a game tutorial, os it must be real-time,
+	// but the time doesn't move while it is paused
+	float time = (float)((paused ? pausedAt : totalTime) - pausedFor);
+
+	glm::mat4x4 test[NUM_MATRICES];
+	calcMatrices(time, cameraPos, test);
+
+	// The LODs can change every frame, and they have different numbers
+	// of vertices, so the copies of the instances after them (and the
+	// number of compute threads, without TWO_LEVEL_BVH) move around
+	selectLods(test, cameraPos, CAMERA_FOV, height, instances);
+	calcInstances(test, instances);
+	numInstanceVertices = calcInstanceOffsets(meshRanges, instances, &numInstanceTriangles);
+
+	// The lights go into the masks of the instances, so before they are sent
+	light lights[MAX_LIGHTS];
+	calcLights(lights);
+	calcLightMasks(lights, MAX_LIGHTS, instances, shadowCasters);
+
+	// Only the instances that changed are sent, the floor
+	// and the skybox are usually the same as last frame
+	beginPass(frameTimer, PASS_UPLOAD);
+	bool instancesChanged = uploadChanged(instanceBuffer, instances.data(), (int)instances.size(), uploadedInstances) > 0;
+	endPass(frameTimer, PASS_UPLOAD);
+
+	// If the trees are built again, draw_program needs to know where they start
+	bool treeChanged = false;
+
+#if TWO_LEVEL_BVH
+	// The triangles stay where they are, the rays move instead,
+	// so the compute shader has nothing to do. Only the small
+	// trees over the instances are built again, at the end of
+	// the trees of the meshes that are already on the GPU,
+	// and only if an instance moved.
+	if (instancesChanged)
+	{
+		beginPass(frameTimer, PASS_BVH);
+		buildTopLevelBVH(instances.data(), (int)instances.size(), shadowCasters, sceneBVH);
+		endPass(frameTimer, PASS_BVH);
+
+		beginPass(frameTimer, PASS_UPLOAD);
+		glBindBuffer(GL_UNIFORM_BUFFER, bvhNodeBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(BVHNode) * sceneBVH.bottomLevelNodes,
+			sizeof(BVHNode) * (sceneBVH.nodes.size() - sceneBVH.bottomLevelNodes), &sceneBVH.nodes[sceneBVH.bottomLevelNodes]);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, bvhTriangleBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(int) * sceneBVH.bottomLevelTriangles,
+			sizeof(int) * (sceneBVH.triangles.size() - sceneBVH.bottomLevelTriangles), &sceneBVH.triangles[sceneBVH.bottomLevelTriangles]);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		endPass(frameTimer, PASS_UPLOAD);
+
+		treeChanged = true;
+	}
+#else
+	// start using transform program
+	glUseProgram(transform_program);
+
+	// Only the matrices that changed are sent
+	beginPass(frameTimer, PASS_UPLOAD);
+	uploadChanged(matrixBuffer, test, NUM_MATRICES, uploadedMatrices);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, verticesCompToFrag);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vertexObjToComp);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, indexToFrag);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, positionsCompToFrag);
+
+	// Only the instances that moved are moved again, the world space
+	// copies of the others are still in the buffers from before
+	int numJobTriangles = 0;
+	int numJobVertices = calcTransformJobs(meshRanges, instances, movedInstances, transformJobs, &numJobTriangles);
+	int numJobs = (int)transformJobs.size();
+
+	if (numJobs > 0)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, transformJobBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformJob) * numJobs, transformJobs.data());
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	// Every instance that moves starts with an "empty" box, min is as big
+	// as it can be and max is as small as it can be, then the compute shader
+	// grows each box to fit around the triangles of its mesh. The boxes of
+	// the instances that didn't move are still around them from before.
+	int numInstances = (int)instances.size();
+	glm::ivec4 emptyMin = glm::ivec4(floatToOrderedInt(FLT_MAX));
+	glm::ivec4 emptyMax = glm::ivec4(floatToOrderedInt(-FLT_MAX));
+
+	glBindBuffer(GL_UNIFORM_BUFFER, meshBoundsBuffer);
+
+	for (int j = 0; j < numJobs; j++)
+	{
+		int i = transformJobs[j].instance;
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::ivec4) * i, sizeof(glm::ivec4), &emptyMin);
+		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::ivec4) * (numInstances + i), sizeof(glm::ivec4), &emptyMax);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	endPass(frameTimer, PASS_UPLOAD);
+
+	beginPass(frameTimer, PASS_TRANSFORM);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, matrixBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, meshBoundsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, meshRangeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, transformJobBuffer);
+
+	// one thread for every vertex of every job, and then one for every
+	// triangle, TRANSFORM_GROUP_SIZE threads in a group, and the last
+	// group is cut short by numJobThreads in the shader
+	int numJobThreads = numJobVertices + numJobTriangles;
+
+	if (numJobs > 0)
+	{
+		glUniform1i(num_job_vertices_loc, numJobVertices);
+		glUniform1i(num_jobs_loc, numJobs);
+		glUniform1i(num_job_threads_loc, numJobThreads);
+		glDispatchCompute((numJobThreads + TRANSFORM_GROUP_SIZE - 1) / TRANSFORM_GROUP_SIZE, 1, 1);
+	}
+	endPass(frameTimer, PASS_TRANSFORM);
+
+	// If no instance moved, the triangles and the trees are the same as before.
+	// Otherwise the trees are refit around the moved triangles on the GPU, or,
+	// if they got too slow, or an instance changed its mesh, the CPU builds
+	// them again while the GPU transforms the triangles.
+	if (numJobs > 0)
+	{
+		bool rebuild = !canRefitSceneBVH(instances.data(), numInstances, sceneBVH) || refitCostRatio() > BVH_REFIT_MAX_COST_RATIO;
+
+		if (rebuild)
+		{
+			beginPass(frameTimer, PASS_BVH);
+			buildSceneBVH(meshes.data(), instances.data(), numInstances, sceneBVH);
+			listRefitNodes(instances.data(), numInstances, sceneBVH, refitNodes, refitLevelStart);
+			endPass(frameTimer, PASS_BVH);
+
+			// The costs of the old trees mean nothing for the new ones
+			if (refitFence)
+			{
+				glDeleteSync(refitFence);
+				refitFence = 0;
+			}
+
+			beginPass(frameTimer, PASS_UPLOAD);
+			glBindBuffer(GL_UNIFORM_BUFFER, bvhNodeBuffer);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(BVHNode) * sceneBVH.nodes.size(), sceneBVH.nodes.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			glBindBuffer(GL_UNIFORM_BUFFER, bvhTriangleBuffer);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(int) * sceneBVH.triangles.size(), sceneBVH.triangles.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			glBindBuffer(GL_UNIFORM_BUFFER, refitNodeBuffer);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(RefitNode) * refitNodes.size(), refitNodes.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			glBindBuffer(GL_UNIFORM_BUFFER, nodeCostBuffer);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * sceneBVH.nodes.size(), nullptr, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			endPass(frameTimer, PASS_UPLOAD);
+
+			numBvhBuilds++;
+			treeChanged = true;
+		}
+		else
+		{
+			beginPass(frameTimer, PASS_REFIT);
+			refitTrees();
+			endPass(frameTimer, PASS_REFIT);
+
+			numBvhRefits++;
+		}
+	}
+#endif
+
+	//=================================================================
+
+	beginPass(frameTimer, PASS_UPLOAD);
+	uploadChanged(lightToFrag, lights, MAX_LIGHTS, uploadedLights);
+	endPass(frameTimer, PASS_UPLOAD);
+
+	beginPass(frameTimer, PASS_TRACE);
+
+	// Call the function we created to calculate the corner rays.
+	// We use the camera position, the focus position, and the up direction (just like glm::lookAt)
+	// We use Field of View, and aspect ratio (just like glm::perspective)
+	CameraRays cam = getCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), CAMERA_FOV, (float)width / height);
+	bool cameraChanged = memcmp(&cam, &uploadedCamera, sizeof(CameraRays)) != 0;
+
+	if (cameraChanged)
+	{
+		uploadedCamera = cam;
+		sceneVersion++;
+	}
+
+	if (tracedVersion == sceneVersion)
+	{
+		// Nothing moved, and nothing was sent, since traceImage
+		// was traced, so it is the same picture as this frame
+		presentTraceImage();
+	}
+	else
+	{
+#if TWO_LEVEL_BVH
+		// the vertices that were never moved
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertexObjToComp);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, positionObjToComp);
+#else
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, verticesCompToFrag);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, positionsCompToFrag);
+#endif
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightToFrag);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bvhNodeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bvhTriangleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, meshBoundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, indexToFrag);
+
+#if !TWO_LEVEL_BVH
+		// The fragment shader reads the triangles and the boxes that
+		// the compute shader wrote, so wait for it to finish writing them
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+#endif
+
+#if WAVEFRONT_TRACE
+		// Same camera as setCameraUniforms gives draw_program
+		traceWavefront(cam);
+#else
+		// start using draw program
+		glUseProgram(draw_program);
+
+		// The uniforms stay in draw_program from one frame to
+		// the next, so only the ones that changed are set
+		if (treeChanged)
+		{
+#if TWO_LEVEL_BVH
+			// Where the top level trees start in bvhNodeBuffer
+			glUniform1i(top_level_root_loc, sceneBVH.topLevelRoot);
+			glUniform1iv(shadow_root_loc, MAX_LIGHTS, sceneBVH.shadowRoot.data());
+#else
+			// Where every instance's tree starts in bvhNodeBuffer
+			glUniform1iv(bvh_root_loc, (int)sceneBVH.root.size(), sceneBVH.root.data());
+#endif
+		}
+
+#if !TWO_LEVEL_BVH
+		// The instances near every light, which can change when one moves
+		if (instancesChanged)
+		{
+			glUniform1iv(num_shadow_casters_loc, MAX_LIGHTS, shadowCasters.count);
+			glUniform1iv(shadow_casters_loc, (int)shadowCasters.instances.size(), shadowCasters.instances.data());
+		}
+#endif
+
+		if (cameraChanged)
+			setCameraUniforms(cam);
+
+#if COMPUTE_TRACE
+		// One group for every tile, the tiles on the right and
+		// top edges hang over when the size isn't a multiple
+		glBindImageTexture(0, traceImage, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		glDispatchCompute((width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE, (height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE, 1);
+#else
+		// Draw an image into traceImage, so that
+		// it is still there for the next frame
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, traceFramebuffer);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+#endif
+#endif
+		// Wait for the picture to be done, then copy it to the screen
+		presentTraceImage();
+		tracedVersion = sceneVersion;
+	}
+	endPass(frameTimer, PASS_TRACE);
+
+	// help us keep track of FPS
+	tempFrame++;
+	totalFrame++;
+
+	endPass(frameTimer, PASS_RENDER);
+	endTimedFrame(frameTimer);
+
+	if (timedFrames > 0 && totalFrame >= timedFrames)
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+}
+
+// This method reads the text from a file.
+// Realistically, we wouldn't want plain text shaders hardcoded in, we'd rather read them in from a separate file so that the shader code is separated.
+std::string readShader(std::string fileName)
+{
+	std::string shaderCode;
+	std::string line;
+
+	// We choose ifstream and std::ios::in because we are opening the file for input into our program.
+	// If we were writing to the file, we would use ofstream and std::ios::out.
+	std::ifstream file(fileName, std::ios::binary);
+
+	// This checks to make sure that we didn't encounter any errors when getting the file.
+	if (!file.good())
+	{
+		std::cout << "Can't read file: " << fileName.data() << std::endl;
+
+		// Return so we don't error out.
+		return "";
+	}
+
+	// Get size of file
+	file.seekg(0, std::ios::end);					
+	shaderCode.resize((unsigned int)file.tellg());	
+	file.seekg(0, std::ios::beg);					
+
+	// Dump the file into our array
+	file.read(&shaderCode[0], shaderCode.size());
+
+	// close the file
+	file.close();
+
+	return shaderCode;
+}
+
+// The shaders need to know how big the scene is when they are compiled, so that
+// their arrays have the right size, and their loops have a fixed number of steps.
+// Instead of typing the numbers into every shader, and changing every shader when
+// a model is added, they are counted after the scene is loaded, and this makes a
+// #define for each of them.
+std::string shaderDefines()
+{
+	std::string defines;
+
+	defines += "#define MAX_LIGHTS " + std::to_string(MAX_LIGHTS) + "\n";
+	defines += "#define MAX_MESHES " + std::to_string(meshes.size()) + "\n";
+	defines += "#define MAX_INSTANCES " + std::to_string(instances.size()) + "\n";
+	defines += "#define MAX_TEXTURES " + std::to_string(m_texture.size()) + "\n";
+	defines += "#define TWO_LEVEL_BVH " + std::to_string(TWO_LEVEL_BVH) + "\n";
+	defines += "#define BVH_MAX_DEPTH " + std::to_string(BVH_MAX_DEPTH) + "\n";
+	defines += "#define INSTANCE_MASK_CAMERA " + std::to_string(INSTANCE_MASK_CAMERA) + "\n";
+	defines += "#define INSTANCE_MASK_SHADOW " + std::to_string(INSTANCE_MASK_SHADOW) + "\n";
+	defines += "#define INSTANCE_MASK_LIGHT(l) (" + std::to_string(INSTANCE_MASK_LIGHT(0)) + " << (l))\n";
+	defines += "#define SHADOW_RAY_BIAS " + std::to_string(SHADOW_RAY_BIAS) + "\n";
+	defines += "#define COMPUTE_TRACE " + std::to_string(COMPUTE_TRACE) + "\n";
+	defines += "#define TRACE_TILE_SIZE " + std::to_string(TRACE_TILE_SIZE) + "\n";
+	defines += "#define TRACE_TILE_PIXELS " + std::to_string(TRACE_TILE_SIZE * TRACE_TILE_SIZE) + "\n";
+	defines += "#define WAVEFRONT_GENERATE " + std::to_string(WAVEFRONT_GENERATE) + "\n";
+	defines += "#define WAVEFRONT_EXTEND " + std::to_string(WAVEFRONT_EXTEND) + "\n";
+	defines += "#define WAVEFRONT_SHADE " + std::to_string(WAVEFRONT_SHADE) + "\n";
+	defines += "#define WAVEFRONT_SHADOW " + std::to_string(WAVEFRONT_SHADOW) + "\n";
+	defines += "#define WAVEFRONT_RESOLVE " + std::to_string(WAVEFRONT_RESOLVE) + "\n";
+	defines += "#define WAVEFRONT_TILE_SIZE " + std::to_string(WAVEFRONT_TILE_SIZE) + "\n";
+	defines += "#define WAVEFRONT_GROUP_SIZE " + std::to_string(WAVEFRONT_GROUP_SIZE) + "\n";
+	defines += "#define WAVEFRONT_COLOR_SCALE " + std::to_string(WAVEFRONT_COLOR_SCALE) + "\n";
+	defines += "#define WAVEFRONT_RAY_QUEUE " + std::to_string(WAVEFRONT_RAY_QUEUE) + "\n";
+	defines += "#define WAVEFRONT_HIT_QUEUE " + std::to_string(WAVEFRONT_HIT_QUEUE) + "\n";
+	defines += "#define WAVEFRONT_SHADOW_QUEUE " + std::to_string(WAVEFRONT_SHADOW_QUEUE) + "\n";
+	defines += "#define NUM_WAVEFRONT_QUEUES " + std::to_string(NUM_WAVEFRONT_QUEUES) + "\n";
+
+	return defines;
+}
+
+// The defines that only Compute.glsl uses, they go after the ones from
+// shaderDefines(). The transform benchmark compiles it with other
+// group sizes, and with the linear search that it used to have.
+std::string transformDefines(int groupSize, bool linearSearch)
+{
+	std::string defines;
+
+	defines += "#define TRANSFORM_GROUP_SIZE " + std::to_string(groupSize) + "\n";
+	defines += "#define TRANSFORM_LINEAR_SEARCH " + std::to_string(linearSearch ? 1 : 0) + "\n";
+
+	return defines;
+}
+
+// This method will consolidate some of the shader code we've written to return a GLuint to the compiled shader.
+// It requires the shader source code, the shader type, and the defines from shaderDefines(),
+// which are put into the code right after the #version line.
+GLuint createShader(std::string sourceCode, GLenum shaderType, const std::string& defines)
+{
+	// #version has to come before anything else in the shader, so the
+	// defines go on the line after it. The #line after the defines
+	// makes the line numbers in compile errors match the file again.
+	size_t version = sourceCode.find("#version");
+	size_t endOfLine = sourceCode.find('\n', version);
+
+	if (version != std::string::npos && endOfLine != std::string::npos)
+	{
+		// lines before the one after #version, counting from 1
+		int line = 2;
+		for (size_t i = 0; i < version; i++)
+			if (sourceCode[i] == '\n')
+				line++;
+
+		sourceCode.insert(endOfLine + 1, defines + "#line " + std::to_string(line) + "\n");
+	}
+
+	// glCreateShader, creates a shader given a type (such as GL_VERTEX_SHADER) and returns a GLuint reference to that shader.
+	GLuint shader = glCreateShader(shaderType);
+	const char *shader_code_ptr = sourceCode.c_str(); // We establish a pointer to our shader code string
+	const int shader_code_size = sourceCode.size();   // And we get the size of that string.
+
+	// glShaderSource replaces the source code in a shader object
+	// It takes the reference to the shader (a GLuint), a count of the number of elements in the string array (in case you're passing in multiple strings), a pointer to the string array
+	// that contains your source code, and a size variable determining the length of the array.
+	glShaderSource(shader, 1, &shader_code_ptr, &shader_code_size);
+	glCompileShader(shader); // This just compiles the shader, given the source code.
+
+	GLint isCompiled = 0;
+
+	// Check the compile status to see if the shader compiled correctly.
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+
+	if (isCompiled == GL_FALSE)
+	{
+		char infolog[1024];
+		glGetShaderInfoLog(shader, 1024, NULL, infolog);
+
+		if (shaderType == GL_VERTEX_SHADER)
+			printf("Vertex Shader\n");
+
+		if (shaderType == GL_FRAGMENT_SHADER)
+			printf("Fragment Shader\n");
+
+		if (shaderType == GL_COMPUTE_SHADER)
+			printf("Compute Shader\n");
+
+		// Print the compile error.
+		std::cout << "The shader failed to compile with the error:" << std::endl << infolog << std::endl;
+
+		// Provide the infolog in whatever manor you deem best.
+		// Exit with failure.
+		glDeleteShader(shader); // Don't leak the shader.
+
+		// NOTE: I almost always put a break point here, so that instead of the program continuing with a deleted/failed shader, it stops and gives me a chance to look at what may
+		// have gone wrong. You can check the console output to see what the error was, and usually that will point you in the right direction.
+	}
+
+	return shader;
+}
+
+// This makes a program out of the shaders in "sources" (the type of every
+// shader, and its source code), with the defines from shaderDefines(), and
+// puts the shaders that it compiled into "shaders". If the same program was
+// linked before, with the same sources, the same defines, and the same driver,
+// it is loaded from the .3Dprog file at "cachePath" instead (see ProgramCache.h),
+// nothing is compiled, and every one of "shaders" is 0.
+GLuint createProgram(const char* name, const char* cachePath, const std::vector<std::pair<GLenum, std::string>>& sources, const std::string& defines, GLuint* shaders)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Everything that changes what the compiler makes
+	std::vector<std::string> keyTexts = { defines };
+
+	for (int i = 0; i < (int)sources.size(); i++)
+	{
+		keyTexts.push_back(std::to_string(sources[i].first));
+		keyTexts.push_back(sources[i].second);
+	}
+
+	GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+
+	for (GLenum s : driverStrings)
+	{
+		const char* text = (const char*)glGetString(s);
+		keyTexts.push_back(text ? text : "");
+	}
+
+	unsigned long long key = programCacheKey(keyTexts);
+
+	GLuint program = glCreateProgram();
+	float compileMilliseconds = 0.0f;
+
+	if (loadProgramCache(cachePath, key, program, &compileMilliseconds))
+	{
+		double ms = 1000.0 * std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		printf("%s program: loaded from %s in %.2f ms, compiling took %.2f ms, %.2f ms saved\n",
+			name, cachePath, ms, compileMilliseconds, compileMilliseconds - ms);
+
+		for (int i = 0; i < (int)sources.size(); i++)
+			shaders[i] = 0;
+
+		return program;
+	}
+
+	// The driver only keeps the binary around if it is asked to before linking
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	for (int i = 0; i < (int)sources.size(); i++)
+	{
+		shaders[i] = createShader(sources[i].second, sources[i].first, defines);
+		glAttachShader(program, shaders[i]);
+	}
+
+	glLinkProgram(program);
+
+	// Asking for the link status waits for the driver to finish,
+	// so the time below is the whole time it took to compile
+	GLint isLinked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+
+	if (isLinked == GL_FALSE)
+	{
+		char infolog[1024];
+		glGetProgramInfoLog(program, 1024, NULL, infolog);
+
+		std::cout << name << " program failed to link with the error:" << std::endl << infolog << std::endl;
+		return program;
+	}
+
+	double ms = 1000.0 * std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	if (writeProgramCache(cachePath, key, program, (float)ms))
+		printf("%s program: compiled in %.2f ms, saved to %s\n", name, ms, cachePath);
+	else
+		printf("%s program: compiled in %.2f ms, could not save it to %s\n", name, ms, cachePath);
+
+	return program;
+}
+
+// This makes traceImage, the picture that every frame is traced into,
+// as big as the window, and attaches it to traceFramebuffer.
+// The window can change size, so it is made again when it does.
+void makeTraceImage()
+{
+	if (traceImage != 0)
+		glDeleteTextures(1, &traceImage);
+
+	if (traceFramebuffer == 0)
+		glGenFramebuffers(1, &traceFramebuffer);
+
+	// Like the other textures, the texture unit is the same number
+	// as the texture, so the textures in the shader stay where they are
+	glGenTextures(1, &traceImage);
+	glActiveTexture(GL_TEXTURE0 + traceImage);
+	glBindTexture(GL_TEXTURE_2D, traceImage);
+	// A window that is minimized is 0 x 0, and a texture can't be
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, std::max(width, 1), std::max(height, 1));
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, traceFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, traceImage, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+// Compiles FragmentShader.glsl once for every pass of WAVEFRONT_TRACE,
+// with the pass's WAVEFRONT_STAGE, and finds the uniforms of each one.
+// Every pass has its own .3Dprog file.
+void makeWavefrontPasses(const std::string& fragShader, const std::string& defines)
+{
+	const char* names[NUM_WAVEFRONT_PASSES] = { "Generate", "Extend", "Shade", "Shadow", "Resolve" };
+
+	for (int i = 0; i < NUM_WAVEFRONT_PASSES; i++)
+	{
+		WavefrontPass& pass = wavefrontPasses[i];
+
+		std::string name = std::string("Wavefront ") + names[i];
+		std::string cachePath = std::string("../Assets/Wavefront") + names[i] + "Program.3Dprog";
+
+		pass.program = createProgram(name.c_str(), cachePath.c_str(), { { GL_COMPUTE_SHADER, fragShader } },
+			defines + "#define WAVEFRONT_STAGE " + std::to_string(i + 1) + "\n", &pass.shader);
+
+		pass.eye = glGetUniformLocation(pass.program, "eye");
+		pass.ray00 = glGetUniformLocation(pass.program, "ray00");
+		pass.ray01 = glGetUniformLocation(pass.program, "ray01");
+		pass.ray10 = glGetUniformLocation(pass.program, "ray10");
+		pass.ray11 = glGetUniformLocation(pass.program, "ray11");
+		pass.screenSize = glGetUniformLocation(pass.program, "screenSize");
+		pass.bvhRoot = glGetUniformLocation(pass.program, "bvhRoot");
+		pass.topLevelRoot = glGetUniformLocation(pass.program, "topLevelRoot");
+		pass.shadowRoot = glGetUniformLocation(pass.program, "shadowRoot");
+		pass.numShadowCasters = glGetUniformLocation(pass.program, "numShadowCasters");
+		pass.shadowCasters = glGetUniformLocation(pass.program, "shadowCasters");
+
+		pass.textures.resize(m_texture.size());
+
+		for (int k = 0; k < (int)pass.textures.size(); k++)
+		{
+			std::string word = "textureTest[" + std::to_string(k) + "]";
+			pass.textures[k] = glGetUniformLocation(pass.program, word.c_str());
+		}
+	}
+}
+
+// This makes the queues of WAVEFRONT_TRACE big enough for one entry for every
+// pixel of the window. There is one camera ray for every pixel, and at most
+// one hit, and one shadow ray for every light, for every camera ray. Like
+// traceImage, they are made again when the window changes size.
+void makeWavefrontQueues()
+{
+	// A window that is minimized is 0 x 0
+	int numPixels = std::max(width * height, 1);
+
+	if (rayQueueBuffer == 0)
+	{
+		glGenBuffers(1, &rayQueueBuffer);
+		glGenBuffers(1, &hitQueueBuffer);
+		glGenBuffers(1, &shadowQueueBuffer);
+		glGenBuffers(1, &queueCountBuffer);
+		glGenBuffers(1, &pixelColorBuffer);
+	}
+
+	// Only the passes write to these, the CPU never touches them
+	glBindBuffer(GL_UNIFORM_BUFFER, rayQueueBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(WavefrontRay) * numPixels, nullptr, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, hitQueueBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(WavefrontHit) * numPixels, nullptr, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, shadowQueueBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(WavefrontShadowRay) * numPixels * MAX_LIGHTS, nullptr, GL_DYNAMIC_COPY);
+
+	// traceWavefront empties the queues at the start of every frame
+	glBindBuffer(GL_UNIFORM_BUFFER, queueCountBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(WavefrontQueueCount) * NUM_WAVEFRONT_QUEUES, nullptr, GL_DYNAMIC_DRAW);
+
+	// resolve sets every pixel back to 0 after it reads it,
+	// so they only have to be set to 0 here, once
+	unsigned int zero = 0;
+	glBindBuffer(GL_UNIFORM_BUFFER, pixelColorBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, 3 * sizeof(unsigned int) * numPixels, nullptr, GL_DYNAMIC_COPY);
+	glClearBufferData(GL_UNIFORM_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// This gives a texture that was already decoded by decodeTexture to OpenGL.
+// Decoding is slow, and doesn't need OpenGL, so it happens on the threads
+// of loadAssets, and only this part has to happen on the main thread.
+void LoadTexture(const CpuTexture& image, int index)
+{
+	// Create an OpenGL texture.
+	glGenTextures(1, &m_texture[index]);
+	glActiveTexture(GL_TEXTURE0 + m_texture[index]);
+	glBindTexture(GL_TEXTURE_2D, m_texture[index]);
+
+	// common parameters for all textures
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	// make the sampler if it does not exist
+	if (sampler == 0)
+		glGenSamplers(1, &sampler);
+
+	// bind the sampler to the texture
+	glBindSampler(m_texture[index], sampler);
+
+	// GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT = 34047
+	// GL_TEXTURE_MAX_ANISOTROPY_EXT = 34046
+
+	GLfloat maxAnisotropy = 0.0f;
+	glGetFloatv(34047, &maxAnisotropy);
+
+	// Trilinear Mipmapping
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glSamplerParameteri(sampler, 34046, (GLint)maxAnisotropy);
+
+	// Fill our openGL side texture object, with every mip level that
+	// decodeTexture baked, instead of making them with glGenerateMipmap
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.numLevels - 1);
+
+	for (int level = 0; level < image.numLevels; level++)
+	{
+		int width = image.levelWidth(level);
+		int height = image.levelHeight(level);
+
+		if (image.format == TEXTURE_FORMAT_BGRA8)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height,
+				0, GL_BGRA, GL_UNSIGNED_BYTE, image.levelData(level));
+		}
+		else
+		{
+			// The blocks go to the GPU as they are, the GPU reads them compressed
+			GLenum format = image.format == TEXTURE_FORMAT_BC1 ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,
+				0, (GLsizei)image.levelSize[level], image.levelData(level));
+		}
+	}
+}
+
+// This loads a mesh from its .3Dbin file, if it has one that is up to date.
+// If not, it reads the .3Dobj file, and makes the .3Dbin file for next time.
+// Returns true if the .3Dbin file was used.
+bool loadMesh(const char* path, Mesh* m)
+{
+	if (loadMeshCache(path, m))
+		return true;
+
+	// don't make a .3Dbin file of a mesh that could not be read,
+	// so that the .3Dobj file is tried again next time
+	if (!loadOBJ(path, m))
+		return false;
+
+	if (!writeMeshCache(path, *m))
+		printf("Could not write %s\n", meshCachePath(path).c_str());
+
+	return false;
+}
+
+// The file of car "car" of the catalog, counting from 0
+std::string carFileName(int car)
+{
+	return "../Assets/carsHigh/" + std::to_string(car + 1) + ".3Dobj";
+}
+
+// The .3Dcat file of the catalog, see MeshCatalogInfo
+std::string carCatalogFileName()
+{
+	return "../Assets/carsHigh/cars.3Dcat";
+}
+
+// How many cars are in the catalog. They are numbered
+// from 1, and the first number with no file is the end.
+int countCars()
+{
+	int n = 0;
+
+	while (std::ifstream(carFileName(n)).good())
+		n++;
+
+	return n;
+}
+
+// The file that each mesh is loaded from, an empty string if the program
+// makes it. The first car slot starts with the first car, the other
+// car slot starts empty, and carStreamer fills it.
+std::string meshFileName(int mesh)
+{
+	if (mesh == SKYBOX_MESH)
+		return "../Assets/Skybox.3Dobj";
+
+	if (mesh == WHEEL_MESH)
+		return "../Assets/wheel.3Dobj";
+
+	if (mesh == FIRST_CAR_MESH)
+		return carFileName(0);
+
+	return "";
+}
+
+// This loads a texture into system memory. The CPU renderer samples
+// it from there, and LoadTexture gives it to OpenGL. Nothing here
+// touches OpenGL, so it can run on any thread.
+// If the texture has a .3Dtex file that is up to date, its mip levels are
+// used, otherwise the image is decoded, and its mip levels are baked and
+// saved into the .3Dtex file for next time (see TextureCache.h).
+// Returns true if the .3Dtex file was used.
+bool decodeTexture(const char* file, CpuTexture* tex)
+{
+	if (loadTextureCache(file, tex))
+		return true;
+
+	// Load the file.
+	FIBITMAP* bitmap = FreeImage_Load(FreeImage_GetFileType(file), file);
+	// Convert the file to 32 bits so we can use it.
+	FIBITMAP* bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
+
+	int width = FreeImage_GetWidth(bitmap32);
+	int height = FreeImage_GetHeight(bitmap32);
+	std::vector<unsigned char> bgra(4 * width * height);
+
+	// Copy one row at a time, because FreeImage
+	// can add padding to the end of every row
+	for (int y = 0; y < height; y++)
+		memcpy(&bgra[4 * width * y], FreeImage_GetScanLine(bitmap32, y), 4 * width);
+
+	FreeImage_Unload(bitmap);
+	FreeImage_Unload(bitmap32);
+
+	bakeTexture(bgra.data(), width, height, bestTextureFormat(bgra.data(), width, height), tex);
+
+	if (!writeTextureCache(file, *tex))
+		printf("Could not write %s\n", textureCachePath(file).c_str());
+
+	return false;
+}
+
+// Runs every job on a pool of threads, one thread per core. Every thread
+// takes the next job that nobody has started yet, until there are none
+// left, the same way the threads of the CPU renderer take tiles. Big jobs
+// (a car) and small jobs (the wheel) can be mixed, because a thread that
+// gets a small job just takes another one sooner.
+// Returns when every job is done, and returns how many threads were used.
+int runJobs(const std::vector<std::function<void()>>& jobs)
+{
+	int numThreads = (int)std::thread::hardware_concurrency();
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	if (numThreads > (int)jobs.size())
+		numThreads = (int)jobs.size();
+
+	std::atomic<int> nextJob(0);
+
+	auto worker = [&]()
+	{
+		for (int i = nextJob++; i < (int)jobs.size(); i = nextJob++)
+			jobs[i]();
+	};
+
+	// This thread does jobs too, instead of only waiting
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(worker));
+
+	worker();
+
+	for (int i = 0; i < (int)threads.size(); i++)
+		threads[i].join();
+
+	return numThreads;
+}
+
+// Gives the car slots room for the biggest car of the catalog, so that every
+// car can be streamed into a slot, however many triangles it has. The size
+// of the biggest car is kept in the catalog's .3Dcat file, so only the cars
+// that were added, or changed, since it was written are loaded here, on the
+// job threads, and every other car is only looked up with getFileInfo.
+// The first time, that is every car, and each one gets its .3Dbin file,
+// so the streamer only maps it later.
+void sizeCarSlots()
+{
+	std::string catalogPath = carCatalogFileName();
+
+	MeshCatalogInfo info = {};
+	bool found = loadMeshCatalogInfo(catalogPath.c_str(), &info);
+
+	// The cars that the .3Dcat file doesn't know about yet
+	std::vector<int> newCars;
+
+	for (int car = 0; car < numCars; car++)
+	{
+		long long size, time;
+
+		if (car < info.numMeshes && getFileInfo(carFileName(car).c_str(), &size, &time) && time <= info.newestSourceTime)
+			continue;
+
+		newCars.push_back(car);
+	}
+
+	std::vector<Mesh> loaded(newCars.size());
+	std::vector<std::function<void()>> jobs;
+
+	for (int i = 0; i < (int)newCars.size(); i++)
+		jobs.push_back([&, i]() { loadMesh(carFileName(newCars[i]).c_str(), &loaded[i]); });
+
+	if (!jobs.empty())
+		runJobs(jobs);
+
+	for (int i = 0; i < (int)newCars.size(); i++)
+	{
+		info.maxTriangles = glm::max(info.maxTriangles, loaded[i].numTriangles);
+		info.maxVertices = glm::max(info.maxVertices, loaded[i].numVertices);
+
+		long long size, time;
+		if (getFileInfo(carFileName(newCars[i]).c_str(), &size, &time))
+			info.newestSourceTime = std::max(info.newestSourceTime, time);
+	}
+
+	if (!found || !newCars.empty() || info.numMeshes != numCars)
+	{
+		info.magic = MESH_CATALOG_MAGIC;
+		info.version = MESH_CATALOG_VERSION;
+		info.numMeshes = numCars;
+
+		if (!writeMeshCatalogInfo(catalogPath.c_str(), info))
+			printf("Could not write %s\n", catalogPath.c_str());
+	}
+
+	carSlotTriangles = info.maxTriangles;
+	carSlotVertices = info.maxVertices;
+
+	printf("Car slots: room for %d triangles, %d vertices (%d cars, %d loaded to find out)\n", carSlotTriangles, carSlotVertices, numCars, (int)newCars.size());
+}
+
+// How long one file took to load in loadAssets
+struct AssetTiming
+{
+	std::string name;
+	double seconds = 0.0;
+	bool cached = false;
+	bool texture = false;
+};
+
+// This loads every mesh in the scene, and every car, into "meshes", and if
+// "withTextures" is true, decodes every texture into "textureImages". Every
+// file is loaded on its own thread (see runJobs). Nothing here touches OpenGL,
+// so the CPU renderer uses this to load the scene too, and init() gives the
+// textures to OpenGL afterwards. Returns how many seconds it took.
+double loadAssets(bool withTextures)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	meshes.clear();
+	meshes.resize(NUM_MESHES);
+
+	textureImages.clear();
+	if (withTextures)
+		textureImages.resize(NUM_TEXTURES);
+
+	// The skybox, the wheel, and the cars
+	// will have one normal per vertex
+	std::vector<AssetTiming> timings;
+	std::vector<std::function<void()>> jobs;
+
+	for (int i = 0; i < (int)meshes.size(); i++)
+	{
+		std::string filename = meshFileName(i);
+
+		if (filename.empty())
+			continue;
+
+		int t = (int)timings.size();
+		timings.push_back(AssetTiming());
+		timings[t].name = filename;
+
+		jobs.push_back([&timings, t, i]()
+		{
+			auto begin = std::chrono::high_resolution_clock::now();
+			timings[t].cached = loadMesh(timings[t].name.c_str(), &meshes[i]);
+			meshes[i].calcPositions();
+			timings[t].seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		});
+	}
+
+	for (int i = 0; i < (int)textureImages.size(); i++)
+	{
+		int t = (int)timings.size();
+		timings.push_back(AssetTiming());
+		timings[t].name = textureFileNames[i];
+		timings[t].texture = true;
+
+		jobs.push_back([&timings, t, i]()
+		{
+			auto begin = std::chrono::high_resolution_clock::now();
+			timings[t].cached = decodeTexture(textureFileNames[i], &textureImages[i]);
+			timings[t].seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		});
+	}
+
+	int numThreads = runJobs(jobs);
+
+	// FLOOR_MESH is a plane, 4 corners and 2 triangles,
+	// and every corner has the same normal, pointing up
+	meshes[0].numVertices = 4;
+	meshes[0].vertices.resize(4);
+	meshes[0].vertices[0] = { glm::vec3(-5.0, 0.0, 5.0), 0, glm::vec3(0.0, 1.0, 0.0), 0 };
+	meshes[0].vertices[1] = { glm::vec3(-5.0, 0.0, -5.0), 0, glm::vec3(0.0, 1.0, 0.0), 1 };
+	meshes[0].vertices[2] = { glm::vec3(5.0, 0.0, -5.0), 1, glm::vec3(0.0, 1.0, 0.0), 1 };
+	meshes[0].vertices[3] = { glm::vec3(5.0, 0.0, 5.0), 1, glm::vec3(0.0, 1.0, 0.0), 0 };
+
+	meshes[0].numTriangles = 2;
+	meshes[0].indices = { 0, 1, 2, 0, 2, 3 };
+	meshes[0].calcPositions();
+
+	// The wheel and the first car get their LODs
+	auto lodStart = std::chrono::high_resolution_clock::now();
+
+	for (int i = WHEEL_MESH; i < FIRST_LOD_MESH; i++)
+		buildLods(meshes[i], &meshes[meshLod(i, 1)]);
+
+	double lodSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - lodStart).count();
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// The four wheels are four instances of meshes[WHEEL_MESH],
+	// and the first car is the one that is in the scene
+	initInstances(instances);
+
+	int totalTri = 0;
+	int biggestMesh = 0;
+	
+	for (int i = 0; i < (int)meshes.size(); i++)
+	{
+		int n = meshes[i].numTriangles;
+
+		if (biggestMesh < n)
+			biggestMesh = n;
+	}
+
+	// every instance is drawn, so every instance counts
+	for (int i = 0; i < (int)instances.size(); i++)
+		totalTri += meshes[instances[i].mesh].numTriangles;
+
+	printf("Num Meshes: %d\n", (int)meshes.size());
+	printf("Num Instances: %d\n", (int)instances.size());
+	printf("Max Triangles Per Mesh: %d\n", biggestMesh);
+	printf("Total triangles in scene: %d\n", totalTri);
+
+	// Every triangle used to be a struct triangle, now the triangles
+	// share their corners, and only 3 indices are stored per triangle
+	int carTriangles = 0;
+	int carVertices = 0;
+
+	for (int i = 0; i < NUM_CAR_SLOTS; i++)
+	{
+		carTriangles += meshes[FIRST_CAR_MESH + i].numTriangles;
+		carVertices += meshes[FIRST_CAR_MESH + i].numVertices;
+	}
+
+	if (carTriangles > 0)
+	{
+		double indexedSize = (double)sizeof(Vertex) * carVertices + 3.0 * sizeof(unsigned int) * carTriangles;
+
+		printf("Cars: %d triangles, %d vertices, %.1f bytes per triangle (%d without indices)\n",
+			carTriangles, carVertices, indexedSize / carTriangles, (int)sizeof(triangle));
+	}
+
+	for (int i = WHEEL_MESH; i < FIRST_LOD_MESH; i++)
+	{
+		if (meshes[i].numTriangles == 0)
+			continue;
+
+		printf("LODs of %s:", meshFileName(i).c_str());
+
+		for (int lod = 0; lod < NUM_LODS; lod++)
+			printf(" %d", meshes[meshLod(i, lod)].numTriangles);
+
+		printf(" triangles\n");
+	}
+
+	printf("Made the LODs in %.2f ms\n", 1000.0 * lodSeconds);
+
+	// How long every file took, and how long they would have
+	// taken all together if they were loaded one at a time
+	double work = 0.0;
+	int numCached = 0;
+	int numCachedTextures = 0;
+
+	for (int i = 0; i < (int)timings.size(); i++)
+	{
+		const char* cache = timings[i].texture ? " (.3Dtex)" : " (.3Dbin)";
+
+		printf("  %-30s %7.2f ms%s\n", timings[i].name.c_str(), 1000.0 * timings[i].seconds, timings[i].cached ? cache : "");
+
+		work += timings[i].seconds;
+		if (timings[i].cached && timings[i].texture)
+			numCachedTextures++;
+		else if (timings[i].cached)
+			numCached++;
+	}
+
+	printf("Loaded %d files (%d meshes from .3Dbin, %d textures from .3Dtex) in %.2f ms on %d threads, %.2f ms of work, %.1fx speedup\n",
+		(int)timings.size(), numCached, numCachedTextures, 1000.0 * seconds, numThreads, 1000.0 * work, work / seconds);
+
+	return seconds;
+}
+
+// Initialization code
+void init()
+{
+	glewExperimental = GL_TRUE;
+	// Initializes the glew library
+	glewInit();
+
+	// Load all the meshes and textures on the CPU side, before the
+	// shaders, because the shaders need to know how many there are
+	loadAssets(true);
+
+	// Before anything on the GPU is given its size
+	sizeCarSlots();
+
+	glEnable(GL_TEXTURE_2D);
+
+	// Load Texture ========================================
+
+	// OpenGL can only be used from this thread, so the
+	// textures are decoded on many threads, and given
+	// to OpenGL here, one at a time
+	m_texture.resize(textureImages.size());
+
+	for (int i = 0; i < (int)textureImages.size(); i++)
+		LoadTexture(textureImages[i], i);
+
+	// OpenGL has its own copy now
+	textureImages.clear();
+
+	// =====================================================
 
 	// Read in the shader code from a file.
 	std::string vertShader = readShader("../Assets/VertexShader.glsl");
 	std::string fragShader = readShader("../Assets/FragmentShader.glsl");
 	std::string compShader = readShader("../Assets/Compute.glsl");
 
-	// createShader consolidates all of the shader compilation code
-	vertex_shader = createShader(vertShader, GL_VERTEX_SHADER);
-	fragment_shader = createShader(fragShader, GL_FRAGMENT_SHADER);
-	compute_shader = createShader(compShader, GL_COMPUTE_SHADER);
+	// createShader consolidates all of the shader compilation code,
+	// and createProgram only calls it if the program isn't in its .3Dprog file
+	std::string defines = shaderDefines();
 
 	// A shader is a program that runs on your GPU instead of your CPU. In this sense, OpenGL refers to your groups of shaders as "programs".
-	// Using glCreateProgram creates a shader program and returns a GLuint reference to it.
-	draw_program = glCreateProgram();
-	glAttachShader(draw_program, vertex_shader);		// This attaches our vertex shader to our program.
-	glAttachShader(draw_program, fragment_shader);	// This attaches our fragment shader to our program.
-	glLinkProgram(draw_program);					// Link the program
+	// createProgram uses glCreateProgram, which creates a shader program and returns a GLuint reference to it.
+#if WAVEFRONT_TRACE
+	// The fragment shader, compiled as a compute shader for every pass,
+	// see WAVEFRONT_TRACE. There is no draw_program.
+	makeWavefrontPasses(fragShader, defines);
+	makeWavefrontQueues();
+#elif COMPUTE_TRACE
+	// The fragment shader, compiled as a compute shader, see COMPUTE_TRACE
+	draw_program = createProgram("Draw", "../Assets/DrawProgram.3Dprog",
+		{ { GL_COMPUTE_SHADER, fragShader } }, defines, &fragment_shader);
+#else
+	GLuint drawShaders[2];
+	draw_program = createProgram("Draw", "../Assets/DrawProgram.3Dprog",
+		{ { GL_VERTEX_SHADER, vertShader }, { GL_FRAGMENT_SHADER, fragShader } }, defines, drawShaders);
+	vertex_shader = drawShaders[0];
+	fragment_shader = drawShaders[1];
+#endif
 	// End of shader and program creation
 
+	// Every way of tracing draws into traceImage, which is then copied to
+	// the screen, so that a frame where nothing changed can show it again
+	makeTraceImage();
+
+#if !WAVEFRONT_TRACE
 	// Tell our code to use the program
 	glUseProgram(draw_program);
 
@@ -596,30 +2429,46 @@ void init()
 	ray01 = glGetUniformLocation(draw_program, "ray01");
 	ray10 = glGetUniformLocation(draw_program, "ray10");
 	ray11 = glGetUniformLocation(draw_program, "ray11");
+	bvh_root_loc = glGetUniformLocation(draw_program, "bvhRoot");
+	top_level_root_loc = glGetUniformLocation(draw_program, "topLevelRoot");
+	shadow_root_loc = glGetUniformLocation(draw_program, "shadowRoot");
+	num_shadow_casters_loc = glGetUniformLocation(draw_program, "numShadowCasters");
+	shadow_casters_loc = glGetUniformLocation(draw_program, "shadowCasters");
 
 	char* word = (char*)malloc(100);
 
-	for (int i = 0; i < MAX_MESHES; i++)
+	tex_loc.resize(m_texture.size());
+
+	for (int i = 0; i < (int)tex_loc.size(); i++)
 	{
 		sprintf(word, "textureTest[%d]", i);
 		tex_loc[i] = glGetUniformLocation(draw_program, word);
+
+		// Give every texture to the shader, the instance table says which
+		// instance uses which texture. The textures never change, so this
+		// stays in draw_program, and renderScene doesn't set it again.
+		glUniform1i(tex_loc[i], m_texture[i]);
 	}
 
 	delete word;
+#endif
 
-	glEnable(GL_TEXTURE_2D);
+	transform_program = createProgram("Transform", "../Assets/TransformProgram.3Dprog",
+		{ { GL_COMPUTE_SHADER, compShader } }, defines + transformDefines(TRANSFORM_GROUP_SIZE, false), &compute_shader);
 
-	// Load Texture ========================================
+	num_job_vertices_loc = glGetUniformLocation(transform_program, "numJobVertices");
+	num_jobs_loc = glGetUniformLocation(transform_program, "numJobs");
+	num_job_threads_loc = glGetUniformLocation(transform_program, "numJobThreads");
 
-	LoadTexture((char*)"../Assets/road.png", 0);
-	LoadTexture((char*)"../Assets/CarColor.png", 1);
-	LoadTexture((char*)"../Assets/night1.png", 2);
+#if !TWO_LEVEL_BVH
+	std::string refitShader = readShader("../Assets/Refit.glsl");
 
-	// =====================================================
+	refit_program = createProgram("Refit", "../Assets/RefitProgram.3Dprog", { { GL_COMPUTE_SHADER, refitShader } },
+		defines + "#define REFIT_GROUP_SIZE " + std::to_string(REFIT_GROUP_SIZE) + "\n#define BVH_BOUNDS_EPSILON " + std::to_string(BVH_BOUNDS_EPSILON) + "\n", &refit_shader);
 
-	transform_program = glCreateProgram();
-	glAttachShader(transform_program, compute_shader);
-	glLinkProgram(transform_program);					// Link the program
+	refit_level_start_loc = glGetUniformLocation(refit_program, "levelStart");
+	refit_level_count_loc = glGetUniformLocation(refit_program, "levelCount");
+#endif
 	// End of shader and program creation
 
 	glGenBuffers(1, &matrixBuffer);
@@ -627,82 +2476,217 @@ void init()
 	glBufferData(GL_UNIFORM_BUFFER, matrixBufferSize, nullptr, GL_DYNAMIC_DRAW); // static because CPU won't touch it
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	char filename[100];
+	glGenBuffers(1, &bvhNodeBuffer);
+	glGenBuffers(1, &bvhTriangleBuffer);
+
+	// This is reset and filled every frame in renderScene()
+	glGenBuffers(1, &meshBoundsBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, meshBoundsBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::ivec4) * instances.size(), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// There is never more than one job for every instance
+	glGenBuffers(1, &transformJobBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, transformJobBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(TransformJob) * instances.size(), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+#if !TWO_LEVEL_BVH
+	// The nodes and their costs are given their size every time the trees
+	// are built, the cost of every tree is written by Refit.glsl
+	glGenBuffers(1, &refitNodeBuffer);
+	glGenBuffers(1, &nodeCostBuffer);
+	glGenBuffers(1, &treeCostBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, treeCostBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * instances.size(), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glGenBuffers(1, &treeCostReadBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, treeCostReadBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * instances.size(), nullptr, GL_STREAM_READ);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+
+	// This sends our OBJ data to the Compute Shader, the first car, and every
+	// other mesh, one time. Only the car slots are ever written again, when
+	// the next car is copied into the slot that is not shown (see beginCarUpload).
+	int numResidentVertices = 0;
+	int numResidentTriangles = packMeshes(meshes, meshRanges, &numResidentVertices);
+	vertexObjToCompSize = sizeof(Vertex) * numResidentVertices;
+	indexToFragSize = 3 * sizeof(unsigned int) * numResidentTriangles;
+
+	printf("Resident geometry: %d triangles, %d vertices, %d bytes (%d bytes as triangles)\n",
+		numResidentTriangles, numResidentVertices, vertexObjToCompSize + indexToFragSize, (int)sizeof(triangle) * numResidentTriangles);
+
+	glGenBuffers(1, &vertexObjToComp);
+	glBindBuffer(GL_UNIFORM_BUFFER, vertexObjToComp);
+	glBufferData(GL_UNIFORM_BUFFER, vertexObjToCompSize, nullptr, GL_STATIC_DRAW); // static because CPU won't touch it
+
+	// Each mesh goes straight from where it is in memory to where it goes
+	// in the buffer. A mesh from a .3Dbin file goes straight from the file.
+	for (int i = 0; i < (int)meshes.size(); i++)
+		if (meshRanges[i].numVertices > 0)
+			glBufferSubData(GL_UNIFORM_BUFFER, sizeof(Vertex) * meshRanges[i].firstVertex, sizeof(Vertex) * meshRanges[i].numVertices, meshes[i].vertexData());
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// The indices start at 0 in every mesh, so they can be copied as they are,
+	// the shaders add the instance's firstVertex to them
+	glGenBuffers(1, &indexToFrag);
+	glBindBuffer(GL_UNIFORM_BUFFER, indexToFrag);
+	glBufferData(GL_UNIFORM_BUFFER, indexToFragSize, nullptr, GL_STATIC_DRAW);
+
+	for (int i = 0; i < (int)meshes.size(); i++)
+		if (meshRanges[i].numTriangles > 0)
+			glBufferSubData(GL_UNIFORM_BUFFER, 3 * sizeof(unsigned int) * meshRanges[i].firstTriangle, 3 * sizeof(unsigned int) * meshRanges[i].numTriangles, meshes[i].indexData());
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// The positions go in the same order as the indices
+	positionObjToCompSize = sizeof(TrianglePositions) * numResidentTriangles;
+
+	printf("Triangle positions: %d bytes, %d bytes per triangle\n", positionObjToCompSize, (int)sizeof(TrianglePositions));
+
+	glGenBuffers(1, &positionObjToComp);
+	glBindBuffer(GL_UNIFORM_BUFFER, positionObjToComp);
+	glBufferData(GL_UNIFORM_BUFFER, positionObjToCompSize, nullptr, GL_STATIC_DRAW);
+
+	for (int i = 0; i < (int)meshes.size(); i++)
+		if (meshRanges[i].numTriangles > 0)
+			glBufferSubData(GL_UNIFORM_BUFFER, sizeof(TrianglePositions) * meshRanges[i].firstTriangle, sizeof(TrianglePositions) * meshRanges[i].numTriangles, meshes[i].positions.data());
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glGenBuffers(1, &meshRangeBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, meshRangeBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(MeshRange) * meshRanges.size(), meshRanges.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	numInstanceVertices = calcInstanceOffsets(meshRanges, instances, &numInstanceTriangles);
+
+	glGenBuffers(1, &verticesCompToFrag);
+	glGenBuffers(1, &positionsCompToFrag);
 
-	cars = new Mesh[16];
-	for (int i = 0; i < 16; i++)
+#if !TWO_LEVEL_BVH
+	// Make room for the world space copy of every instance, with the
+	// biggest car that fits in a car slot, so that it never has to grow.
+	// The compute shader writes every vertex and triangle of these
+	// every frame, so they do not need to be filled with anything here
+	std::vector<MeshRange> fullSlots = meshRanges;
+	std::vector<Instance> fullInstances = instances;
+
+	for (int i = 0; i < (int)fullSlots.size(); i++)
 	{
-		sprintf(filename, "../Assets/carsHigh/%d.3Dobj", i + 1);
-		loadOBJ((char*)filename, &cars[i]);
+		if (isCarSlot(i))
+		{
+			fullSlots[i].numTriangles = glm::max(fullSlots[i].numTriangles, carSlotTriangles);
+			fullSlots[i].numVertices = glm::max(fullSlots[i].numVertices, carSlotVertices);
+		}
 	}
 
-	meshes = new Mesh[MAX_MESHES];
+	int mostTriangles = 0;
+	int mostVertices = calcInstanceOffsets(fullSlots, fullInstances, &mostTriangles);
 
-	meshes[0].numTriangles = 2;
-	meshes[0].triangles[0].pos[0] = glm::vec4(-5.0, 0.0, 5.0, 1.0); 
-	meshes[0].triangles[0].pos[1] = glm::vec4(-5.0, 0.0, -5.0, 1.0);
-	meshes[0].triangles[0].pos[2] = glm::vec4(5.0, 0.0, -5.0, 1.0);
-	meshes[0].triangles[0].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[0].triangles[0].uv[1] = glm::vec4(0, 1, 1, 1);
-	meshes[0].triangles[0].uv[2] = glm::vec4(1, 1, 1, 1);
-	meshes[0].triangles[0].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0); 
-
-	meshes[0].triangles[1].pos[0] = glm::vec4(-5.0, 0.0, 5.0, 1.0);
-	meshes[0].triangles[1].pos[1] = glm::vec4(5.0, 0.0, -5.0, 1.0);
-	meshes[0].triangles[1].pos[2] = glm::vec4(5.0, 0.0, 5.0, 1.0);
-	meshes[0].triangles[1].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[0].triangles[1].uv[1] = glm::vec4(1, 1, 1, 1);
-	meshes[0].triangles[1].uv[2] = glm::vec4(1, 0, 1, 1);
-	meshes[0].triangles[1].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
-
-	// Mesh 0 is a plane
-	// It should have one normal per triangle
-	// dulicate the first normal we give it
-	for (int i = 0; i < meshes[0].numTriangles; i++)
-	{
-		meshes[0].triangles[i].normal[1] = meshes[0].triangles[i].normal[0];
-		meshes[0].triangles[i].normal[2] = meshes[0].triangles[i].normal[0];
-	}
-
-	// Mesh 1: Skybox
-	// Mesh 2: Car
-	// Mesh 3: Wheels
-	// It will have one normal per vertex
-	loadOBJ((char*)"../Assets/Skybox.3Dobj", &meshes[1]);
-	loadOBJ((char*)"../Assets/wheel.3Dobj", &meshes[3]);
-	
-	// copy one wheel to make 4 wheels
-	for (int i = 0; i < 3; i++)
-		memcpy(&meshes[4+i], &meshes[3], sizeof(Mesh));
+	verticesCompToFragSize = sizeof(Vertex) * mostVertices;
+	positionsCompToFragSize = sizeof(TrianglePositions) * mostTriangles;
 
-	int totalTri = 0;
-	int biggestMesh = 0;
-	
-	for (int i = 0; i < MAX_MESHES; i++)
-	{
-		int n = meshes[i].numTriangles;
+	glBindBuffer(GL_UNIFORM_BUFFER, verticesCompToFrag);
+	glBufferData(GL_UNIFORM_BUFFER, verticesCompToFragSize, nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-		if (biggestMesh < n)
-			biggestMesh = n;
+	glBindBuffer(GL_UNIFORM_BUFFER, positionsCompToFrag);
+	glBufferData(GL_UNIFORM_BUFFER, positionsCompToFragSize, nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
 
-		totalTri += n;
-	}
+	// This is filled every frame in renderScene()
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, instanceBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Instance) * instances.size(), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	int n = cars[0].numTriangles;
+#if TWO_LEVEL_BVH
+	// Build the trees of the meshes once, and send them to the GPU once.
+	// A top level tree has no more than one leaf per instance, so it never
+	// has more than 2 * instances.size() nodes, and there is room at the end
+	// for the tree of the camera rays and the tree of every light.
+	buildBottomLevelBVH();
 
-	if (biggestMesh < n)
-		biggestMesh = n;
+	int numTopLevelTrees = 1 + MAX_LIGHTS;
+	bvhNodeBufferSize = sizeof(BVHNode) * (sceneBVH.bottomLevelNodes + numTopLevelTrees * 2 * (int)instances.size());
+	bvhTriangleBufferSize = sizeof(int) * (sceneBVH.bottomLevelTriangles + numTopLevelTrees * (int)instances.size());
 
-	totalTri += n;
+	printf("Bottom level BVH: %d nodes, %d triangles\n", sceneBVH.bottomLevelNodes, sceneBVH.bottomLevelTriangles);
 
-	printf("Num Meshes: %d\n", MAX_MESHES);
-	printf("Max Triangles Per Mesh: %d\n", biggestMesh);
-	printf("Total triangles in scene: %d\n", totalTri);
+	glBindBuffer(GL_UNIFORM_BUFFER, bvhNodeBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, bvhNodeBufferSize, nullptr, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(BVHNode) * sceneBVH.bottomLevelNodes, sceneBVH.nodes.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, bvhTriangleBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, bvhTriangleBufferSize, nullptr, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(int) * sceneBVH.bottomLevelTriangles, sceneBVH.triangles.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
 
 	glGenBuffers(1, &lightToFrag);
 	glBindBuffer(GL_UNIFORM_BUFFER, lightToFrag);
-	glBufferData(GL_UNIFORM_BUFFER, lightToFrag, nullptr, GL_DYNAMIC_DRAW); // static because CPU won't touch it
+	glBufferData(GL_UNIFORM_BUFFER, lightToFragSize, nullptr, GL_DYNAMIC_DRAW); // renderScene only sends the lights that changed
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// Room for every LOD of one car as big as a car slot, and their trees. With
+	// GL_MAP_PERSISTENT_BIT it can stay mapped while the GPU copies from
+	// it, and with GL_MAP_COHERENT_BIT the GPU sees what the memcpy wrote
+	// without a glFlushMappedBufferRange.
+	stagingBufferSize = sizeof(Vertex) * carSlotVertices + (3 * sizeof(unsigned int) + sizeof(TrianglePositions)) * carSlotTriangles;
+#if TWO_LEVEL_BVH
+	stagingBufferSize += (2 * sizeof(BVHNode) + sizeof(int)) * carSlotTriangles;
+#endif
+	stagingBufferSize *= NUM_LODS;
+
+	GLbitfield stagingFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glGenBuffers(1, &stagingBuffer);
+	glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+	glBufferStorage(GL_COPY_READ_BUFFER, stagingBufferSize, nullptr, stagingFlags);
+	stagingMemory = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, stagingBufferSize, stagingFlags);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	// Car 0 is already in slot 0, so the streamer starts with car 1.
+	// Every car fits in a car slot (see sizeCarSlots), unless its file could
+	// not be read, or was changed to a bigger car after the program started.
+	startCarStreamer(carStreamer, 1, numCars, [](int car, StreamedCar* out)
+	{
+		std::string filename = carFileName(car);
+		loadMesh(filename.c_str(), &out->lods[0]);
+
+		Mesh& mesh = out->lods[0];
+
+		if (mesh.numTriangles == 0)
+		{
+			printf("Skipping %s, it could not be read\n", filename.c_str());
+			return false;
+		}
+
+		if (mesh.numTriangles > carSlotTriangles || mesh.numVertices > carSlotVertices)
+		{
+			printf("Skipping %s, it changed since the program started, it has %d triangles and %d vertices, a car slot has room for %d and %d\n",
+				filename.c_str(), mesh.numTriangles, mesh.numVertices, carSlotTriangles, carSlotVertices);
+			return false;
+		}
+
+		mesh.calcPositions();
+		buildLods(mesh, &out->lods[1]);
+
+#if TWO_LEVEL_BVH
+		for (int lod = 0; lod < NUM_LODS; lod++)
+			out->bvhRoot[lod] = buildMeshBVH(out->lods[lod], glm::mat4(), out->bvh[lod]);
+#endif
+		return true;
+	});
+
+	// The queries that time every pass of every frame
+	initFrameTimer(frameTimer);
 }
 
 void window_size_callback(GLFWwindow* window, int w, int h)
@@ -710,10 +2694,65 @@ void window_size_callback(GLFWwindow* window, int w, int h)
 	width = w;
 	height = h;
 	glViewport(0, 0, width, height);
+
+#if WAVEFRONT_TRACE
+	makeWavefrontQueues();
+#endif
+	makeTraceImage();
+
+	// traceImage is new, and the camera rays change with the
+	// shape of the window, so the next frame has to be traced
+	sceneVersion++;
+}
+
+// Space stops the animation, and starts it again
+void key_callback(GLFWwindow*, int key, int, int action, int)
+{
+	if (key != GLFW_KEY_SPACE || action != GLFW_PRESS)
+		return;
+
+	if (!paused)
+		pausedAt = glfwGetTime();
+	else
+		pausedFor += glfwGetTime() - pausedAt;
+
+	paused = !paused;
 }
 
 int main(int argc, char **argv)
 {
+	numCars = countCars();
+
+	// The benchmarks, and the CPU renderer, read the rest
+	// of the command line themselves (see Benchmarks.h)
+	if (argc > 1 && strcmp(argv[1], "-objbench") == 0)
+		return runObjParserBenchmark(argc, argv);
+
+	if (argc > 1 && strcmp(argv[1], "-meshcache") == 0)
+		return runMeshCacheBenchmark(argc, argv);
+
+	if (argc > 1 && strcmp(argv[1], "-lodbench") == 0)
+		return runLodBenchmark(argc, argv);
+
+	if (argc > 1 && strcmp(argv[1], "-texcache") == 0)
+		return runTextureCacheBenchmark(argc, argv);
+
+	if (argc > 1 && strcmp(argv[1], "-cpu") == 0)
+		return runCpuRenderer(argc, argv);
+
+	// "-transformbench" needs the window, so it runs right after init()
+	bool transformBenchmark = argc > 1 && strcmp(argv[1], "-transformbench") == 0;
+
+	// Run with "-timings" to save the time every pass of the frame
+	// took into a .csv file when the window closes, and optionally
+	// give the name of the file, and a number of frames after
+	// which the window closes on its own
+	if (argc > 1 && strcmp(argv[1], "-timings") == 0)
+	{
+		timingsPath = argc > 2 ? argv[2] : "frame_times.csv";
+		timedFrames = argc > 3 ? atoi(argv[3]) : 0;
+	}
+
 	// Initializes the GLFW library
 	glfwInit();
 
@@ -724,6 +2763,9 @@ int main(int argc, char **argv)
 	// This allows us to resize the window when we want to
 	glfwSetWindowSizeCallback(window, window_size_callback);
 
+	// Space pauses the animation, see key_callback
+	glfwSetKeyCallback(window, key_callback);
+
 	// Makes the OpenGL context current for the created window.
 	glfwMakeContextCurrent(window);
 
@@ -733,6 +2775,14 @@ int main(int argc, char **argv)
 	// Initializes most things needed before the main loop
 	init();
 
+	if (transformBenchmark)
+	{
+		int result = runTransformBenchmark(argc, argv);
+		stopCarStreamer(carStreamer);
+		glfwTerminate();
+		return result;
+	}
+
 	// Make the BYTE array, factor of 3 because it's RGB.
 	// This will hold each screenshot
 	unsigned char* pixels = new unsigned char[3 * width * height];
@@ -750,12 +2800,57 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 
+	// How long every pass took, on average, and in the slowest frames
+	freeFrameTimer(frameTimer);
+	printFrameTimes(frameTimer);
+
+#if !TWO_LEVEL_BVH
+	printf("The trees were built %d times, and refit %d times\n", numBvhBuilds, numBvhRefits);
+#endif
+
+	if (timingsPath)
+	{
+		if (writeFrameTimesCsv(frameTimer, timingsPath))
+			printf("Saved the frame times to %s\n", timingsPath);
+		else
+			printf("Could not save the frame times to %s\n", timingsPath);
+	}
+
 	// After the program is over, cleanup your data!
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
 	glDeleteProgram(draw_program);
+
+	for (int i = 0; i < NUM_WAVEFRONT_PASSES; i++)
+	{
+		glDeleteShader(wavefrontPasses[i].shader);
+		glDeleteProgram(wavefrontPasses[i].program);
+	}
+
+	glDeleteBuffers(1, &rayQueueBuffer);
+	glDeleteBuffers(1, &hitQueueBuffer);
+	glDeleteBuffers(1, &shadowQueueBuffer);
+	glDeleteBuffers(1, &queueCountBuffer);
+	glDeleteBuffers(1, &pixelColorBuffer);
+	glDeleteBuffers(1, &transformJobBuffer);
+
+#if !TWO_LEVEL_BVH
+	glDeleteShader(refit_shader);
+	glDeleteProgram(refit_program);
+	glDeleteBuffers(1, &refitNodeBuffer);
+	glDeleteBuffers(1, &nodeCostBuffer);
+	glDeleteBuffers(1, &treeCostBuffer);
+	glDeleteBuffers(1, &treeCostReadBuffer);
+
+	if (refitFence)
+		glDeleteSync(refitFence);
+#endif
+	glDeleteTextures(1, &traceImage);
+	glDeleteFramebuffers(1, &traceFramebuffer);
 	delete[] pixels;
 
+	stopCarStreamer(carStreamer);
+
 	// Frees up GLFW memory
 	glfwTerminate();
 